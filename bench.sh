@@ -0,0 +1,73 @@
+#!/bin/sh
+
+# Throughput benchmarks for the gzdec element. Run after installing the plugin (see test.sh).
+
+export GST_PLUGIN_PATH=/usr/local/lib/gstreamer-1.0
+export GST_DEBUG="*:1"
+
+BENCH_DIR=${BENCH_DIR:-/tmp/gzdec-bench}
+BENCH_COPIES=${BENCH_COPIES:-200}
+
+mkdir -p $BENCH_DIR
+
+echo "Producing benchmark data ($BENCH_COPIES copies of test/test.tiff):\n"
+
+rm -f $BENCH_DIR/bench.raw
+for i in $(seq $BENCH_COPIES); do
+        cat test/test.tiff >> $BENCH_DIR/bench.raw
+done
+gzip -c $BENCH_DIR/bench.raw > $BENCH_DIR/bench.gz
+bzip2 -zc $BENCH_DIR/bench.raw > $BENCH_DIR/bench.bz2
+ls -l $BENCH_DIR
+
+# Prints the wall clock seconds a pipeline takes
+run() {
+        start=$(date +%s.%N)
+        gst-launch-1.0 -q "$@" > /dev/null
+        end=$(date +%s.%N)
+        echo "$end - $start" | bc
+}
+
+echo "\nDecoding throughput (seconds):\n"
+
+for input in bench.gz bench.bz2; do
+        for low_memory in false true; do
+                echo "$input low-memory=$low_memory: $(run filesrc location=$BENCH_DIR/$input ! gzdec low-memory=$low_memory ! fakesink)"
+        done
+done
+
+echo "\nStartup/teardown latency (NULL -> PLAYING -> EOS -> NULL, milliseconds per cycle):\n"
+
+# A tiny stream, so that a cycle is all state changes. A reused pipeline is what
+# per-file pipelines recycling their elements see, a new one adds element creation.
+BENCH_CYCLES=${BENCH_CYCLES:-1000}
+head -c 4096 test/test.tiff | gzip -c > $BENCH_DIR/small.gz
+
+python3 - $BENCH_DIR/small.gz $BENCH_CYCLES <<'EOF'
+import sys, time
+import gi
+gi.require_version('Gst', '1.0')
+from gi.repository import Gst
+
+Gst.init(None)
+location, cycles = sys.argv[1], int(sys.argv[2])
+description = 'filesrc location=%s ! gzdec ! fakesink' % location
+
+def cycle(pipeline):
+        start = time.perf_counter()
+        pipeline.set_state(Gst.State.PLAYING)
+        pipeline.get_bus().timed_pop_filtered(Gst.CLOCK_TIME_NONE, Gst.MessageType.EOS | Gst.MessageType.ERROR)
+        pipeline.set_state(Gst.State.NULL)
+        return (time.perf_counter() - start) * 1000
+
+def report(name, times):
+        times.sort()
+        print('%s: mean %.3f, median %.3f, p99 %.3f' % (name, sum(times) / len(times),
+              times[len(times) // 2], times[int(len(times) * 0.99)]))
+
+pipeline = Gst.parse_launch(description)
+report('reused pipeline', [cycle(pipeline) for i in range(cycles)])
+report('new pipeline', [cycle(Gst.parse_launch(description)) for i in range(cycles)])
+EOF
+
+echo "\n"
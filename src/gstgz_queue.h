@@ -0,0 +1,76 @@
+#pragma once
+
+/* Queue and task plumbing shared by the decoder and the encoder.
+
+   Both elements are built the same way: the chain function appends to an input queue
+   that an input task drains, the input task appends to an output queue that the srcpad
+   task pushes from. Each queue has its mutex, the cond its task waits on while it is
+   empty and a resume flag to wake that task up without data (EOS, pause, stop).
+   The macros below work on any element with these fields:
+
+   input_queue_mutex, input_queue_run_cond, input_task_resume, input_task, input_task_mutex
+   output_queue_mutex, output_queue_run_cond, srcpad_task_resume, srcpad_task, srcpad */
+
+// Mutex convenience macros
+
+#define INPUT_TASK_LOCK(element) REC_MUTEX_LOCK(&element->input_task_mutex)
+#define INPUT_TASK_UNLOCK(element) REC_MUTEX_UNLOCK(&element->input_task_mutex)
+#define SRCPAD_TASK_LOCK(element) REC_MUTEX_LOCK(GST_PAD_GET_STREAM_LOCK(element->srcpad))
+#define SRCPAD_TASK_UNLOCK(element) REC_MUTEX_UNLOCK(GST_PAD_GET_STREAM_LOCK(element->srcpad))
+
+#define INPUT_QUEUE_WAIT(element) g_cond_wait(&element->input_queue_run_cond, &element->input_queue_mutex)
+#define INPUT_QUEUE_SIGNAL(element) g_cond_signal(&element->input_queue_run_cond)
+
+#define OUTPUT_QUEUE_WAIT(element) g_cond_wait(&element->output_queue_run_cond, &element->output_queue_mutex)
+#define OUTPUT_QUEUE_SIGNAL(element) g_cond_signal(&element->output_queue_run_cond)
+
+#define INPUT_QUEUE_LOCK(element) g_mutex_lock(&element->input_queue_mutex)
+#define INPUT_QUEUE_UNLOCK(element) g_mutex_unlock(&element->input_queue_mutex)
+
+#define OUTPUT_QUEUE_LOCK(element) g_mutex_lock(&element->output_queue_mutex)
+#define OUTPUT_QUEUE_UNLOCK(element) g_mutex_unlock(&element->output_queue_mutex)
+
+// Task control
+
+#define INPUT_QUEUE_RESUME(element) queue_signal_resume(&element->input_queue_mutex, &element->input_queue_run_cond, &element->input_task_resume)
+#define OUTPUT_QUEUE_RESUME(element) queue_signal_resume(&element->output_queue_mutex, &element->output_queue_run_cond, &element->srcpad_task_resume)
+
+#define INPUT_TASK_START(element) task_start(element->input_task)
+#define INPUT_TASK_PAUSE(element) task_pause(element->input_task, &element->input_queue_mutex, &element->input_queue_run_cond, &element->input_task_resume)
+#define INPUT_TASK_JOIN(element) task_join(element->input_task, &element->input_queue_mutex, &element->input_queue_run_cond, &element->input_task_resume)
+
+#define SRCPAD_TASK_START(element) task_start(element->srcpad_task)
+#define SRCPAD_TASK_PAUSE(element) task_pause(element->srcpad_task, &element->output_queue_mutex, &element->output_queue_run_cond, &element->srcpad_task_resume)
+#define SRCPAD_TASK_JOIN(element) task_join(element->srcpad_task, &element->output_queue_mutex, &element->output_queue_run_cond, &element->srcpad_task_resume)
+
+// Wakes up the task waiting on a queue, the queue might be empty
+static void queue_signal_resume (GMutex* mutex, GCond* cond, gboolean* resume) {
+        g_mutex_lock(mutex);
+        *resume = TRUE;
+        g_cond_signal(cond);
+        g_mutex_unlock(mutex);
+}
+
+static void task_start (GstTask* task) {
+        GST_INFO_OBJECT (task, "Starting task");
+        gst_task_start(task);
+}
+
+static void task_pause (GstTask* task, GMutex* mutex, GCond* cond, gboolean* resume) {
+        GST_INFO_OBJECT (task, "Setting task to paused");
+        gst_task_pause(task);
+        queue_signal_resume(mutex, cond, resume);
+        // the task function runs under the task lock,
+        // this blocks until we are actually paused
+        REC_MUTEX_LOCK(GST_TASK_GET_LOCK(task));
+        REC_MUTEX_UNLOCK(GST_TASK_GET_LOCK(task));
+}
+
+static void task_join (GstTask* task, GMutex* mutex, GCond* cond, gboolean* resume) {
+        GST_INFO_OBJECT (task, "Setting task to stopped");
+        gst_task_stop(task);
+        // the task only sees the stop once woken up
+        queue_signal_resume(mutex, cond, resume);
+        // joins the thread, the task itself can be started again
+        gst_task_join(task);
+}
@@ -53,50 +53,200 @@
  * |[
  * gst-launch-1.0 filesrc location=test/test.txt.zip ! gzdec ! filesink location=test/test.out.txt
  * ]|
+ * Streams compressed with a preset dictionary:
+ * |[
+ * gst-launch-1.0 filesrc location=msg.zlib ! gzdec dictionary=shared.dict ! filesink location=msg.txt
+ * ]|
+ * HTTP bodies with "Content-Encoding: br" (raw deflate and Brotli can not be detected):
+ * |[
+ * gst-launch-1.0 souphttpsrc location=https://example.com/ ! gzdec format=brotli ! filesink location=index.html
+ * ]|
  * </refsect2>
  */
 
+// first, it may turn on system extensions (memrchr)
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 #include <zlib.h>
 #include <bzlib.h>
-
-#ifdef HAVE_CONFIG_H
-#  include <config.h>
+#ifdef HAVE_BROTLI
+#include <brotli/decode.h>
 #endif
 
 #include <gst/gst.h>
+#include <gst/base/gsttypefindhelper.h>
 
 #include "gstgzdec.h"
+#include "gstgzenc.h"
+#include "gstgzdeclatency.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_gz_dec_debug);
 #define GST_CAT_DEFAULT gst_gz_dec_debug
 
-#include "gstgzdec_bzipdecstream.h"
-#include "gstgzdec_zipdecstream.h"
-#include "gstgzdec_priv.h"
-
 /* Filter signals and args */
 enum
 {
-        /* FILL ME */
+        SIGNAL_UNDERRUN,
+        SIGNAL_OVERRUN,
         LAST_SIGNAL
 };
 
+static guint gst_gz_dec_signals[LAST_SIGNAL] = { 0 };
+
+#include "gstgz_queue.h"
+#include "gstgzdec_dictionary.h"
+#include "gstgzdec_checksum.h"
+#include "gstgzdec_split.h"
+#include "gstgzdec_tar.h"
+#include "gstgzdec_zip.h"
+#include "gstgzdec_memfd.h"
+#include "gstgzdec_sparse.h"
+#include "gstgzdec_cache.h"
+#include "gstgzdec_bzipdecstream.h"
+#include "gstgzdec_zipdecstream.h"
+#include "gstgzdec_brotlidecstream.h"
+#include "gstgzdec_priv.h"
+
 enum
 {
-        PROP_0
+        PROP_0,
+        PROP_DICTIONARY,
+        PROP_DICTIONARY_BYTES,
+        PROP_FORMAT,
+        PROP_CHECKSUMS,
+        PROP_VERIFY,
+        PROP_LOW_MEMORY,
+        PROP_MEMORY_USAGE,
+        PROP_MAX_OUTPUT_BYTES,
+        PROP_MAX_RATIO,
+        PROP_RECOVER,
+        PROP_BYTES_SKIPPED,
+        PROP_USE_BUFFERING,
+        PROP_MAX_SIZE_BYTES,
+        PROP_LOW_WATERMARK,
+        PROP_HIGH_WATERMARK,
+        PROP_SPLIT,
+        PROP_DELIMITER,
+        PROP_RECORD_SIZE,
+        PROP_MAX_RECORD_SIZE,
+        PROP_TAR,
+        PROP_ENTRY_FILTER,
+        PROP_THREADS,
+        PROP_MEMFD,
+        PROP_CACHE_DIR,
+        PROP_CACHE_MAX_BYTES,
+        PROP_SPARSE,
+        PROP_SPARSE_THRESHOLD,
+        PROP_VALIDATE_ONLY
 };
 
+#define DEFAULT_FORMAT GST_GZDEC_FORMAT_AUTO
+#define DEFAULT_CHECKSUMS GST_GZDEC_CHECKSUM_NONE
+#define DEFAULT_VERIFY TRUE
+#define DEFAULT_LOW_MEMORY FALSE
+#define DEFAULT_MAX_OUTPUT_BYTES 0
+#define DEFAULT_MAX_RATIO 0
+#define DEFAULT_RECOVER FALSE
+#define DEFAULT_USE_BUFFERING FALSE
+#define DEFAULT_MAX_SIZE_BYTES (2 * 1024 * 1024)
+#define DEFAULT_LOW_WATERMARK 0.01
+#define DEFAULT_HIGH_WATERMARK 0.99
+#define DEFAULT_SPLIT GST_GZDEC_SPLIT_NONE
+#define DEFAULT_TAR FALSE
+#define DEFAULT_THREADS 0
+#define DEFAULT_MEMFD FALSE
+#define DEFAULT_CACHE_MAX_BYTES (G_GUINT64_CONSTANT(1) << 30)
+#define DEFAULT_SPARSE FALSE
+#define DEFAULT_VALIDATE_ONLY FALSE
+
+GType
+gst_gz_dec_checksum_get_type (void)
+{
+        static gsize checksum_type = 0;
+        static const GFlagsValue checksums[] = {
+                {GST_GZDEC_CHECKSUM_CRC32, "CRC-32", "crc32"},
+                {GST_GZDEC_CHECKSUM_CRC32C, "CRC-32C (Castagnoli)", "crc32c"},
+                {GST_GZDEC_CHECKSUM_SHA256, "SHA-256", "sha256"},
+                {0, NULL, NULL}
+        };
+
+        if (g_once_init_enter (&checksum_type)) {
+                GType tmp = g_flags_register_static ("GstGzDecChecksum", checksums);
+                g_once_init_leave (&checksum_type, tmp);
+        }
+        return (GType) checksum_type;
+}
+
+GType
+gst_gz_dec_split_get_type (void)
+{
+        static gsize split_type = 0;
+        static const GEnumValue splits[] = {
+                {GST_GZDEC_SPLIT_NONE, "Chunks as they come out of the decoder", "none"},
+                {GST_GZDEC_SPLIT_DELIMITER, "End buffers after a delimiter (see delimiter)", "delimiter"},
+                {GST_GZDEC_SPLIT_RECORD, "Buffers of whole fixed size records (see record-size)", "record"},
+                {0, NULL, NULL}
+        };
+
+        if (g_once_init_enter (&split_type)) {
+                GType tmp = g_enum_register_static ("GstGzDecSplit", splits);
+                g_once_init_leave (&split_type, tmp);
+        }
+        return (GType) split_type;
+}
+
+GType
+gst_gz_dec_format_get_type (void)
+{
+        static gsize format_type = 0;
+        static const GEnumValue formats[] = {
+                {GST_GZDEC_FORMAT_AUTO, "Detect from stream header (gzip, zlib, bzip2)", "auto"},
+                {GST_GZDEC_FORMAT_ZLIB, "Zlib (HTTP deflate)", "zlib"},
+                {GST_GZDEC_FORMAT_GZIP, "Gzip", "gzip"},
+                {GST_GZDEC_FORMAT_RAW_DEFLATE, "Raw deflate without header", "raw-deflate"},
+                {GST_GZDEC_FORMAT_BZIP2, "Bzip2", "bzip2"},
+                {GST_GZDEC_FORMAT_BROTLI, "Brotli (HTTP br)", "brotli"},
+                {GST_GZDEC_FORMAT_ZIP, "PKZIP archive, entries pushed one after the other", "zip"},
+                {0, NULL, NULL}
+        };
+
+        if (g_once_init_enter (&format_type)) {
+                GType tmp = g_enum_register_static ("GstGzDecFormat", formats);
+                g_once_init_leave (&format_type, tmp);
+        }
+        return (GType) format_type;
+}
+
 /* the capabilities of the inputs and outputs.
  *
- * describe the real formats here.
+ * The template lists what we decode, for autoplugging. The sink pad still accepts any caps
+ * (see gst_gz_dec_sink_query), data we don't decode is passed through with its caps.
+ * Output caps are typefound on the decompressed data.
  */
+#ifdef HAVE_BROTLI
+#define BROTLI_SINK_CAPS "application/x-brotli; "
+#else
+#define BROTLI_SINK_CAPS
+#endif
+
 static GstStaticPadTemplate sink_factory = GST_STATIC_PAD_TEMPLATE ("sink",
                                                                     GST_PAD_SINK,
                                                                     GST_PAD_ALWAYS,
-                                                                    GST_STATIC_CAPS ("ANY")
+                                                                    GST_STATIC_CAPS ("application/x-gzip; "
+                                                                                     "application/x-bzip; "
+                                                                                     "application/x-bzip2; "
+                                                                                     "application/zlib; "
+                                                                                     "application/x-zlib; "
+                                                                                     "application/x-deflate; "
+                                                                                     BROTLI_SINK_CAPS
+                                                                                     "application/zip; "
+                                                                                     "application/octet-stream")
                                                                     );
 
 static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
@@ -112,8 +262,12 @@ static void gst_gz_dec_set_property (GObject * object, guint prop_id,
                                      const GValue * value, GParamSpec * pspec);
 static void gst_gz_dec_get_property (GObject * object, guint prop_id,
                                      GValue * value, GParamSpec * pspec);
+static void gst_gz_dec_finalize (GObject * object);
 
 static gboolean gst_gz_dec_sink_event (GstPad * pad, GstObject * parent, GstEvent * event);
+static gboolean gst_gz_dec_src_event (GstPad * pad, GstObject * parent, GstEvent * event);
+static gboolean gst_gz_dec_src_query (GstPad * pad, GstObject * parent, GstQuery * query);
+static gboolean gst_gz_dec_sink_query (GstPad * pad, GstObject * parent, GstQuery * query);
 static GstFlowReturn gst_gz_dec_chain (GstPad * pad, GstObject * parent, GstBuffer * buf);
 
 static GstStateChangeReturn
@@ -130,10 +284,188 @@ gst_gz_dec_class_init (GstGzDecClass * klass)
 
         gobject_class->set_property = gst_gz_dec_set_property;
         gobject_class->get_property = gst_gz_dec_get_property;
+        gobject_class->finalize = gst_gz_dec_finalize;
+
+        g_object_class_install_property (gobject_class, PROP_DICTIONARY,
+                                         g_param_spec_string ("dictionary", "Dictionary",
+                                                              "Preset dictionary file(s), separated by '" G_SEARCHPATH_SEPARATOR_S "'. "
+                                                              "Selected by their Adler-32 ID when the stream asks for one.",
+                                                              NULL,
+                                                              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_DICTIONARY_BYTES,
+                                         g_param_spec_boxed ("dictionary-bytes", "Dictionary bytes",
+                                                             "Preset dictionary data, used in addition to the dictionary files",
+                                                             G_TYPE_BYTES,
+                                                             G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_FORMAT,
+                                         g_param_spec_enum ("format", "Format",
+                                                            "Compression format of the input stream",
+                                                            GST_TYPE_GZDEC_FORMAT, DEFAULT_FORMAT,
+                                                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_CHECKSUMS,
+                                         g_param_spec_flags ("checksums", "Checksums",
+                                                             "Checksums of the decompressed data, posted as "
+                                                             "'gzdec-checksum' element message at EOS",
+                                                             GST_TYPE_GZDEC_CHECKSUM, DEFAULT_CHECKSUMS,
+                                                             G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_VERIFY,
+                                         g_param_spec_boolean ("verify", "Verify",
+                                                               "Check the gzip/zlib trailer checksum, disable for trusted input "
+                                                               "(bzip2 always checks its block CRCs)",
+                                                               DEFAULT_VERIFY,
+                                                               G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_LOW_MEMORY,
+                                         g_param_spec_boolean ("low-memory", "Low memory",
+                                                               "Use the small bzip2 decompressor and smaller output chunks, "
+                                                               "and free the decoder when idle in between streams",
+                                                               DEFAULT_LOW_MEMORY,
+                                                               G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_MEMORY_USAGE,
+                                         g_param_spec_uint64 ("memory-usage", "Memory usage",
+                                                              "Bytes held by the decoder state and output chunk (not counting queued buffers)",
+                                                              0, G_MAXUINT64, 0,
+                                                              G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_MAX_OUTPUT_BYTES,
+                                         g_param_spec_uint64 ("max-output-bytes", "Maximum output bytes",
+                                                              "Fail the stream once it decompresses to more than this (0 = unlimited)",
+                                                              0, G_MAXUINT64, DEFAULT_MAX_OUTPUT_BYTES,
+                                                              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_MAX_RATIO,
+                                         g_param_spec_uint ("max-ratio", "Maximum ratio",
+                                                            "Fail the stream once output exceeds this many times the input consumed, "
+                                                            "checked past the first MiB of output (0 = unlimited)",
+                                                            0, G_MAXUINT, DEFAULT_MAX_RATIO,
+                                                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_RECOVER,
+                                         g_param_spec_boolean ("recover", "Recover",
+                                                               "On corrupt gzip/zlib/deflate or bzip2 data, skip ahead to the next "
+                                                               "point decoding can resume from and mark the output discontinuous",
+                                                               DEFAULT_RECOVER,
+                                                               G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_BYTES_SKIPPED,
+                                         g_param_spec_uint64 ("bytes-skipped", "Bytes skipped",
+                                                              "Compressed bytes skipped to recover from corrupt data in the current stream",
+                                                              0, G_MAXUINT64, 0,
+                                                              G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_USE_BUFFERING,
+                                         g_param_spec_boolean ("use-buffering", "Use buffering",
+                                                               "Post buffering messages for the decompressed data queued on the source pad",
+                                                               DEFAULT_USE_BUFFERING,
+                                                               G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_MAX_SIZE_BYTES,
+                                         g_param_spec_uint ("max-size-bytes", "Max size bytes",
+                                                            "Queue level the watermarks refer to, either queue holding more emits overrun, "
+                                                            "the decoder waits while the output queue does",
+                                                            1, G_MAXUINT, DEFAULT_MAX_SIZE_BYTES,
+                                                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_LOW_WATERMARK,
+                                         g_param_spec_double ("low-watermark", "Low watermark",
+                                                              "Start buffering when the output queue falls below this fraction of max-size-bytes",
+                                                              0.0, 1.0, DEFAULT_LOW_WATERMARK,
+                                                              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_HIGH_WATERMARK,
+                                         g_param_spec_double ("high-watermark", "High watermark",
+                                                              "Stop buffering (100%) when the output queue reaches this fraction of max-size-bytes",
+                                                              0.0, 1.0, DEFAULT_HIGH_WATERMARK,
+                                                              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+        g_object_class_install_property (gobject_class, PROP_SPLIT,
+                                         g_param_spec_enum ("split", "Split",
+                                                            "Align output buffers to record boundaries, holding back the partial last record",
+                                                            GST_TYPE_GZDEC_SPLIT, DEFAULT_SPLIT,
+                                                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_DELIMITER,
+                                         g_param_spec_string ("delimiter", "Delimiter",
+                                                              "Record delimiter for split=delimiter, C escapes like \\r\\n are interpreted",
+                                                              SPLIT_DEFAULT_DELIMITER,
+                                                              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_RECORD_SIZE,
+                                         g_param_spec_uint ("record-size", "Record size",
+                                                            "Record size in bytes for split=record",
+                                                            1, G_MAXUINT, SPLIT_DEFAULT_RECORD_SIZE,
+                                                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_MAX_RECORD_SIZE,
+                                         g_param_spec_uint ("max-record-size", "Max record size",
+                                                            "Bytes held back for split=delimiter before the partial record is pushed "
+                                                            "without a delimiter (0 = unlimited)",
+                                                            0, G_MAXUINT, SPLIT_DEFAULT_MAX_RECORD_SIZE,
+                                                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+        g_object_class_install_property (gobject_class, PROP_TAR,
+                                         g_param_spec_boolean ("tar", "Tar",
+                                                               "Demux the decompressed tar archive, pushing the data of regular files "
+                                                               "each preceded by a '" TAR_ENTRY_EVENT_NAME "' custom downstream event",
+                                                               DEFAULT_TAR,
+                                                               G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_ENTRY_FILTER,
+                                         g_param_spec_string ("entry-filter", "Entry filter",
+                                                              "Comma separated glob patterns of the tar or zip entries to push (NULL = all), "
+                                                              "other entries are skipped",
+                                                              NULL,
+                                                              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_THREADS,
+                                         g_param_spec_uint ("threads", "Threads",
+                                                            "Number of threads decoding zip entries (0 = number of processors)",
+                                                            0, 1024, DEFAULT_THREADS,
+                                                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_MEMFD,
+                                         g_param_spec_boolean ("memfd", "Memfd",
+                                                               "Copy the output into page aligned memfd backed memory (GstFdMemory), "
+                                                               "which other processes can map without another copy",
+                                                               DEFAULT_MEMFD,
+                                                               G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_CACHE_DIR,
+                                         g_param_spec_string ("cache-dir", "Cache directory",
+                                                              "Directory caching the decompressed streams read from local files, "
+                                                              "keyed by their content (NULL = no cache)",
+                                                              NULL,
+                                                              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_CACHE_MAX_BYTES,
+                                         g_param_spec_uint64 ("cache-max-bytes", "Cache max bytes",
+                                                              "Size of the cache directory, least recently used streams are evicted beyond it",
+                                                              1, G_MAXUINT64, DEFAULT_CACHE_MAX_BYTES,
+                                                              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_SPARSE,
+                                         g_param_spec_boolean ("sparse", "Sparse",
+                                                               "Push runs of zeros as GAP flagged buffers of shared zero memory, "
+                                                               "which sparse aware sinks can skip (not with split)",
+                                                               DEFAULT_SPARSE,
+                                                               G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_SPARSE_THRESHOLD,
+                                         g_param_spec_uint ("sparse-threshold", "Sparse threshold",
+                                                            "Shortest run of zeros in bytes pushed as a gap for sparse=true",
+                                                            SPARSE_BLOCK_SIZE, SPARSE_ZERO_SIZE, SPARSE_DEFAULT_THRESHOLD,
+                                                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_VALIDATE_ONLY,
+                                         g_param_spec_boolean ("validate-only", "Validate only",
+                                                               "Decode without pushing any data, only the checksums are computed and "
+                                                               "a 'gzdec-validate' element message sums the stream up at EOS",
+                                                               DEFAULT_VALIDATE_ONLY,
+                                                               G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+        /**
+         * GstGzDec::underrun:
+         * @gzdec: the gzdec instance
+         *
+         * Emitted from the source pad task when the output queue ran empty before EOS.
+         */
+        gst_gz_dec_signals[SIGNAL_UNDERRUN] =
+                g_signal_new ("underrun", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_FIRST,
+                              0, NULL, NULL, g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+        /**
+         * GstGzDec::overrun:
+         * @gzdec: the gzdec instance
+         *
+         * Emitted when the input or the output queue grows past max-size-bytes.
+         * Nothing blocks, upstream is expected to slow down.
+         */
+        gst_gz_dec_signals[SIGNAL_OVERRUN] =
+                g_signal_new ("overrun", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_FIRST,
+                              0, NULL, NULL, g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
 
         gst_element_class_set_details_simple(gstelement_class,
                                              "Gzip decoder",
-                                             "Decoder",
+                                             "Codec/Decoder",
                                              "Decode compressed zip data",
                                              "Stephan Hesse <disparat@gmail.com>");
 
@@ -158,11 +490,15 @@ gst_gz_dec_init (GstGzDec * filter)
                                     GST_DEBUG_FUNCPTR(gst_gz_dec_sink_event));
         gst_pad_set_chain_function (filter->sinkpad,
                                     GST_DEBUG_FUNCPTR(gst_gz_dec_chain));
-        GST_PAD_SET_PROXY_CAPS (filter->sinkpad);
+        gst_pad_set_query_function (filter->sinkpad,
+                                    GST_DEBUG_FUNCPTR(gst_gz_dec_sink_query));
         gst_element_add_pad (GST_ELEMENT (filter), filter->sinkpad);
 
         filter->srcpad = gst_pad_new_from_static_template (&src_factory, "src");
-        GST_PAD_SET_PROXY_CAPS (filter->srcpad);
+        gst_pad_set_event_function (filter->srcpad,
+                                    GST_DEBUG_FUNCPTR(gst_gz_dec_src_event));
+        gst_pad_set_query_function (filter->srcpad,
+                                    GST_DEBUG_FUNCPTR(gst_gz_dec_src_query));
         gst_element_add_pad (GST_ELEMENT (filter), filter->srcpad);
 
         // EOS event store
@@ -173,6 +509,10 @@ gst_gz_dec_init (GstGzDec * filter)
         // Queues
         filter->input_queue = g_queue_new();
         filter->output_queue = g_queue_new();
+        filter->stream_start_queue = g_queue_new();
+        filter->passthrough = filter->unsupported = FALSE;
+        filter->bytes_in = filter->bytes_out = filter->bytes_pushed = 0;
+        filter->isize = -1;
         // Init locks
         g_mutex_init(&filter->input_queue_mutex);
         g_mutex_init(&filter->output_queue_mutex);
@@ -180,15 +520,316 @@ gst_gz_dec_init (GstGzDec * filter)
         // queueing conds
         g_cond_init(&filter->input_queue_run_cond);
         g_cond_init(&filter->output_queue_run_cond);
+        g_cond_init(&filter->output_queue_space_cond);
+        // Dictionaries
+        filter->dictionaries = NULL;
+        filter->dictionary_paths = NULL;
+        filter->dictionary_bytes = NULL;
+        // Properties
+        filter->format = DEFAULT_FORMAT;
+        filter->checksums = DEFAULT_CHECKSUMS;
+        filter->checksum_state = NULL;
+        filter->verify = DEFAULT_VERIFY;
+        filter->low_memory = DEFAULT_LOW_MEMORY;
+        filter->memory.allocated = 0;
+        filter->max_output_bytes = DEFAULT_MAX_OUTPUT_BYTES;
+        filter->max_ratio = DEFAULT_MAX_RATIO;
+        filter->limit_max_output_bytes = filter->limit_bytes_in = filter->limit_bytes_out = 0;
+        filter->limit_max_ratio = 0;
+        filter->limit_exceeded = FALSE;
+        filter->recover = DEFAULT_RECOVER;
+        filter->bytes_skipped = 0;
+        filter->discont = FALSE;
+        filter->use_buffering = DEFAULT_USE_BUFFERING;
+        filter->max_size_bytes = DEFAULT_MAX_SIZE_BYTES;
+        filter->low_watermark = DEFAULT_LOW_WATERMARK;
+        filter->high_watermark = DEFAULT_HIGH_WATERMARK;
+        filter->input_queue_bytes = 0;
+        filter->input_overrun = filter->output_overrun = FALSE;
+        filter->buffering = FALSE;
+        filter->buffering_percent = -1;
+        filter->latency_queued = filter->latency_decode_start = GST_CLOCK_TIME_NONE;
+        filter->split = DEFAULT_SPLIT;
+        filter->delimiter = g_strdup(SPLIT_DEFAULT_DELIMITER);
+        filter->record_size = SPLIT_DEFAULT_RECORD_SIZE;
+        filter->max_record_size = SPLIT_DEFAULT_MAX_RECORD_SIZE;
+        filter->split_mode = GST_GZDEC_SPLIT_NONE;
+        filter->split_delimiter = NULL;
+        filter->split_record_size = filter->split_max_record_size = 0;
+        filter->split_tail = g_byte_array_new();
+        filter->tar = DEFAULT_TAR;
+        filter->tar_parser = NULL;
+        filter->entry_filter = NULL;
+        filter->entry_patterns = NULL;
+        filter->threads = DEFAULT_THREADS;
+        filter->zip_pool = NULL;
+        filter->zip_jobs = g_queue_new();
+        g_mutex_init(&filter->zip_jobs_mutex);
+        g_cond_init(&filter->zip_jobs_cond);
+        filter->zip_seeking = filter->zip_done = FALSE;
+        filter->memfd = DEFAULT_MEMFD;
+        filter->memfd_ring = NULL;
+        filter->sparse = DEFAULT_SPARSE;
+        filter->sparse_threshold = SPARSE_DEFAULT_THRESHOLD;
+        filter->sparse_mode = FALSE;
+        filter->sparse_min_run = 0;
+        filter->sparse_position = filter->sparse_run = 0;
+        filter->validate_only = DEFAULT_VALIDATE_ONLY;
+        filter->validate_mode = filter->validate_complete = FALSE;
+        filter->validate_corrupt_entries = 0;
+        filter->cache_dir = NULL;
+        filter->cache_max_bytes = DEFAULT_CACHE_MAX_BYTES;
+        filter->cache_writer = NULL;
+        filter->cache_hit = FALSE;
+        filter->range_start = 0;
+        filter->range_stop = -1;
+        filter->range_position = 0;
+        filter->range_done = FALSE;
+        filter->caps_format = GST_GZDEC_FORMAT_AUTO;
+        filter->src_caps_set = FALSE;
+        filter->pending_segment = NULL;
+        filter->sink_caps = NULL;
+        filter->typefind_queue = g_queue_new();
+        filter->typefind_bytes = 0;
+        filter->stream_format = filter->switch_format = GST_GZDEC_FORMAT_AUTO;
+        filter->switch_rest = filter->switch_fill = 0;
 
         GST_INFO_OBJECT(filter, "Done initializing element");
 }
 
+static void
+gst_gz_dec_finalize (GObject * object)
+{
+        GstGzDec *filter = GST_GZDEC (object);
+
+        g_queue_free_full(filter->input_queue, (GDestroyNotify) gst_mini_object_unref);
+        g_queue_free_full(filter->output_queue, (GDestroyNotify) gst_mini_object_unref);
+        g_queue_free_full(filter->stream_start_queue, (GDestroyNotify) gst_mini_object_unref);
+        g_mutex_clear(&filter->input_queue_mutex);
+        g_mutex_clear(&filter->output_queue_mutex);
+        g_cond_clear(&filter->input_queue_run_cond);
+        g_cond_clear(&filter->output_queue_run_cond);
+        g_cond_clear(&filter->output_queue_space_cond);
+
+        if (filter->dictionaries) {
+                dictionary_store_unref(filter->dictionaries);
+        }
+        g_free(filter->dictionary_paths);
+        gst_event_replace(&filter->pending_segment, NULL);
+        gst_caps_replace(&filter->sink_caps, NULL);
+        g_queue_free_full(filter->typefind_queue, (GDestroyNotify) gst_mini_object_unref);
+        if (filter->checksum_state) {
+                checksum_state_free(CHECKSUM_STATE(filter->checksum_state));
+        }
+        if (filter->dictionary_bytes) {
+                g_bytes_unref(filter->dictionary_bytes);
+        }
+        g_free(filter->delimiter);
+        if (filter->split_delimiter) {
+                g_bytes_unref(filter->split_delimiter);
+        }
+        g_byte_array_unref(filter->split_tail);
+        tar_clear(filter);
+        memfd_clear(filter);
+        cache_abort(filter);
+        g_free(filter->cache_dir);
+        decoder_pool_clear(filter);
+        if (filter->input_task) {
+                g_object_unref(filter->input_task);
+        }
+        if (filter->srcpad_task) {
+                g_object_unref(filter->srcpad_task);
+        }
+        g_free(filter->entry_filter);
+        entry_filter_clear(filter);
+        zip_pool_free(filter);
+        g_queue_free_full(filter->zip_jobs, (GDestroyNotify) zip_job_free);
+        g_mutex_clear(&filter->zip_jobs_mutex);
+        g_cond_clear(&filter->zip_jobs_cond);
+
+        G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+/* Rebuilds the dictionary store from the properties, call with the object lock held.
+   Decoders already running keep their reference on the previous store. */
+static void
+gst_gz_dec_update_dictionaries (GstGzDec * filter)
+{
+        DictionaryStore* store = NULL;
+        gchar** paths;
+        gchar** path;
+
+        if (filter->dictionary_paths || filter->dictionary_bytes) {
+                store = dictionary_store_new();
+        }
+
+        if (filter->dictionary_paths) {
+                paths = g_strsplit(filter->dictionary_paths, G_SEARCHPATH_SEPARATOR_S, -1);
+                for (path = paths; *path; path++) {
+                        if (**path && !dictionary_store_add_file(store, *path)) {
+                                GST_WARNING_OBJECT(filter, "Ignoring dictionary %s", *path);
+                        }
+                }
+                g_strfreev(paths);
+        }
+
+        if (filter->dictionary_bytes) {
+                dictionary_store_add(store, dictionary_adler32_id(filter->dictionary_bytes),
+                                     filter->dictionary_bytes);
+        }
+
+        if (filter->dictionaries) {
+                dictionary_store_unref(filter->dictionaries);
+        }
+        filter->dictionaries = store;
+}
+
 static void
 gst_gz_dec_set_property (GObject * object, guint prop_id,
                          const GValue * value, GParamSpec * pspec)
 {
+        GstGzDec *filter = GST_GZDEC (object);
+
         switch (prop_id) {
+        case PROP_DICTIONARY:
+                GST_OBJECT_LOCK(filter);
+                g_free(filter->dictionary_paths);
+                filter->dictionary_paths = g_value_dup_string(value);
+                gst_gz_dec_update_dictionaries(filter);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_DICTIONARY_BYTES:
+                GST_OBJECT_LOCK(filter);
+                if (filter->dictionary_bytes) {
+                        g_bytes_unref(filter->dictionary_bytes);
+                }
+                filter->dictionary_bytes = g_value_dup_boxed(value);
+                gst_gz_dec_update_dictionaries(filter);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_FORMAT:
+                GST_OBJECT_LOCK(filter);
+                filter->format = g_value_get_enum(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_CHECKSUMS:
+                GST_OBJECT_LOCK(filter);
+                filter->checksums = g_value_get_flags(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_VERIFY:
+                GST_OBJECT_LOCK(filter);
+                filter->verify = g_value_get_boolean(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_LOW_MEMORY:
+                GST_OBJECT_LOCK(filter);
+                filter->low_memory = g_value_get_boolean(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_MAX_OUTPUT_BYTES:
+                GST_OBJECT_LOCK(filter);
+                filter->max_output_bytes = g_value_get_uint64(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_MAX_RATIO:
+                GST_OBJECT_LOCK(filter);
+                filter->max_ratio = g_value_get_uint(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_RECOVER:
+                GST_OBJECT_LOCK(filter);
+                filter->recover = g_value_get_boolean(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_USE_BUFFERING:
+                GST_OBJECT_LOCK(filter);
+                filter->use_buffering = g_value_get_boolean(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_MAX_SIZE_BYTES:
+                GST_OBJECT_LOCK(filter);
+                filter->max_size_bytes = g_value_get_uint(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_LOW_WATERMARK:
+                GST_OBJECT_LOCK(filter);
+                filter->low_watermark = g_value_get_double(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_HIGH_WATERMARK:
+                GST_OBJECT_LOCK(filter);
+                filter->high_watermark = g_value_get_double(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_SPLIT:
+                GST_OBJECT_LOCK(filter);
+                filter->split = g_value_get_enum(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_DELIMITER:
+                GST_OBJECT_LOCK(filter);
+                g_free(filter->delimiter);
+                filter->delimiter = g_value_dup_string(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_RECORD_SIZE:
+                GST_OBJECT_LOCK(filter);
+                filter->record_size = g_value_get_uint(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_MAX_RECORD_SIZE:
+                GST_OBJECT_LOCK(filter);
+                filter->max_record_size = g_value_get_uint(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_TAR:
+                GST_OBJECT_LOCK(filter);
+                filter->tar = g_value_get_boolean(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_ENTRY_FILTER:
+                GST_OBJECT_LOCK(filter);
+                g_free(filter->entry_filter);
+                filter->entry_filter = g_value_dup_string(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_THREADS:
+                GST_OBJECT_LOCK(filter);
+                filter->threads = g_value_get_uint(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_MEMFD:
+                GST_OBJECT_LOCK(filter);
+                filter->memfd = g_value_get_boolean(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_CACHE_DIR:
+                GST_OBJECT_LOCK(filter);
+                g_free(filter->cache_dir);
+                filter->cache_dir = g_value_dup_string(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_CACHE_MAX_BYTES:
+                GST_OBJECT_LOCK(filter);
+                filter->cache_max_bytes = g_value_get_uint64(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_SPARSE:
+                GST_OBJECT_LOCK(filter);
+                filter->sparse = g_value_get_boolean(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_SPARSE_THRESHOLD:
+                GST_OBJECT_LOCK(filter);
+                filter->sparse_threshold = g_value_get_uint(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_VALIDATE_ONLY:
+                GST_OBJECT_LOCK(filter);
+                filter->validate_only = g_value_get_boolean(value);
+                GST_OBJECT_UNLOCK(filter);
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
                 break;
@@ -199,7 +840,147 @@ static void
 gst_gz_dec_get_property (GObject * object, guint prop_id,
                          GValue * value, GParamSpec * pspec)
 {
+        GstGzDec *filter = GST_GZDEC (object);
+
         switch (prop_id) {
+        case PROP_DICTIONARY:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_string(value, filter->dictionary_paths);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_DICTIONARY_BYTES:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_boxed(value, filter->dictionary_bytes);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_FORMAT:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_enum(value, filter->format);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_CHECKSUMS:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_flags(value, filter->checksums);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_VERIFY:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_boolean(value, filter->verify);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_LOW_MEMORY:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_boolean(value, filter->low_memory);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_MEMORY_USAGE:
+                g_value_set_uint64(value, memory_counter_get(&filter->memory));
+                break;
+        case PROP_MAX_OUTPUT_BYTES:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_uint64(value, filter->max_output_bytes);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_MAX_RATIO:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_uint(value, filter->max_ratio);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_RECOVER:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_boolean(value, filter->recover);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_BYTES_SKIPPED:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_uint64(value, filter->bytes_skipped);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_USE_BUFFERING:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_boolean(value, filter->use_buffering);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_MAX_SIZE_BYTES:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_uint(value, filter->max_size_bytes);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_LOW_WATERMARK:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_double(value, filter->low_watermark);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_HIGH_WATERMARK:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_double(value, filter->high_watermark);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_SPLIT:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_enum(value, filter->split);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_DELIMITER:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_string(value, filter->delimiter);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_RECORD_SIZE:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_uint(value, filter->record_size);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_MAX_RECORD_SIZE:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_uint(value, filter->max_record_size);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_TAR:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_boolean(value, filter->tar);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_ENTRY_FILTER:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_string(value, filter->entry_filter);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_THREADS:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_uint(value, filter->threads);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_MEMFD:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_boolean(value, filter->memfd);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_CACHE_DIR:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_string(value, filter->cache_dir);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_CACHE_MAX_BYTES:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_uint64(value, filter->cache_max_bytes);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_SPARSE:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_boolean(value, filter->sparse);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_SPARSE_THRESHOLD:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_uint(value, filter->sparse_threshold);
+                GST_OBJECT_UNLOCK(filter);
+                break;
+        case PROP_VALIDATE_ONLY:
+                GST_OBJECT_LOCK(filter);
+                g_value_set_boolean(value, filter->validate_only);
+                GST_OBJECT_UNLOCK(filter);
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
                 break;
@@ -210,6 +991,7 @@ static GstStateChangeReturn
 gst_gz_dec_change_state (GstElement *element, GstStateChange transition)
 {
         GstGzDec *filter = GST_GZDEC (element);
+        GstStateChangeReturn ret;
 
         GstState current = GST_STATE_TRANSITION_CURRENT(transition);
         GstState next = GST_STATE_TRANSITION_NEXT(transition);
@@ -224,54 +1006,69 @@ gst_gz_dec_change_state (GstElement *element, GstStateChange transition)
                 GST_OBJECT_LOCK(filter);
                 // reset EOS flag
                 filter->eos = FALSE;
-                // create input task
-                filter->input_task = CREATE_TASK(input_task_func, filter);
                 GST_OBJECT_UNLOCK(filter);
-                gst_task_set_lock(filter->input_task, &filter->input_task_mutex);
-                // Pre-warm our input processing worker
-                gst_task_pause(filter->input_task);
+                // the tasks are made once and reused across state cycles,
+                // their threads only come from the task pool when they start
+                if (!filter->input_task) {
+                        filter->input_task = CREATE_TASK(input_task_func, filter);
+                        gst_task_set_lock(filter->input_task, &filter->input_task_mutex);
+                }
+                if (!filter->srcpad_task) {
+                        filter->srcpad_task = CREATE_TASK(srcpad_task_func, filter);
+                        gst_task_set_lock(filter->srcpad_task, GST_PAD_GET_STREAM_LOCK(filter->srcpad));
+                }
                 break;
         case GST_STATE_CHANGE_READY_TO_PAUSED:
                 // Pre-process input data to have prerolled data
-                // on output when we go to play
-                input_task_start(filter);
-                // Weird! we need this to startup, but it should only be necessary in PLAYING state, no?
-                srcpad_task_start(filter);
+                // on output when we go to play. The srcpad task runs from
+                // here on as well, downstream blocks it while prerolling.
+                INPUT_TASK_START(filter);
+                SRCPAD_TASK_START(filter);
                 break;
         case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
-                // We're playing, start srcpad streaming task!
-                srcpad_task_start(filter);
-                break;
         case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
-                // this will be syncroneous
-                srcpad_task_pause(filter);
+                // Nothing to do, our tasks don't care about the clock
+                // and a paused sink holds back the srcpad task by itself
                 break;
         case GST_STATE_CHANGE_PAUSED_TO_READY:
-                // We might have never reached playing state, in this
-                // case we want to pause the srcpad task from here!
                 // Pausing srcpad streaming task (this will be syncroneous!)
-                srcpad_task_pause(filter);
+                SRCPAD_TASK_PAUSE(filter);
+                // the input task might wait for room in the output queue
+                output_queue_unblock(filter);
                 // Pause input processing worker (blocking/sync)
-                input_task_pause(filter);
+                INPUT_TASK_PAUSE(filter);
                 break;
         case GST_STATE_CHANGE_READY_TO_NULL:
                 // This will actually join all the task threads
                 // (but the tasks are re-usable)
-                srcpad_task_join(filter);
-                input_task_join(filter);
-                // clean up decoder
+                SRCPAD_TASK_JOIN(filter);
+                output_queue_unblock(filter);
+                INPUT_TASK_JOIN(filter);
+                // keep the decoder for the next run if we can reset it
                 if (filter->decoder) {
-                        clear_decoder(filter);
-                }
-                // clean up task object
-                if (filter->input_task) {
-                        g_object_unref(filter->input_task);
-                        filter->input_task = NULL;
+                        park_decoder(filter);
                 }
+                filter->decode_func = NULL;
+                // a stream cut short is not cached
+                cache_abort(filter);
+                // the next run takes the tar, memfd and entry filter settings anew
+                tar_clear(filter);
+                memfd_clear(filter);
+                entry_filter_clear(filter);
+                filter->zip_done = FALSE;
+                filter->cache_hit = FALSE;
                 break;
         }
 
-        return GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+        ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+        // the pads are deactivated now, the chain function no longer queues anything.
+        // What the paused tasks left in the queues is dropped, the next run starts clean.
+        if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+                flush_reset(filter);
+        }
+
+        return ret;
 }
 
 /* GstElement vmethod implementations */
@@ -286,24 +1083,66 @@ gst_gz_dec_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
         GST_LOG_OBJECT (filter, "Received %s event: %" GST_PTR_FORMAT,
                         GST_EVENT_TYPE_NAME (event), event);
 
+        // the input task is reading a zip archive through seeks, these are its own
+        if (zip_seeking_event (filter, event)) {
+                return TRUE;
+        }
+
         switch (GST_EVENT_TYPE (event)) {
         case GST_EVENT_STREAM_START:
 
-                filter->stream_start_fill
-                        = filter->stream_start[0]
-                                  = filter->stream_start[1] = 0;
+                // with a decoder set up the input task holds the magic of a
+                // following stream there (switch_fill), see input_stream_reset
+                if (!filter->decode_func) {
+                        filter->stream_start_fill
+                                = filter->stream_start[0]
+                                          = filter->stream_start[1] = 0;
+                }
+                filter->passthrough = FALSE;
+                filter->unsupported = FALSE;
                 filter->eos = FALSE;
+                INPUT_QUEUE_LOCK(filter);
+                filter->bytes_in = 0;
+                INPUT_QUEUE_UNLOCK(filter);
+                OUTPUT_QUEUE_LOCK(filter);
+                filter->bytes_out = filter->bytes_pushed = 0;
+                filter->discont = FALSE;
+                // every stream starts out buffering
+                filter->buffering = TRUE;
+                filter->buffering_percent = -1;
+                OUTPUT_QUEUE_UNLOCK(filter);
+                // the input task may still be decoding the stream before,
+                // it resets its own state once it gets there
+                input_queue_append_event(filter, gst_event_ref(event));
+                GST_OBJECT_LOCK(filter);
+                // set by cache_setup, in this thread
+                filter->isize = -1;
+                filter->caps_format = GST_GZDEC_FORMAT_AUTO;
+                filter->src_caps_set = FALSE;
+                filter->limit_exceeded = FALSE;
+                filter->bytes_skipped = 0;
+                // a seek window only holds for the stream it was made in
+                filter->range_start = 0;
+                filter->range_stop = -1;
+                filter->range_done = FALSE;
+                GST_OBJECT_UNLOCK(filter);
 
                 ret = gst_pad_event_default (pad, parent, event);
                 break;
         case GST_EVENT_EOS:
+                // stream too short to be peeked, it can't be compressed data
+                if (G_UNLIKELY(!g_queue_is_empty(filter->stream_start_queue))) {
+                        GST_INFO_OBJECT(filter, "EOS before stream start could be peeked, passing data through");
+                        filter->passthrough = TRUE;
+                        stream_start_queue_release(filter);
+                }
                 GST_OBJECT_LOCK(filter);
                 filter->pending_eos = event;
                 GST_OBJECT_UNLOCK(filter);
                 // the queue might be waiting at this point
                 // even if there is no data to process
                 // we want it to pick up this EOS signal
-                input_queue_signal_resume (filter);
+                INPUT_QUEUE_RESUME(filter);
 
                 ret = TRUE;
                 break;
@@ -312,9 +1151,99 @@ gst_gz_dec_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
                 GstCaps * caps;
                 gst_event_parse_caps (event, &caps);
 
+                // The decoder is picked from compressed caps and output caps are typefound on
+                // the decompressed data. Passed through data goes out with the caps it came with.
+                GST_OBJECT_LOCK(filter);
+                filter->caps_format = format_from_caps (caps);
+                gst_caps_replace (&filter->sink_caps, caps);
+                GST_OBJECT_UNLOCK(filter);
+                GST_DEBUG_OBJECT (filter, "Format from caps: %d", (int) filter->caps_format);
+
+                if (filter->passthrough) {
+                        ret = gst_pad_event_default (pad, parent, event);
+                        break;
+                }
+                gst_event_unref (event);
+                ret = TRUE;
+                break;
+        }
+        case GST_EVENT_FLUSH_START:
+                // downstream first, the srcpad task might be blocked pushing
+                ret = gst_pad_event_default (pad, parent, event);
+                flush_pause_tasks (filter);
+                break;
+        case GST_EVENT_FLUSH_STOP:
+                flush_reset (filter);
+                ret = gst_pad_event_default (pad, parent, event);
+                if (filter->input_task) {
+                        INPUT_TASK_START(filter);
+                        SRCPAD_TASK_START(filter);
+                }
+                break;
+        case GST_EVENT_SEGMENT:
+                event = range_segment (filter, event);
+                GST_OBJECT_LOCK(filter);
+                if (!filter->src_caps_set) {
+                        gst_event_replace (&filter->pending_segment, event);
+                        GST_OBJECT_UNLOCK(filter);
+                        gst_event_unref (event);
+                        ret = TRUE;
+                        break;
+                }
+                GST_OBJECT_UNLOCK(filter);
+
                 ret = gst_pad_event_default (pad, parent, event);
                 break;
+        default:
+                ret = gst_pad_event_default (pad, parent, event);
+                break;
+        }
+        return ret;
+}
+
+/* this function answers caps queries on the sink pad. Anything links, what we don't
+ * decode is passed through. The template only tells decodebin what we decode. */
+static gboolean
+gst_gz_dec_sink_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+        GstCaps* filter_caps;
+        GstCaps* caps;
+
+        switch (GST_QUERY_TYPE (query)) {
+        case GST_QUERY_CAPS:
+                gst_query_parse_caps (query, &filter_caps);
+                caps = filter_caps ? gst_caps_ref (filter_caps) : gst_caps_new_any ();
+                gst_query_set_caps_result (query, caps);
+                gst_caps_unref (caps);
+                return TRUE;
+        case GST_QUERY_ACCEPT_CAPS:
+                gst_query_set_accept_caps_result (query, TRUE);
+                return TRUE;
+        default:
+                return gst_pad_query_default (pad, parent, query);
+        }
+}
+
+/* this function handles events from downstream */
+static gboolean
+gst_gz_dec_src_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+        GstGzDec *filter = GST_GZDEC (parent);
+        gboolean ret;
+
+        GST_LOG_OBJECT (filter, "Received %s event: %" GST_PTR_FORMAT,
+                        GST_EVENT_TYPE_NAME (event), event);
+
+        // data passes as it is, upstream knows best
+        if (filter->passthrough) {
+                return gst_pad_event_default (pad, parent, event);
         }
+
+        switch (GST_EVENT_TYPE (event)) {
+        case GST_EVENT_SEEK:
+                ret = srcpad_seek_bytes (filter, event);
+                gst_event_unref (event);
+                break;
         default:
                 ret = gst_pad_event_default (pad, parent, event);
                 break;
@@ -322,6 +1251,49 @@ gst_gz_dec_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
         return ret;
 }
 
+/* this function answers queries on the decompressed stream */
+static gboolean
+gst_gz_dec_src_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+        GstGzDec *filter = GST_GZDEC (parent);
+        GstFormat format;
+        gint64 value;
+
+        // data passes as it is, upstream knows best
+        if (filter->passthrough) {
+                return gst_pad_query_default (pad, parent, query);
+        }
+
+        switch (GST_QUERY_TYPE (query)) {
+        case GST_QUERY_DURATION:
+                gst_query_parse_duration (query, &format, NULL);
+                if (format != GST_FORMAT_BYTES) {
+                        return FALSE;
+                }
+                if (!query_duration_bytes (filter, &value)) {
+                        return FALSE;
+                }
+                gst_query_set_duration (query, GST_FORMAT_BYTES, value);
+                return TRUE;
+        case GST_QUERY_POSITION:
+                gst_query_parse_position (query, &format, NULL);
+                if (format != GST_FORMAT_BYTES) {
+                        return FALSE;
+                }
+                query_position_bytes (filter, &value);
+                gst_query_set_position (query, GST_FORMAT_BYTES, value);
+                return TRUE;
+        case GST_QUERY_SEEKING:
+                gst_query_parse_seeking (query, &format, NULL, NULL, NULL);
+                if (format != GST_FORMAT_BYTES) {
+                        return FALSE;
+                }
+                return query_seeking_bytes (filter, query);
+        default:
+                return gst_pad_query_default (pad, parent, query);
+        }
+}
+
 /* chain function
  * this function does the actual processing
  */
@@ -334,11 +1306,66 @@ gst_gz_dec_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
 
         GST_TRACE_OBJECT(filter, "Entering chain function: %" GST_PTR_FORMAT, buf);
 
-        if (G_UNLIKELY(!filter->decoder)) {
-                try_feed_stream_start(filter, buf);
+        // decode_func stays set when the decoder is freed in low-memory mode
+        if (G_UNLIKELY(!filter->decode_func && !filter->passthrough)) {
+                if (!filter->unsupported) {
+                        try_feed_stream_start(filter, buf);
+                }
+                // the error is posted already, see setup_format_decoder
+                if (G_UNLIKELY(filter->unsupported)) {
+                        gst_buffer_unref(buf);
+                        return GST_FLOW_ERROR;
+                }
+                // hold back data until we know what to do with it
+                g_queue_push_tail(filter->stream_start_queue, buf);
+                if (!filter->decode_func && !filter->passthrough) {
+                        GST_DEBUG_OBJECT(filter, "Not enough data to peek stream start yet");
+                        return GST_FLOW_OK;
+                }
+                return stream_start_queue_release(filter);
+        }
+
+        // Unknown data goes straight downstream in the streaming thread,
+        // without any copy nor passing through our queues
+        if (filter->passthrough) {
+                // nothing to validate, see setup_decoder
+                if (G_UNLIKELY(filter->validate_mode)) {
+                        gst_buffer_unref(buf);
+                        return GST_FLOW_ERROR;
+                }
+                return gst_pad_push(filter->srcpad, buf);
+        }
+
+        g_assert(filter->decode_func != NULL);
+
+        // the decoder already gave up on this stream, see stream_writer_func
+        GST_OBJECT_LOCK(filter);
+        if (G_UNLIKELY(filter->limit_exceeded)) {
+                GST_OBJECT_UNLOCK(filter);
+                gst_buffer_unref(buf);
+                return GST_FLOW_ERROR;
+        }
+        // the zip entries are extracted, the stream is served from the cache
+        // or the seek stop was reached: upstream can stop
+        if (filter->zip_done || filter->cache_hit || filter->range_done) {
+                GST_OBJECT_UNLOCK(filter);
+                gst_buffer_unref(buf);
+                return GST_FLOW_EOS;
         }
+        GST_OBJECT_UNLOCK(filter);
 
-        g_assert(filter->decoder != NULL);
+        if (G_UNLIKELY(gst_gz_dec_latency_tracing())) {
+                GstGzDecLatencyMeta* meta;
+
+                buf = gst_buffer_make_writable(buf);
+                // a gzdec upstream decoded this, the meta is ours from here on
+                meta = gst_buffer_get_gz_dec_latency_meta(buf);
+                if (!meta) {
+                        meta = gst_buffer_add_gz_dec_latency_meta(buf);
+                }
+                meta->queued = gst_util_get_timestamp();
+                meta->element = NULL;
+        }
 
         // once task is paused sooner or later
         // we should be able to take the worker lock
@@ -368,8 +1395,17 @@ gzdec_init (GstPlugin * gzdec)
         GST_DEBUG_CATEGORY_INIT (gst_gz_dec_debug, "gzdec",
                                  0, "Template gzdec");
 
-        return gst_element_register (gzdec, "gzdec", GST_RANK_NONE,
-                                     GST_TYPE_GZDEC);
+        return gst_element_register (gzdec, "gzdec", GST_RANK_SECONDARY,
+                                     GST_TYPE_GZDEC)
+               && gst_element_register (gzdec, "gzenc", GST_RANK_NONE,
+                                        GST_TYPE_GZENC)
+               && gst_element_register (gzdec, "bzenc", GST_RANK_NONE,
+                                        GST_TYPE_BZENC)
+#ifdef GZDEC_HAVE_LATENCY_TRACER
+               && gst_tracer_register (gzdec, "gzdec-latency",
+                                       GST_TYPE_GZDEC_LATENCY_TRACER)
+#endif
+               ;
 }
 
 /* PACKAGE: this is usually set by autotools depending on some _INIT macro
@@ -49,6 +49,7 @@
 #include <gst/gst.h>
 
 #include <gstgzdec_compat.h>
+#include <gstgzdec_memory.h>
 
 G_BEGIN_DECLS
 
@@ -66,14 +67,79 @@ G_BEGIN_DECLS
 
 typedef struct _GstGzDec GstGzDec;
 typedef struct _GstGzDecClass GstGzDecClass;
+typedef struct _ZipJob ZipJob;
 
 typedef gboolean (*GstGzDecFunc)(gpointer dec_wrapper, GstBuffer* buf);
 
+/* One zip archive entry, decoded independently on a worker thread */
+struct _ZipJob
+{
+        GstGzDec* filter;
+        // the central directory entry (a ZipEntry) and its compressed data, NULL for an entry
+        // too large to hold, the input task decodes it as it reads it
+        gpointer entry;
+        GstBuffer* input;
+        gboolean verify;
+        // the decoder of the entry while it is decoded, NULL for stored entries
+        gpointer decoder;
+        GstGzDecFunc decode_func;
+        gboolean ok;
+
+        // output held while an entry before this one is decoding, bounded by ZIP_JOB_OUTPUT_MAX
+        GByteArray* output;
+        // at the head of the queue, the output goes to the element as it is decoded
+        gboolean streaming;
+        // the element takes no more output, a limit or the seek stop was hit
+        gboolean stopped;
+
+        // results
+        guint64 size;
+        guint32 crc;
+        gboolean failed;
+        gboolean done;
+};
+
 typedef enum {
+        // the codecs first, they index the decoder pool
         GZIP,
-        BZIP
+        BZIP,
+        BROTLI,
+        PKZIP,
+        // served from the cache, see gstgzdec_cache.h
+        CACHED
 } GstGzDecStreamType;
 
+#define DECODER_POOL_SIZE (BROTLI + 1)
+
+#define GST_TYPE_GZDEC_FORMAT (gst_gz_dec_format_get_type())
+
+#define GST_TYPE_GZDEC_CHECKSUM (gst_gz_dec_checksum_get_type())
+
+#define GST_TYPE_GZDEC_SPLIT (gst_gz_dec_split_get_type())
+
+typedef enum {
+        GST_GZDEC_SPLIT_NONE,
+        GST_GZDEC_SPLIT_DELIMITER,
+        GST_GZDEC_SPLIT_RECORD
+} GstGzDecSplit;
+
+typedef enum {
+        GST_GZDEC_CHECKSUM_NONE = 0,
+        GST_GZDEC_CHECKSUM_CRC32 = (1 << 0),
+        GST_GZDEC_CHECKSUM_CRC32C = (1 << 1),
+        GST_GZDEC_CHECKSUM_SHA256 = (1 << 2)
+} GstGzDecChecksum;
+
+typedef enum {
+        GST_GZDEC_FORMAT_AUTO,
+        GST_GZDEC_FORMAT_ZLIB,
+        GST_GZDEC_FORMAT_GZIP,
+        GST_GZDEC_FORMAT_RAW_DEFLATE,
+        GST_GZDEC_FORMAT_BZIP2,
+        GST_GZDEC_FORMAT_BROTLI,
+        GST_GZDEC_FORMAT_ZIP
+} GstGzDecFormat;
+
 struct _GstGzDec
 {
         GstElement element;
@@ -85,8 +151,13 @@ struct _GstGzDec
 
         GstTask *input_task;
         MUTEX input_task_mutex;
+        // our own task rather than the pad's, which gst_pad_stop_task would destroy,
+        // running under the srcpad stream lock like a pad task
+        GstTask *srcpad_task;
 
         GCond output_queue_run_cond;
+        // the srcpad task made room in the output queue
+        GCond output_queue_space_cond;
         GCond input_queue_run_cond;
 
         GMutex input_queue_mutex;
@@ -101,9 +172,173 @@ struct _GstGzDec
         gpointer decoder;
         GstGzDecFunc decode_func;
         GstGzDecStreamType stream_type;
+        // decoders kept when their stream is over (state cycle or format switch),
+        // reset for the next stream of their format if their settings still hold
+        gpointer decoder_pool[DECODER_POOL_SIZE];
+        // format of the stream being decoded, and of the one following its end when it differs
+        GstGzDecFormat stream_format;
+        GstGzDecFormat switch_format;
+        // input left after the stream end, for the decoder of the following stream
+        gsize switch_rest;
+        // a stream ended right before the end of an input block, the start of the next
+        // one's magic is held in stream_start until the next block completes it
+        gsize switch_fill;
+
+        GstGzDecFormat format;
+        // format announced by upstream caps, if any
+        GstGzDecFormat caps_format;
+        // caps of the data as upstream sent it, forwarded as they are in passthrough
+        GstCaps* sink_caps;
+        // output caps are typefound on the decompressed data, the first TYPEFIND_MIN_SIZE
+        // bytes are held back for it in typefind_queue (srcpad task only)
+        gboolean src_caps_set;
+        GQueue* typefind_queue;
+        gsize typefind_bytes;
+        GstEvent* pending_segment;
 
-        gchar stream_start[2];
+        guchar stream_start[2];
         guint stream_start_fill;
+        // byte counters (compressed in, decompressed out and pushed downstream)
+        // guarded by the input and output queue locks respectively
+        guint64 bytes_in;
+        guint64 bytes_out;
+        guint64 bytes_pushed;
+        // uncompressed size when known up front (cache hit), -1 if unknown, object lock
+        gint64 isize;
+
+        // checksums of the decompressed output, see gstgzdec_checksum.h
+        GstGzDecChecksum checksums;
+        gpointer checksum_state;
+        // check the codec's own integrity data
+        gboolean verify;
+
+        // small decoder state and chunks, idle decoders are freed
+        gboolean low_memory;
+        // memory held by the decoder state (see gstgzdec_memory.h)
+        MemoryCounter memory;
+
+        // decompression bomb protection, 0 means unlimited
+        guint64 max_output_bytes;
+        guint max_ratio;
+        // the limits of the stream being decoded and the counts they are checked against,
+        // only touched by the decoding thread (the input task, or in zip mode the job at the head
+        // of the queue while the input task waits) so that the check takes no lock. A stream
+        // start resets the counts from the input task too, see input_stream_reset
+        guint64 limit_max_output_bytes;
+        guint limit_max_ratio;
+        guint64 limit_bytes_in;
+        guint64 limit_bytes_out;
+        // a limit was hit, the rest of the stream is dropped
+        gboolean limit_exceeded;
+
+        // resynchronize after corrupt data instead of failing
+        gboolean recover;
+        guint64 bytes_skipped;
+        // data was skipped, guarded by the output queue lock
+        gboolean discont;
+
+        // queue levels, buffering messages and underrun/overrun signals
+        gboolean use_buffering;
+        guint max_size_bytes;
+        gdouble low_watermark;
+        gdouble high_watermark;
+        // guarded by the input queue lock
+        guint64 input_queue_bytes;
+        gboolean input_overrun;
+        // guarded by the output queue lock
+        gboolean output_overrun;
+        gboolean buffering;
+        gint buffering_percent;
+
+        // record aligned output (see gstgzdec_split.h)
+        GstGzDecSplit split;
+        gchar* delimiter;
+        guint record_size;
+        guint max_record_size;
+        // taken from the properties at decoder setup, used by the input task only
+        GstGzDecSplit split_mode;
+        GBytes* split_delimiter;
+        gsize split_record_size;
+        gsize split_max_record_size;
+        // the partial record held back
+        GByteArray* split_tail;
+
+        // tar archive demuxing (see gstgzdec_tar.h)
+        gboolean tar;
+        // taken from the property at decoder setup, used by the input task only
+        gpointer tar_parser;
+
+        // archive entries to push, glob patterns (tar and zip)
+        gchar* entry_filter;
+        GPtrArray* entry_patterns;
+
+        // zip archives (see gstgzdec_zip.h), entries are decoded on a pool of threads
+        guint threads;
+        GThreadPool* zip_pool;
+        // jobs in central directory order, entries are pushed in that order
+        GQueue* zip_jobs;
+        GMutex zip_jobs_mutex;
+        GCond zip_jobs_cond;
+        // the input task reads the archive through seeks upstream, the flushes, segments and
+        // EOS that come of them are its own (input queue lock)
+        gboolean zip_seeking;
+        // the entries are extracted, upstream can stop
+        gboolean zip_done;
+
+        // output memory in memfd files (see gstgzdec_memfd.h)
+        gboolean memfd;
+        // taken from the property at decoder setup, used by the input task only
+        gpointer memfd_ring;
+
+        // zero runs pushed as gap buffers (see gstgzdec_sparse.h)
+        gboolean sparse;
+        guint sparse_threshold;
+        // taken from the properties at decoder setup, used by the input task only
+        gboolean sparse_mode;
+        gsize sparse_min_run;
+        // stream position of the scan, and the zeros held back before it
+        guint64 sparse_position;
+        guint64 sparse_run;
+
+        // decoding without any output, for integrity checks: a summary is posted at EOS
+        gboolean validate_only;
+        // taken from the property at decoder setup, used by the input task only
+        gboolean validate_mode;
+        // the stream ended properly, and the zip entries that did not
+        gboolean validate_complete;
+        guint validate_corrupt_entries;
+
+        // cache of decompressed streams on local disk (see gstgzdec_cache.h), NULL when off
+        gchar* cache_dir;
+        guint64 cache_max_bytes;
+        // the entry being written on a miss, used by the input task only
+        gpointer cache_writer;
+        // the stream is served from the cache, upstream can stop
+        gboolean cache_hit;
+
+        // BYTES seek window in the decompressed stream, the stop is -1 when open ended
+        guint64 range_start;
+        guint64 range_stop;
+        // decompressed bytes the window has seen so far, used by the input task only
+        guint64 range_position;
+        // the stop was reached, the rest of the stream is dropped
+        gboolean range_done;
+
+        // stage timestamps of the input buffer being decoded, for the latency meta
+        GstClockTime latency_queued;
+        GstClockTime latency_decode_start;
+
+        // buffers held back until the stream start could be peeked
+        GQueue *stream_start_queue;
+        // unrecognized stream, forward buffers as they are
+        gboolean passthrough;
+        // a format this build can't decode, the stream fails rather than pass through compressed
+        gboolean unsupported;
+
+        // preset dictionaries by ID (see gstgzdec_dictionary.h)
+        GHashTable* dictionaries;
+        gchar* dictionary_paths;
+        GBytes* dictionary_bytes;
 };
 
 struct _GstGzDecClass
@@ -112,6 +347,9 @@ struct _GstGzDecClass
 };
 
 GType gst_gz_dec_get_type (void);
+GType gst_gz_dec_format_get_type (void);
+GType gst_gz_dec_checksum_get_type (void);
+GType gst_gz_dec_split_get_type (void);
 
 G_END_DECLS
 
@@ -0,0 +1,191 @@
+#pragma once
+
+/* This is stream wrapper for the Brotli decoder, compiled out without libbrotlidec (HAVE_BROTLI) */
+
+#define BROTLI_DEC_STREAM_OUT_BUFFER_SIZE 16*1024
+#define BROTLI_DEC_STREAM_OUT_BUFFER_SIZE_SMALL 4*1024
+
+#define BROTLI_DECODER_STREAM(ptr) ((BrotliDecoderStream*)ptr)
+typedef struct _BrotliDecoderStream BrotliDecoderStream;
+// returns FALSE when decoding should stop
+typedef gboolean (*StreamWriterFunc)(gpointer user_data, gpointer data, gsize bytes);
+// called at a stream end with more input following, with that input. Returns TRUE
+// when the stream that follows is of another format, this decoder then stops there.
+typedef gboolean (*StreamSwitchFunc)(gpointer user_data, gconstpointer next, gsize avail);
+
+#ifdef HAVE_BROTLI
+
+struct _BrotliDecoderStream {
+        BrotliDecoderState* state;
+        gpointer user_data;
+        StreamWriterFunc writer_func;
+        // output chunk
+        guint8* out;
+        gsize out_size;
+        MemoryCounter* memory;
+        // reached the end of a stream, more input starts a new one
+        gboolean ended;
+        // hands over to another decoder at a stream end, optional
+        StreamSwitchFunc switch_func;
+};
+
+static void brotlidec_stream_init(BrotliDecoderStream* wrapper) {
+        wrapper->state = BrotliDecoderCreateInstance(memory_counter_brotli_alloc,
+                                                     memory_counter_brotli_free,
+                                                     wrapper->memory);
+        if (!wrapper->state) {
+                GST_ERROR("Failed to create Brotli decoder instance");
+        }
+        wrapper->ended = FALSE;
+}
+
+static BrotliDecoderStream* brotlidec_stream_new(gpointer user_data, StreamWriterFunc writer_func,
+                                                 StreamSwitchFunc switch_func,
+                                                 MemoryCounter* memory, gsize out_size) {
+        BrotliDecoderStream* wrapper = BROTLI_DECODER_STREAM(memory_counter_alloc(memory, sizeof(BrotliDecoderStream)));
+        wrapper->user_data = user_data;
+        wrapper->writer_func = writer_func;
+        wrapper->switch_func = switch_func;
+        wrapper->memory = memory;
+        wrapper->out_size = out_size;
+        wrapper->out = memory_counter_alloc(memory, out_size);
+        brotlidec_stream_init(wrapper);
+        return wrapper;
+}
+
+static void brotlidec_stream_free(BrotliDecoderStream* wrapper) {
+        if (wrapper->state) {
+                BrotliDecoderDestroyInstance(wrapper->state);
+        }
+        memory_counter_free(wrapper->memory, wrapper->out);
+        memory_counter_free(wrapper->memory, wrapper);
+}
+
+// Ready for a new stream, Brotli has no reset so only the state is made anew
+static void brotlidec_stream_reset(BrotliDecoderStream* wrapper) {
+        if (wrapper->state) {
+                BrotliDecoderDestroyInstance(wrapper->state);
+        }
+        brotlidec_stream_init(wrapper);
+}
+
+static gboolean brotlidec_stream_at_end(void *w) {
+        return BROTLI_DECODER_STREAM(w)->ended;
+}
+
+// Decompresses one memory block of an input buffer
+static gboolean brotlidec_stream_digest(gpointer w, const guint8* data, gsize size) {
+
+        BrotliDecoderStream *wrapper = BROTLI_DECODER_STREAM(w);
+
+        // unwrap components
+        gpointer user_data = wrapper->user_data;
+        StreamWriterFunc writer_func = wrapper->writer_func;
+
+        // processing state
+        BrotliDecoderResult ret;
+        gsize have;
+        gboolean success = FALSE;
+
+        // output buffer
+        guint8* out = wrapper->out;
+        gsize out_size = wrapper->out_size;
+        gsize avail_out;
+        guint8* next_out;
+
+        // input buffer
+        gsize avail_in = size;
+        const guint8* next_in = data;
+
+        GST_TRACE("Input chunk size: %d", (int) avail_in);
+
+        // one brotli stream after the other, or one of another format
+        if (wrapper->ended && avail_in) {
+                if (wrapper->switch_func && wrapper->switch_func(user_data, next_in, avail_in)) {
+                        GST_DEBUG("Stream end with %d bytes left for another decoder", (int) avail_in);
+                        success = TRUE;
+                        goto done;
+                }
+                brotlidec_stream_reset(wrapper);
+        }
+
+        if (!wrapper->state) {
+                goto done;
+        }
+
+        do {
+                // reset output buffer on every iteration
+                avail_out = out_size;
+                next_out = out;
+
+                ret = BrotliDecoderDecompressStream(wrapper->state, &avail_in, &next_in,
+                                                    &avail_out, &next_out, NULL);
+                GST_TRACE("BrotliDecoderDecompressStream returned %d", (int) ret);
+
+                if (ret == BROTLI_DECODER_RESULT_ERROR) {
+                        GST_ERROR("Brotli decoder error: %s",
+                                  BrotliDecoderErrorString(BrotliDecoderGetErrorCode(wrapper->state)));
+                        goto done;
+                }
+
+                have = out_size - avail_out;
+
+                GST_TRACE("Have %d decompressed bytes, writing to output stream", (int) have);
+
+                if (!writer_func(user_data, out, have)) {
+                        GST_DEBUG("Writer stopped decoding");
+                        goto done;
+                }
+
+        } while (ret == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+
+        if (ret == BROTLI_DECODER_RESULT_SUCCESS) {
+                wrapper->ended = TRUE;
+                if (avail_in && wrapper->switch_func && wrapper->switch_func(user_data, next_in, avail_in)) {
+                        GST_DEBUG("Stream end with %d bytes left for another decoder", (int) avail_in);
+                } else if (avail_in) {
+                        GST_WARNING("Discarding %d bytes of trailing data after Brotli stream end", (int) avail_in);
+                }
+        }
+
+        success = TRUE;
+
+done:
+        return success;
+}
+
+static gboolean brotlidec_stream_digest_buffer(void *w, GstBuffer* buf) {
+        GST_TRACE("Processing one buffer for decompression: %" GST_PTR_FORMAT, buf);
+
+        return buffer_foreach_chunk(buf, brotlidec_stream_digest, w);
+}
+
+#else // no libbrotlidec, the format is refused at setup and none of this runs
+
+struct _BrotliDecoderStream {
+        StreamWriterFunc writer_func;
+        gsize out_size;
+};
+
+static BrotliDecoderStream* brotlidec_stream_new(gpointer user_data, StreamWriterFunc writer_func,
+                                                 StreamSwitchFunc switch_func,
+                                                 MemoryCounter* memory, gsize out_size) {
+        GST_ERROR("Built without Brotli support");
+        return NULL;
+}
+
+static void brotlidec_stream_free(BrotliDecoderStream* wrapper) {
+}
+
+static void brotlidec_stream_reset(BrotliDecoderStream* wrapper) {
+}
+
+static gboolean brotlidec_stream_at_end(void *w) {
+        return TRUE;
+}
+
+static gboolean brotlidec_stream_digest_buffer(void *w, GstBuffer* buf) {
+        return FALSE;
+}
+
+#endif
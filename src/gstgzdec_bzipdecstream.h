@@ -1,20 +1,69 @@
 #pragma once
 
 #define BZIP_DEC_STREAM_OUT_BUFFER_SIZE 16*1024
+#define BZIP_DEC_STREAM_OUT_BUFFER_SIZE_SMALL 4*1024
+// 48 bit magic starting every block (BCD pi), not byte aligned past the first block of a stream
+#define BZIP_BLOCK_MAGIC G_GUINT64_CONSTANT(0x314159265359)
+#define BZIP_BLOCK_MAGIC_MASK G_GUINT64_CONSTANT(0xffffffffffff)
+// not libbzip2 return codes
+#define BZIP_DEC_STREAM_WRITER_STOPPED (-100)
+#define BZIP_DEC_STREAM_SWITCHED (-101)
 
 #define BZIP_DECODER_STREAM(ptr) ((BzipDecoderStream*)ptr)
 typedef struct _BzipDecoderStream BzipDecoderStream;
-typedef void (*StreamWriterFunc)(gpointer user_data, gpointer data, gsize bytes);
+// returns FALSE when decoding should stop
+typedef gboolean (*StreamWriterFunc)(gpointer user_data, gpointer data, gsize bytes);
+// called when decoding resumes after corrupt data, with the number of input bytes given up
+typedef void (*StreamResyncFunc)(gpointer user_data, guint64 skipped);
+// called at a stream end with more input following, with that input. Returns TRUE
+// when the stream that follows is of another format, this decoder then stops there.
+typedef gboolean (*StreamSwitchFunc)(gpointer user_data, gconstpointer next, gsize avail);
 typedef bz_stream BzipStream;
 
 struct _BzipDecoderStream {
         BzipStream stream;
         gpointer user_data;
         StreamWriterFunc writer_func;
+        // about 2.3 MB less per stream, at about half the speed
+        gboolean small;
+        // output chunk
+        gchar* out;
+        gsize out_size;
+        MemoryCounter* memory;
+        // reached the end of a stream, more input starts a new one
+        gboolean ended;
+        // error recovery, only when there is a resync function
+        StreamResyncFunc resync_func;
+        // looking for the next block magic after corrupt data
+        gboolean resyncing;
+        guint64 skipped;
+        guint64 magic_bits;
+        // resumed at a block which is not byte aligned, the input is shifted
+        // left by this many bits, carrying over the last byte of the previous chunk
+        guint shift;
+        guchar carry;
+        // hands over to another decoder at a stream end, optional
+        StreamSwitchFunc switch_func;
 };
 
-static BzipDecoderStream* bzipdec_stream_new(gpointer user_data, StreamWriterFunc writer_func) {
-        BzipDecoderStream* wrapper = BZIP_DECODER_STREAM(g_malloc(sizeof(BzipDecoderStream)));
+static void bzipdec_stream_init(BzipDecoderStream* wrapper) {
+        memset(&wrapper->stream, 0, sizeof(BzipStream));
+        wrapper->stream.bzalloc = memory_counter_bzalloc;
+        wrapper->stream.bzfree = memory_counter_bzfree;
+        wrapper->stream.opaque = wrapper->memory;
+        GST_INFO("+BZ2_bzDecompressInit");
+        int ret = BZ2_bzDecompressInit(&wrapper->stream, 0, wrapper->small);
+        GST_INFO("-BZ2_bzDecompressInit");
+        if (ret != BZ_OK) {
+                GST_ERROR("Got code %d when calling BZ2_bzDecompressInit", (int) ret);
+        }
+        wrapper->ended = FALSE;
+}
+
+static BzipDecoderStream* bzipdec_stream_new(gpointer user_data, StreamWriterFunc writer_func,
+                                             StreamResyncFunc resync_func, StreamSwitchFunc switch_func,
+                                             gboolean small, MemoryCounter* memory, gsize out_size) {
+        BzipDecoderStream* wrapper = BZIP_DECODER_STREAM(memory_counter_alloc(memory, sizeof(BzipDecoderStream)));
         // NOTE:
         // If we dont do this memset BZ2_bzDecompressInit crashes 1 out of 5 times consistent
         // with a SEGV sig because it expects to initialize a completely 0'd piece of memory,
@@ -22,61 +71,188 @@ static BzipDecoderStream* bzipdec_stream_new(gpointer user_data, StreamWriterFun
         memset(wrapper, 0, sizeof(BzipDecoderStream)); // Important
         wrapper->user_data = user_data;
         wrapper->writer_func = writer_func;
-        GST_INFO("+BZ2_bzDecompressInit");
-        int ret = BZ2_bzDecompressInit(&wrapper->stream, 0, 0);
-        GST_INFO("-BZ2_bzDecompressInit");
-        if (ret != BZ_OK) {
-                GST_ERROR("Got code %d when calling BZ2_bzDecompressInit", (int) ret);
-        }
+        wrapper->resync_func = resync_func;
+        wrapper->switch_func = switch_func;
+        wrapper->small = small;
+        wrapper->memory = memory;
+        wrapper->out_size = out_size;
+        wrapper->out = memory_counter_alloc(memory, out_size);
+        bzipdec_stream_init(wrapper);
         return wrapper;
 }
 
 
 static void bzipdec_stream_free(BzipDecoderStream* wrapper) {
         BZ2_bzDecompressEnd(&wrapper->stream);
-        g_free(wrapper);
+        memory_counter_free(wrapper->memory, wrapper->out);
+        memory_counter_free(wrapper->memory, wrapper);
 }
 
-static gboolean bzipdec_stream_digest_buffer(void *w, GstBuffer* buf) {
-
-        GST_TRACE ("Processing one buffer for inflation: %" GST_PTR_FORMAT, buf);
+// Ready for a new stream, only the libbzip2 state is made anew
+static void bzipdec_stream_reset(BzipDecoderStream* wrapper) {
+        BZ2_bzDecompressEnd(&wrapper->stream);
+        bzipdec_stream_init(wrapper);
+        wrapper->resyncing = FALSE;
+        wrapper->skipped = 0;
+        wrapper->magic_bits = 0;
+        wrapper->shift = 0;
+}
 
-        BzipDecoderStream *wrapper = BZIP_DECODER_STREAM(w);
+static gboolean bzipdec_stream_at_end(void *w) {
+        return BZIP_DECODER_STREAM(w)->ended;
+}
 
-        // unwrap components
-        gpointer user_data = wrapper->user_data;
+/*
+   Runs the decompressor over one chunk of input, writing out as it goes. Returns BZ_OK
+   once all of it is consumed, BZIP_DEC_STREAM_WRITER_STOPPED when the writer stopped us, any other code
+   on a decoder error. The bytes consumed are returned in both cases.
+ */
+static int bzipdec_stream_decompress(BzipDecoderStream* wrapper, const gchar* data, guint size, guint* consumed) {
         BzipStream* strm = &wrapper->stream;
-        StreamWriterFunc writer_func = wrapper->writer_func;
+        guint have;
+        int ret = BZ_OK;
+
+        strm->next_in = (char*) data;
+        strm->avail_in = size;
+
+        while(strm->avail_in) {
+
+                // concatenated streams (e.g from pbzip2 or bzenc) decode to the concatenated data
+                if (wrapper->ended) {
+                        if (wrapper->shift) {
+                                // the stream ended off our shifted alignment, the next one is byte aligned
+                                ret = BZ_DATA_ERROR;
+                                break;
+                        }
+                        if (wrapper->switch_func
+                            && wrapper->switch_func(wrapper->user_data, strm->next_in, strm->avail_in)) {
+                                GST_DEBUG("Stream end with %d bytes left for another decoder", (int) strm->avail_in);
+                                ret = BZIP_DEC_STREAM_SWITCHED;
+                                break;
+                        }
+                        GST_DEBUG("Stream end with %d bytes left, restarting for next stream", (int) strm->avail_in);
+                        char* next_in = strm->next_in;
+                        unsigned int avail_in = strm->avail_in;
+                        BZ2_bzDecompressEnd(strm);
+                        bzipdec_stream_init(wrapper);
+                        strm->next_in = next_in;
+                        strm->avail_in = avail_in;
+                }
+
+                // reset output buffer on every iteration
+                strm->avail_out = wrapper->out_size;
+                strm->next_out = wrapper->out;
+
+                // this function will inflate as much from the input
+                // as our output buffer can take
+                // therefore we need to iterate eventually several times
+                // over this function
+                GST_TRACE ("Running decompress func now");
+                ret = BZ2_bzDecompress(strm);
+                GST_TRACE("BZ2_bzDecompress returned %d", (int) ret);
+
+                GST_TRACE ("Remaining output buffer bytes: %d", (int) strm->avail_out);
+
+                have = wrapper->out_size - strm->avail_out;
+
+                GST_TRACE("Have %d inflated bytes, writing to output stream", (int) have);
+
+                // what was decoded before an error is still good
+                if (!wrapper->writer_func(wrapper->user_data, wrapper->out, have)) {
+                        GST_DEBUG("Writer stopped decoding");
+                        ret = BZIP_DEC_STREAM_WRITER_STOPPED;
+                        break;
+                }
+
+                if (ret == BZ_STREAM_END) {
+                        wrapper->ended = TRUE;
+                } else if (ret != BZ_OK) {
+                        break;
+                }
+                ret = BZ_OK;
+        }
+
+        *consumed = size - strm->avail_in;
+        return ret;
+}
+
+// Shifts the input to the alignment of the block we resynced to
+static void bzipdec_stream_shift(BzipDecoderStream* wrapper, const guchar* data, gchar* shifted, guint size) {
+        guint shift = wrapper->shift;
+        guchar carry = wrapper->carry;
+        guint i;
+
+        for (i = 0; i < size; i++) {
+                shifted[i] = (gchar) ((carry << shift) | (data[i] >> (8 - shift)));
+                carry = data[i];
+        }
+        wrapper->carry = carry;
+}
+
+/*
+   Scans bit by bit for the next block magic after corrupt data, which also finds the
+   first block of the next stream. The decoder is restarted with a stream header followed by
+   the magic, and fed the rest of the block shifted to byte alignment. The block size
+   of the header is the largest so any block fits. Returns the bytes scanned.
+
+   The combined CRC at the end of a stream we resynced into can't match, so
+   that stream ends in another error and a resync to the first block of the next one.
+ */
+static guint bzipdec_stream_resync(BzipDecoderStream* wrapper, const guchar* data, guint size) {
+        static const gchar header[] = { 'B', 'Z', 'h', '9', 0x31, 0x41, 0x59, 0x26, 0x53, 0x59 };
+        guint consumed;
+        guint i;
+        gint bit;
+
+        for (i = 0; i < size; i++) {
+                for (bit = 7; bit >= 0; bit--) {
+                        wrapper->magic_bits = (wrapper->magic_bits << 1) | ((data[i] >> bit) & 1);
+                        if ((wrapper->magic_bits & BZIP_BLOCK_MAGIC_MASK) == BZIP_BLOCK_MAGIC) {
+                                goto found;
+                        }
+                }
+        }
+
+        wrapper->skipped += size;
+        return size;
+
+found:
+        // the block goes on right after the last magic bit
+        wrapper->shift = bit ? 8 - bit : 0;
+        wrapper->carry = data[i];
+        wrapper->skipped += i + 1;
+        wrapper->resyncing = FALSE;
+
+        GST_WARNING("Resuming at block after skipping %" G_GUINT64_FORMAT " bytes", wrapper->skipped);
+
+        BZ2_bzDecompressEnd(&wrapper->stream);
+        bzipdec_stream_init(wrapper);
+        bzipdec_stream_decompress(wrapper, header, sizeof(header), &consumed);
+
+        wrapper->resync_func(wrapper->user_data, wrapper->skipped);
+        wrapper->skipped = 0;
+        return i + 1;
+}
+
+// Decompresses one memory block of an input buffer
+static gboolean bzipdec_stream_digest(gpointer w, const guint8* buffer_data, gsize buffer_size) {
+
+        BzipDecoderStream *wrapper = BZIP_DECODER_STREAM(w);
 
         // processing state
         int ret;
-        guint have;
         gboolean success = FALSE;
 
-        // deflate output buffer
-        gchar out[BZIP_DEC_STREAM_OUT_BUFFER_SIZE];
-        guint out_size = sizeof(out);
-
-        // input buffer
-        guint buffer_size;
-        gpointer buffer_data;
+        guint out_size = wrapper->out_size;
 
-#ifdef USE_GSTREAMER_1_DOT_0_API
-        GstMapInfo map;
-        if (!gst_buffer_map(buf, &map, GST_MAP_READ)) {
-                GST_ERROR ("Error mapping buffer for read access: %" GST_PTR_FORMAT, buf);
-                return Z_ERRNO;
-        }
-        buffer_size = map.size;
-        buffer_data = map.data;
-#else
-        buffer_size = BUFFER_SIZE(buf)
-                      buffer_data = GST_BUFFER_DATA(buf);
-#endif
+        const guchar* input;
+        guint avail, consumed;
+        // shifted input, only used after resyncing to a block which is not byte aligned
+        gchar* shifted = NULL;
 
 #if 0
         // debug: prints hex dump of input buffer
-        guchar* buffer_chars = buffer_data;
+        const guchar* buffer_chars = buffer_data;
         for (gint i = 0; i < buffer_size; i++)
         {
                 if (i > 0) g_print(":");
@@ -89,43 +265,64 @@ static gboolean bzipdec_stream_digest_buffer(void *w, GstBuffer* buf) {
         GST_TRACE ("Input chunk size: %d", (int) buffer_size);
         GST_TRACE ("Total output buffer size: %d", out_size);
 
-        // set initial input pointer and size
-        strm->avail_in = buffer_size;
-        strm->next_in = buffer_data;
+        input = buffer_data;
+        avail = buffer_size;
 
-        while(strm->avail_in) {
+        while (avail) {
+                if (wrapper->resyncing) {
+                        consumed = bzipdec_stream_resync(wrapper, input, avail);
+                        input += consumed;
+                        avail -= consumed;
+                        continue;
+                }
 
-                // reset output buffer on every iteration
-                strm->avail_out = out_size;
-                strm->next_out = out;
+                if (wrapper->shift) {
+                        if (!shifted) {
+                                shifted = memory_counter_alloc(wrapper->memory, out_size);
+                        }
+                        // one byte of output per byte of input, so positions map 1:1
+                        consumed = MIN(avail, out_size);
+                        bzipdec_stream_shift(wrapper, input, shifted, consumed);
+                        ret = bzipdec_stream_decompress(wrapper, shifted, consumed, &consumed);
+                } else {
+                        ret = bzipdec_stream_decompress(wrapper, (const gchar*) input, avail, &consumed);
+                }
+                input += consumed;
+                avail -= consumed;
 
-                // this function will inflate as much from the input
-                // as our output buffer can take
-                // therefore we need to iterate eventually several times
-                // over this function
-                GST_TRACE ("Running decompress func now");
-                ret = BZ2_bzDecompress(strm);
-                if (!(ret == BZ_OK || ret == BZ_STREAM_END)) {
-                        GST_ERROR("BZ2_bzDecompress returned code %d", (int) ret);
+                switch (ret) {
+                case BZ_OK:
+                        break;
+                case BZIP_DEC_STREAM_WRITER_STOPPED:
+                        goto done;
+                case BZIP_DEC_STREAM_SWITCHED:
+                        success = TRUE;
                         goto done;
+                default:
+                        if (!wrapper->resync_func) {
+                                GST_ERROR("BZ2_bzDecompress returned code %d", (int) ret);
+                                goto done;
+                        }
+                        GST_WARNING("Corrupt data (code %d), looking for the next block", (int) ret);
+                        wrapper->resyncing = TRUE;
+                        wrapper->magic_bits = 0;
+                        wrapper->shift = 0;
+                        break;
                 }
-                GST_TRACE("BZ2_bzDecompress returned %d", (int) ret);
-
-                GST_TRACE ("Remaining output buffer bytes: %d", (int) strm->avail_out);
-
-                have = out_size - strm->avail_out;
-
-                GST_TRACE("Have %d inflated bytes, writing to output stream", (int) have);
-
-                writer_func(user_data, out, have);
         }
 
         success = TRUE;
 
 done:
-#ifdef USE_GSTREAMER_1_DOT_0_API
-        gst_buffer_unmap (buf, &map);
-#endif
+        if (shifted) {
+                memory_counter_free(wrapper->memory, shifted);
+        }
         return success;
 }
 
+static gboolean bzipdec_stream_digest_buffer(void *w, GstBuffer* buf) {
+        GST_TRACE ("Processing one buffer for inflation: %" GST_PTR_FORMAT, buf);
+
+        return buffer_foreach_chunk(buf, bzipdec_stream_digest, w);
+}
+
@@ -0,0 +1,298 @@
+#pragma once
+
+/* A cache of decompressed streams on local disk, shared by every element (and process)
+   pointed at the same directory. An entry is a file named after the SHA-256 of the decoding
+   parameters, the identity of the input file and samples of its contents (see cache_key),
+   holding the decompressed bytes. It is written to a
+   temporary file and renamed once complete, so readers never see a partial entry. The
+   modification time of an entry is its last use: hits touch it, and the least recently used
+   entries are deleted when the directory grows past its size limit. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#define CACHE_ENTRY_SUFFIX ".gzdec"
+// size of the buffers a hit is served in
+#define CACHE_CHUNK_SIZE (256 * 1024)
+// temporary files left behind by a crashed writer are deleted after this long
+#define CACHE_STALE_TMP_AGE (60 * 60)
+
+// Parts of the compressed stream the key is taken over, the rest is covered by the file times
+#define CACHE_KEY_EDGE_SIZE (64 * 1024)
+#define CACHE_KEY_SAMPLES 16
+#define CACHE_KEY_SAMPLE_SIZE (4 * 1024)
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+#define CACHE_STAT_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#else
+#define CACHE_STAT_MTIME_NSEC(st) 0
+#endif
+#ifdef HAVE_STRUCT_STAT_ST_CTIM
+#define CACHE_STAT_CTIME_NSEC(st) ((st)->st_ctim.tv_nsec)
+#else
+#define CACHE_STAT_CTIME_NSEC(st) 0
+#endif
+
+/*
+   The key covers the parameters the output depends on, the identity of the input file and
+   samples of the compressed stream: its start and end and evenly spaced blocks in between.
+   Hashing the whole stream took about as long as decoding it, which defeated the cache.
+   Any write to the file moves its change time, which user space can't set back, so the
+   samples only guard against file systems with coarse times. The price is that a copy of
+   a file doesn't share the entry of the original. SHA-256 stays, it is over some 200 KiB
+   at most, and keys are file names shared across processes.
+ */
+static gchar* cache_key(const gchar* params, const GStatBuf* st, const guchar* data, gsize size) {
+        GChecksum* checksum = g_checksum_new(G_CHECKSUM_SHA256);
+        gchar* identity;
+        gchar* key;
+        gsize stride, offset;
+        guint i;
+
+        // the terminating NULs separate the parameters, the identity and the data
+        g_checksum_update(checksum, (const guchar*) params, strlen(params) + 1);
+        identity = g_strdup_printf("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT
+                                   ":%" G_GINT64_FORMAT ".%ld:%" G_GINT64_FORMAT ".%ld",
+                                   (guint64) st->st_dev, (guint64) st->st_ino, (guint64) size,
+                                   (gint64) st->st_mtime, (long) CACHE_STAT_MTIME_NSEC(st),
+                                   (gint64) st->st_ctime, (long) CACHE_STAT_CTIME_NSEC(st));
+        g_checksum_update(checksum, (const guchar*) identity, strlen(identity) + 1);
+        g_free(identity);
+
+        if (size <= 2 * CACHE_KEY_EDGE_SIZE + CACHE_KEY_SAMPLES * CACHE_KEY_SAMPLE_SIZE) {
+                g_checksum_update(checksum, data, size);
+        } else {
+                g_checksum_update(checksum, data, CACHE_KEY_EDGE_SIZE);
+                stride = (size - 2 * CACHE_KEY_EDGE_SIZE) / CACHE_KEY_SAMPLES;
+                for (i = 0; i < CACHE_KEY_SAMPLES; i++) {
+                        offset = CACHE_KEY_EDGE_SIZE + i * stride;
+                        g_checksum_update(checksum, data + offset, CACHE_KEY_SAMPLE_SIZE);
+                }
+                g_checksum_update(checksum, data + size - CACHE_KEY_EDGE_SIZE, CACHE_KEY_EDGE_SIZE);
+        }
+
+        key = g_strdup(g_checksum_get_string(checksum));
+        g_checksum_free(checksum);
+        return key;
+}
+
+static gchar* cache_entry_path(const gchar* dir, const gchar* key) {
+        gchar* name = g_strconcat(key, CACHE_ENTRY_SUFFIX, NULL);
+        gchar* path = g_build_filename(dir, name, NULL);
+        g_free(name);
+        return path;
+}
+
+// Returns the entry mapped, NULL on a miss
+static GMappedFile* cache_lookup(const gchar* dir, const gchar* key) {
+        gchar* path = cache_entry_path(dir, key);
+        GMappedFile* file = g_mapped_file_new(path, FALSE, NULL);
+
+        if (file) {
+                // marks it as recently used
+                g_utime(path, NULL);
+        }
+        g_free(path);
+        return file;
+}
+
+typedef struct {
+        gchar* path;
+        guint64 size;
+        gint64 mtime;
+} CacheFile;
+
+static gint cache_file_compare_mtime(gconstpointer a, gconstpointer b) {
+        gint64 ma = ((const CacheFile*) a)->mtime;
+        gint64 mb = ((const CacheFile*) b)->mtime;
+        return ma < mb ? -1 : ma > mb;
+}
+
+// Deletes the least recently used entries until the directory holds at most max_bytes
+static void cache_evict(const gchar* dir, guint64 max_bytes) {
+        GDir* d = g_dir_open(dir, 0, NULL);
+        GArray* files;
+        const gchar* name;
+        GStatBuf st;
+        CacheFile file;
+        guint64 total = 0;
+        gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+        guint i;
+
+        if (!d) {
+                return;
+        }
+
+        files = g_array_new(FALSE, FALSE, sizeof(CacheFile));
+        while ((name = g_dir_read_name(d))) {
+                if (!strstr(name, CACHE_ENTRY_SUFFIX)) {
+                        continue;
+                }
+                file.path = g_build_filename(dir, name, NULL);
+                if (g_stat(file.path, &st) < 0) {
+                        g_free(file.path);
+                        continue;
+                }
+                if (!g_str_has_suffix(name, CACHE_ENTRY_SUFFIX)) {
+                        if (now - st.st_mtime > CACHE_STALE_TMP_AGE) {
+                                GST_DEBUG("Deleting stale cache file %s", file.path);
+                                g_unlink(file.path);
+                        }
+                        g_free(file.path);
+                        continue;
+                }
+                file.size = st.st_size;
+                file.mtime = st.st_mtime;
+                total += file.size;
+                g_array_append_val(files, file);
+        }
+        g_dir_close(d);
+
+        g_array_sort(files, cache_file_compare_mtime);
+        for (i = 0; i < files->len && total > max_bytes; i++) {
+                CacheFile* f = &g_array_index(files, CacheFile, i);
+                GST_DEBUG("Evicting cache entry %s (%" G_GUINT64_FORMAT " bytes)", f->path, f->size);
+                if (g_unlink(f->path) == 0) {
+                        total -= f->size;
+                }
+        }
+
+        for (i = 0; i < files->len; i++) {
+                g_free(g_array_index(files, CacheFile, i).path);
+        }
+        g_array_free(files, TRUE);
+}
+
+#define CACHE_WRITER(ptr) ((CacheWriter*)ptr)
+typedef struct _CacheWriter CacheWriter;
+
+// Writes a new entry while the stream is decoded
+struct _CacheWriter {
+        gchar* dir;
+        gchar* path;
+        gchar* tmp_path;
+        FILE* file;
+        guint64 size;
+        guint64 max_bytes;
+        // nothing more is written, the entry is dropped at the end
+        gboolean failed;
+};
+
+static void cache_writer_free(CacheWriter* writer) {
+        g_free(writer->dir);
+        g_free(writer->path);
+        g_free(writer->tmp_path);
+        g_free(writer);
+}
+
+// Returns NULL when the entry can't be created
+static CacheWriter* cache_writer_new(const gchar* dir, const gchar* key, guint64 max_bytes) {
+        CacheWriter* writer;
+        gchar* path;
+        gchar* tmp_path;
+        gint fd;
+
+        if (g_mkdir_with_parents(dir, 0755) < 0) {
+                GST_WARNING("Failed to create cache directory %s: %s", dir, g_strerror(errno));
+                return NULL;
+        }
+
+        path = cache_entry_path(dir, key);
+        tmp_path = g_strconcat(path, ".XXXXXX", NULL);
+        fd = g_mkstemp(tmp_path);
+        if (fd < 0) {
+                GST_WARNING("Failed to create cache file %s: %s", tmp_path, g_strerror(errno));
+                g_free(tmp_path);
+                g_free(path);
+                return NULL;
+        }
+
+        writer = g_new0(CacheWriter, 1);
+        writer->dir = g_strdup(dir);
+        writer->path = path;
+        writer->tmp_path = tmp_path;
+        writer->file = fdopen(fd, "wb");
+        writer->max_bytes = max_bytes;
+        if (!writer->file) {
+                GST_WARNING("Failed to open cache file %s: %s", tmp_path, g_strerror(errno));
+                close(fd);
+                g_unlink(tmp_path);
+                cache_writer_free(writer);
+                return NULL;
+        }
+        return writer;
+}
+
+static void cache_writer_write(CacheWriter* writer, gconstpointer data, gsize bytes) {
+        if (writer->failed || !bytes) {
+                return;
+        }
+        writer->size += bytes;
+        if (writer->size > writer->max_bytes) {
+                GST_INFO("Stream is larger than the cache, not caching it");
+                writer->failed = TRUE;
+                return;
+        }
+        if (fwrite(data, 1, bytes, writer->file) != bytes) {
+                GST_WARNING("Failed to write cache file %s: %s", writer->tmp_path, g_strerror(errno));
+                writer->failed = TRUE;
+        }
+}
+
+// The stream did not end properly, or the entry failed
+static void cache_writer_abort(CacheWriter* writer) {
+        fclose(writer->file);
+        g_unlink(writer->tmp_path);
+        cache_writer_free(writer);
+}
+
+// The stream is complete, the entry becomes visible
+static void cache_writer_commit(CacheWriter* writer) {
+        if (writer->failed) {
+                cache_writer_abort(writer);
+                return;
+        }
+        if (fclose(writer->file) != 0 || g_rename(writer->tmp_path, writer->path) < 0) {
+                GST_WARNING("Failed to complete cache entry %s: %s", writer->path, g_strerror(errno));
+                g_unlink(writer->tmp_path);
+        } else {
+                GST_INFO("Cached %" G_GUINT64_FORMAT " decompressed bytes as %s", writer->size, writer->path);
+                cache_evict(writer->dir, writer->max_bytes);
+        }
+        cache_writer_free(writer);
+}
+
+#define CACHE_ENTRY(ptr) ((CacheEntry*)ptr)
+typedef struct _CacheEntry CacheEntry;
+
+// A hit, served in place of a decoder
+struct _CacheEntry {
+        gpointer user_data;
+        GMappedFile* file;
+        // of the compressed stream it stands for
+        guint64 input_size;
+        gboolean served;
+};
+
+static CacheEntry* cache_entry_new(gpointer user_data, GMappedFile* file, guint64 input_size) {
+        CacheEntry* entry = g_new0(CacheEntry, 1);
+        entry->user_data = user_data;
+        entry->file = file;
+        entry->input_size = input_size;
+        return entry;
+}
+
+static void cache_entry_free(CacheEntry* entry) {
+        g_mapped_file_unref(entry->file);
+        g_free(entry);
+}
+
+// Whether the data lies in the mapped entry, and can be handed on without a copy
+static gboolean cache_entry_contains(CacheEntry* entry, gconstpointer data, gsize bytes) {
+        const gchar* start = g_mapped_file_get_contents(entry->file);
+        gsize length = g_mapped_file_get_length(entry->file);
+
+        return start && (const gchar*) data >= start && (const gchar*) data + bytes <= start + length;
+}
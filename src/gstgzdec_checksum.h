@@ -0,0 +1,159 @@
+#pragma once
+
+/* Checksums computed on the decompressed output as it is produced.
+
+   CRC-32 is zlib's crc32(), which is table-braided in recent zlib and folded with PCLMUL
+   in zlib-ng and other optimized builds. CRC-32C uses the SSE4.2 crc32 instruction
+   (selected at runtime) or the ARMv8 CRC extension (selected at compile time),
+   with a table-driven fallback. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHECKSUM_HAVE_SSE42_CRC32C 1
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#define CHECKSUM_HAVE_ARM_CRC32C 1
+#include <arm_acle.h>
+#endif
+
+#define CHECKSUM_STATE(ptr) ((ChecksumState*)ptr)
+typedef struct _ChecksumState ChecksumState;
+
+struct _ChecksumState {
+        GstGzDecChecksum types;
+        guint32 crc32;
+        guint32 crc32c;
+        GChecksum* sha256;
+        guint64 size;
+};
+
+static guint32 crc32c_table[256];
+
+static gpointer crc32c_table_init(gpointer unused) {
+        guint32 i, j, crc;
+        for (i = 0; i < 256; i++) {
+                crc = i;
+                for (j = 0; j < 8; j++) {
+                        crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+                }
+                crc32c_table[i] = crc;
+        }
+        return NULL;
+}
+
+static guint32 crc32c_sw(guint32 crc, const guchar* data, gsize len) {
+        static GOnce once = G_ONCE_INIT;
+        g_once(&once, crc32c_table_init, NULL);
+
+        crc = ~crc;
+        while (len--) {
+                crc = crc32c_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+}
+
+#if CHECKSUM_HAVE_SSE42_CRC32C
+__attribute__((target("sse4.2")))
+static guint32 crc32c_sse42(guint32 crc, const guchar* data, gsize len) {
+        crc = ~crc;
+#if defined(__x86_64__)
+        guint64 crc64 = crc;
+        for (; len >= 8; len -= 8, data += 8) {
+                guint64 word;
+                memcpy(&word, data, sizeof(word));
+                crc64 = _mm_crc32_u64(crc64, word);
+        }
+        crc = (guint32) crc64;
+#endif
+        for (; len >= 4; len -= 4, data += 4) {
+                guint32 word;
+                memcpy(&word, data, sizeof(word));
+                crc = _mm_crc32_u32(crc, word);
+        }
+        while (len--) {
+                crc = _mm_crc32_u8(crc, *data++);
+        }
+        return ~crc;
+}
+#endif
+
+#if CHECKSUM_HAVE_ARM_CRC32C
+static guint32 crc32c_arm(guint32 crc, const guchar* data, gsize len) {
+        crc = ~crc;
+        for (; len >= 8; len -= 8, data += 8) {
+                guint64 word;
+                memcpy(&word, data, sizeof(word));
+                crc = __crc32cd(crc, word);
+        }
+        while (len--) {
+                crc = __crc32cb(crc, *data++);
+        }
+        return ~crc;
+}
+#endif
+
+typedef guint32 (*Crc32cFunc)(guint32 crc, const guchar* data, gsize len);
+
+static gpointer crc32c_select(gpointer unused) {
+#if CHECKSUM_HAVE_SSE42_CRC32C
+        if (__builtin_cpu_supports("sse4.2")) {
+                return crc32c_sse42;
+        }
+#elif CHECKSUM_HAVE_ARM_CRC32C
+        return crc32c_arm;
+#endif
+        return crc32c_sw;
+}
+
+static guint32 crc32c(guint32 crc, const guchar* data, gsize len) {
+        static GOnce once = G_ONCE_INIT;
+        g_once(&once, crc32c_select, NULL);
+        return ((Crc32cFunc) once.retval)(crc, data, len);
+}
+
+static ChecksumState* checksum_state_new(GstGzDecChecksum types) {
+        ChecksumState* state = CHECKSUM_STATE(g_malloc0(sizeof(ChecksumState)));
+        state->types = types;
+        state->crc32 = crc32(0L, Z_NULL, 0);
+        state->crc32c = 0;
+        if (types & GST_GZDEC_CHECKSUM_SHA256) {
+                state->sha256 = g_checksum_new(G_CHECKSUM_SHA256);
+        }
+        return state;
+}
+
+static void checksum_state_free(ChecksumState* state) {
+        if (state->sha256) {
+                g_checksum_free(state->sha256);
+        }
+        g_free(state);
+}
+
+static void checksum_state_update(ChecksumState* state, gconstpointer data, gsize bytes) {
+        state->size += bytes;
+        if (state->types & GST_GZDEC_CHECKSUM_CRC32) {
+                state->crc32 = crc32(state->crc32, data, (uInt) bytes);
+        }
+        if (state->types & GST_GZDEC_CHECKSUM_CRC32C) {
+                state->crc32c = crc32c(state->crc32c, data, bytes);
+        }
+        if (state->sha256) {
+                g_checksum_update(state->sha256, data, bytes);
+        }
+}
+
+// Returns a new structure with the results, for an element message
+static GstStructure* checksum_state_to_structure(ChecksumState* state, const gchar* name) {
+        GstStructure* s = gst_structure_new(name,
+                                            "size", G_TYPE_UINT64, state->size,
+                                            NULL);
+        if (state->types & GST_GZDEC_CHECKSUM_CRC32) {
+                gst_structure_set(s, "crc32", G_TYPE_UINT, state->crc32, NULL);
+        }
+        if (state->types & GST_GZDEC_CHECKSUM_CRC32C) {
+                gst_structure_set(s, "crc32c", G_TYPE_UINT, state->crc32c, NULL);
+        }
+        if (state->sha256) {
+                gst_structure_set(s, "sha256", G_TYPE_STRING, g_checksum_get_string(state->sha256), NULL);
+        }
+        return s;
+}
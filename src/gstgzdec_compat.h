@@ -5,9 +5,31 @@
 // GstTask API. The two implementations might however compatible.
 #define USE_GSTREAMER_1_DOT_0_API TRUE
 
+// Called for every memory block of a buffer, returns FALSE to stop
+typedef gboolean (*BufferChunkFunc)(gpointer user_data, const guint8* data, gsize size);
+
 #if USE_GSTREAMER_1_DOT_0_API
 
-void buffer_set_data (GstBuffer* buf, gpointer data, gsize size) {
+// Maps one memory block at a time, mapping the whole buffer would merge (copy) them
+static inline gboolean buffer_foreach_chunk (GstBuffer* buf, BufferChunkFunc func, gpointer user_data) {
+        GstMapInfo map;
+        GstMemory* mem;
+        guint i, n = gst_buffer_n_memory(buf);
+        gboolean ret = TRUE;
+
+        for (i = 0; ret && i < n; i++) {
+                mem = gst_buffer_peek_memory(buf, i);
+                if (!gst_memory_map(mem, &map, GST_MAP_READ)) {
+                        GST_ERROR ("Error mapping memory %u for read access: %" GST_PTR_FORMAT, i, buf);
+                        return FALSE;
+                }
+                ret = func(user_data, map.data, map.size);
+                gst_memory_unmap(mem, &map);
+        }
+        return ret;
+}
+
+static inline void buffer_set_data (GstBuffer* buf, gpointer data, gsize size) {
         GstMapInfo map;
         if (!gst_buffer_map(buf, &map, GST_MAP_WRITE)) {
                 GST_ERROR ("Error mapping buffer for write access: %" GST_PTR_FORMAT, buf);
@@ -28,6 +50,12 @@ void buffer_set_data (GstBuffer* buf, gpointer data, gsize size) {
         #define BUFFER_SET_DATA(buf, data, size) buffer_set_data(buf, data, size)
         #define BUFFER_ALLOC(size) gst_buffer_new_allocate(NULL, size, NULL)
         #define BUFFER_SIZE gst_buffer_get_size
+        #define BUFFER_NEW_WRAPPED_BYTES(bytes) gst_buffer_new_wrapped_bytes(bytes)
+        #define BUFFER_FILL(buf, offset, data, size) gst_buffer_fill(buf, offset, data, size)
+        #define BUFFER_NEW_WRAPPED_STATIC(data, size) gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, (gpointer) (data), size, 0, size, NULL, NULL)
+        #define BUFFER_EXTRACT(buf, offset, dest, size) gst_buffer_extract(buf, offset, dest, size)
+        #define BUFFER_SUB(buf, offset, size) gst_buffer_copy_region(buf, GST_BUFFER_COPY_MEMORY, offset, size)
+        #define BUFFER_APPEND(buf1, buf2) gst_buffer_append(buf1, buf2)
 
 #else // fallback to default: GStreamer 0.10.x API
 
@@ -35,6 +63,40 @@ void buffer_set_data (GstBuffer* buf, gpointer data, gsize size) {
         #define BUFFER_SET_DATA(buf, data, size) gst_buffer_set_data(buf, data, size)
         #define BUFFER_ALLOC(size) gst_buffer_new_and_alloc(size)
         #define BUFFER_SIZE GST_BUFFER_SIZE
+        #define BUFFER_NEW_WRAPPED_BYTES(bytes) buffer_new_from_bytes(bytes)
+        #define BUFFER_FILL(buf, offset, data, size) memcpy(GST_BUFFER_DATA(buf) + (offset), data, size)
+        #define BUFFER_NEW_WRAPPED_STATIC(data, size) buffer_new_static(data, size)
+        #define BUFFER_EXTRACT(buf, offset, dest, size) buffer_extract(buf, offset, dest, size)
+        #define BUFFER_SUB(buf, offset, size) gst_buffer_create_sub(buf, offset, size)
+        #define BUFFER_APPEND(buf1, buf2) gst_buffer_join(buf1, buf2)
+        #define GST_FLOW_EOS GST_FLOW_UNEXPECTED
+
+static inline GstBuffer* buffer_new_from_bytes (GBytes* bytes) {
+        GstBuffer* buf = gst_buffer_new_and_alloc(g_bytes_get_size(bytes));
+        memcpy(GST_BUFFER_DATA(buf), g_bytes_get_data(bytes, NULL), g_bytes_get_size(bytes));
+        return buf;
+}
+
+static inline gboolean buffer_foreach_chunk (GstBuffer* buf, BufferChunkFunc func, gpointer user_data) {
+        return func(user_data, GST_BUFFER_DATA(buf), GST_BUFFER_SIZE(buf));
+}
+
+static inline gsize buffer_extract (GstBuffer* buf, gsize offset, gpointer dest, gsize size) {
+        if (offset >= GST_BUFFER_SIZE(buf)) {
+                return 0;
+        }
+        size = MIN(size, GST_BUFFER_SIZE(buf) - offset);
+        memcpy(dest, GST_BUFFER_DATA(buf) + offset, size);
+        return size;
+}
+
+// Memory owned by someone else, which outlives the buffer
+static inline GstBuffer* buffer_new_static (gconstpointer data, gsize size) {
+        GstBuffer* buf = gst_buffer_new();
+        GST_BUFFER_DATA(buf) = (guint8*) data;
+        GST_BUFFER_SIZE(buf) = size;
+        return buf;
+}
 
 #endif
 
@@ -0,0 +1,61 @@
+#pragma once
+
+/* This is a store of preset dictionaries, keyed by dictionary ID.
+
+   Zlib identifies a preset dictionary by the Adler-32 checksum of its contents
+   (the DICTID field of the stream header, found in strm->adler once inflate returned Z_NEED_DICT).
+   Other codecs with dictionary support (zstd has its own dictionary ID in the frame header)
+   can share the same store by adding entries under the ID their format uses. */
+
+typedef GHashTable DictionaryStore;
+
+static DictionaryStore* dictionary_store_new(void) {
+        return g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                     NULL, (GDestroyNotify) g_bytes_unref);
+}
+
+static DictionaryStore* dictionary_store_ref(DictionaryStore* store) {
+        return g_hash_table_ref(store);
+}
+
+static void dictionary_store_unref(DictionaryStore* store) {
+        g_hash_table_unref(store);
+}
+
+static guint32 dictionary_adler32_id(GBytes* bytes) {
+        gsize size;
+        const guchar* data = g_bytes_get_data(bytes, &size);
+        return (guint32) adler32(adler32(0L, Z_NULL, 0), data, (uInt) size);
+}
+
+// Takes a new reference on the bytes
+static void dictionary_store_add(DictionaryStore* store, guint32 id, GBytes* bytes) {
+        GST_DEBUG("Adding dictionary of %d bytes with ID %08x", (int) g_bytes_get_size(bytes), id);
+        g_hash_table_replace(store, GUINT_TO_POINTER(id), g_bytes_ref(bytes));
+}
+
+static gboolean dictionary_store_add_file(DictionaryStore* store, const gchar* path) {
+        gchar* contents;
+        gsize length;
+        GError* error = NULL;
+        GBytes* bytes;
+
+        if (!g_file_get_contents(path, &contents, &length, &error)) {
+                GST_ERROR("Failed to read dictionary file %s: %s", path, error->message);
+                g_error_free(error);
+                return FALSE;
+        }
+
+        bytes = g_bytes_new_take(contents, length);
+        dictionary_store_add(store, dictionary_adler32_id(bytes), bytes);
+        g_bytes_unref(bytes);
+        return TRUE;
+}
+
+// Returns a borrowed reference or NULL
+static GBytes* dictionary_store_lookup(DictionaryStore* store, guint32 id) {
+        if (!store) {
+                return NULL;
+        }
+        return (GBytes*) g_hash_table_lookup(store, GUINT_TO_POINTER(id));
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+/* Output memory in memfd files, wrapped by a GstFdAllocator, so that the decompressed data
+   can be handed to other processes by file descriptor (unixfdsink and the like) without
+   another copy. Buffers are cut page aligned out of segments of MEMFD_SEGMENT_SIZE, which
+   also suits O_DIRECT writers. A segment is released once the last buffer cut from it is
+   gone, its file then goes back to the ring to be cut again, still mapped. */
+
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_GST_FD_ALLOCATOR) && USE_GSTREAMER_1_DOT_0_API
+#define GZDEC_HAVE_MEMFD 1
+#endif
+
+#ifdef GZDEC_HAVE_MEMFD
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <gst/allocators/gstfdmemory.h>
+#endif
+
+#define MEMFD_SEGMENT_SIZE (4 * 1024 * 1024)
+// released segments kept for reuse, beyond that their files are closed
+#define MEMFD_RING_SPARE 8
+
+#define MEMFD_RING(ptr) ((MemfdRing*)ptr)
+typedef struct _MemfdRing MemfdRing;
+
+#ifdef GZDEC_HAVE_MEMFD
+
+typedef struct _MemfdSegment MemfdSegment;
+
+struct _MemfdSegment {
+        MemfdRing* ring;
+        gint fd;
+        gsize size;
+        // our own writable mapping, kept as long as the file
+        guint8* base;
+};
+
+struct _MemfdRing {
+        // one for the owner and one for every segment in use
+        gint refcount;
+        GstAllocator* allocator;
+        gsize page_size;
+        // guards the spare segments, they come back from whichever thread frees the last buffer
+        GMutex lock;
+        GQueue* spare;
+        // segment being cut, and the next free offset in it
+        MemfdSegment* current;
+        GstMemory* memory;
+        gsize offset;
+};
+
+static MemfdSegment* memfd_segment_new(gsize size) {
+        MemfdSegment* segment;
+        guint8* base;
+        gint fd = memfd_create("gzdec", MFD_CLOEXEC);
+
+        if (fd < 0) {
+                GST_ERROR("memfd_create failed: %s", g_strerror(errno));
+                return NULL;
+        }
+        if (ftruncate(fd, size) < 0) {
+                GST_ERROR("Failed to size memfd to %" G_GSIZE_FORMAT " bytes: %s", size, g_strerror(errno));
+                close(fd);
+                return NULL;
+        }
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+                GST_ERROR("Failed to map memfd: %s", g_strerror(errno));
+                close(fd);
+                return NULL;
+        }
+
+        segment = g_new0(MemfdSegment, 1);
+        segment->fd = fd;
+        segment->size = size;
+        segment->base = base;
+        return segment;
+}
+
+static void memfd_segment_free(MemfdSegment* segment) {
+        munmap(segment->base, segment->size);
+        close(segment->fd);
+        g_free(segment);
+}
+
+static void memfd_ring_unref(MemfdRing* ring) {
+        if (!g_atomic_int_dec_and_test(&ring->refcount)) {
+                return;
+        }
+        g_queue_free_full(ring->spare, (GDestroyNotify) memfd_segment_free);
+        g_mutex_clear(&ring->lock);
+        gst_object_unref(ring->allocator);
+        g_free(ring);
+}
+
+// The last buffer cut from the segment is gone
+static void memfd_segment_released(gpointer data, GstMiniObject* memory) {
+        MemfdSegment* segment = data;
+        MemfdRing* ring = segment->ring;
+
+        g_mutex_lock(&ring->lock);
+        if (segment->size == MEMFD_SEGMENT_SIZE && g_queue_get_length(ring->spare) < MEMFD_RING_SPARE) {
+                g_queue_push_tail(ring->spare, segment);
+                segment = NULL;
+        }
+        g_mutex_unlock(&ring->lock);
+
+        if (segment) {
+                memfd_segment_free(segment);
+        }
+        memfd_ring_unref(ring);
+}
+
+static MemfdRing* memfd_ring_new(void) {
+        MemfdRing* ring = g_new0(MemfdRing, 1);
+        ring->refcount = 1;
+        ring->allocator = gst_fd_allocator_new();
+        ring->page_size = (gsize) sysconf(_SC_PAGESIZE);
+        g_mutex_init(&ring->lock);
+        ring->spare = g_queue_new();
+        return ring;
+}
+
+// Drops our hold on the current segment, the buffers still out keep theirs
+static void memfd_ring_free(MemfdRing* ring) {
+        if (ring->memory) {
+                gst_memory_unref(ring->memory);
+                ring->memory = NULL;
+        }
+        memfd_ring_unref(ring);
+}
+
+// Larger buffers get a segment of their own, which is not kept for reuse
+static gboolean memfd_ring_next_segment(MemfdRing* ring, gsize size) {
+        MemfdSegment* segment = NULL;
+
+        if (ring->memory) {
+                gst_memory_unref(ring->memory);
+                ring->memory = NULL;
+        }
+
+        if (size <= MEMFD_SEGMENT_SIZE) {
+                g_mutex_lock(&ring->lock);
+                segment = g_queue_pop_head(ring->spare);
+                g_mutex_unlock(&ring->lock);
+                size = MEMFD_SEGMENT_SIZE;
+        } else {
+                size = (size + ring->page_size - 1) / ring->page_size * ring->page_size;
+        }
+
+        if (!segment) {
+                segment = memfd_segment_new(size);
+                if (!segment) {
+                        return FALSE;
+                }
+                segment->ring = ring;
+        }
+
+        ring->memory = gst_fd_allocator_alloc(ring->allocator, segment->fd, segment->size, GST_FD_MEMORY_FLAG_DONT_CLOSE);
+        g_atomic_int_inc(&ring->refcount);
+        gst_mini_object_weak_ref(GST_MINI_OBJECT_CAST(ring->memory), memfd_segment_released, segment);
+        ring->current = segment;
+        ring->offset = 0;
+        return TRUE;
+}
+
+// A buffer of size bytes, its data is to be written through data before it goes out.
+// Returns NULL when no memfd could be made.
+static GstBuffer* memfd_ring_buffer_new(MemfdRing* ring, gsize size, guint8** data) {
+        gsize offset = (ring->offset + ring->page_size - 1) / ring->page_size * ring->page_size;
+        GstBuffer* buf;
+
+        if (!ring->memory || offset + size > ring->current->size) {
+                if (!memfd_ring_next_segment(ring, size)) {
+                        return NULL;
+                }
+                offset = 0;
+        }
+        ring->offset = offset + size;
+
+        *data = ring->current->base + offset;
+        buf = gst_buffer_new();
+        gst_buffer_append_memory(buf, gst_memory_share(ring->memory, offset, size));
+        return buf;
+}
+
+#else // no memfd, output stays in system memory
+
+static MemfdRing* memfd_ring_new(void) {
+        GST_WARNING("Built without memfd support");
+        return NULL;
+}
+
+static void memfd_ring_free(MemfdRing* ring) {
+}
+
+static GstBuffer* memfd_ring_buffer_new(MemfdRing* ring, gsize size, guint8** data) {
+        return NULL;
+}
+
+#endif
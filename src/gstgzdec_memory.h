@@ -0,0 +1,74 @@
+#pragma once
+
+/* Counting allocator handed to the codec libraries, so that an element can report
+   how much memory its decoder state holds. Every block carries its size in a header. */
+
+#define MEMORY_COUNTER_HEADER_SIZE 16 // keeps the malloc alignment
+
+typedef struct _MemoryCounter MemoryCounter;
+
+struct _MemoryCounter {
+        volatile gssize allocated;
+};
+
+static gpointer memory_counter_add(MemoryCounter* counter, guchar* block, gsize size) {
+        *((gsize*) block) = size;
+        g_atomic_pointer_add(&counter->allocated, (gssize) size);
+        return block + MEMORY_COUNTER_HEADER_SIZE;
+}
+
+// For the blocks of our wrappers, aborts when out of memory like g_malloc
+static gpointer memory_counter_alloc(MemoryCounter* counter, gsize size) {
+        return memory_counter_add(counter, g_malloc(size + MEMORY_COUNTER_HEADER_SIZE), size);
+}
+
+// For the codec libraries, which report a failed allocation as an error
+static gpointer memory_counter_try_alloc(MemoryCounter* counter, gsize size) {
+        guchar* block = g_try_malloc(size + MEMORY_COUNTER_HEADER_SIZE);
+        if (!block) {
+                return NULL;
+        }
+        return memory_counter_add(counter, block, size);
+}
+
+static void memory_counter_free(MemoryCounter* counter, gpointer address) {
+        guchar* block;
+        if (!address) {
+                return;
+        }
+        block = (guchar*) address - MEMORY_COUNTER_HEADER_SIZE;
+        g_atomic_pointer_add(&counter->allocated, -(gssize) *((gsize*) block));
+        g_free(block);
+}
+
+static gsize memory_counter_get(MemoryCounter* counter) {
+        return (gsize) g_atomic_pointer_get(&counter->allocated);
+}
+
+// Adapters for the allocator hooks of the codec libraries
+
+static voidpf memory_counter_zalloc(voidpf opaque, uInt items, uInt size) {
+        return memory_counter_try_alloc(opaque, (gsize) items * size);
+}
+
+static void memory_counter_zfree(voidpf opaque, voidpf address) {
+        memory_counter_free(opaque, address);
+}
+
+static void* memory_counter_bzalloc(void* opaque, int items, int size) {
+        return memory_counter_try_alloc(opaque, (gsize) items * size);
+}
+
+static void memory_counter_bzfree(void* opaque, void* address) {
+        memory_counter_free(opaque, address);
+}
+
+#ifdef HAVE_BROTLI
+static void* memory_counter_brotli_alloc(void* opaque, size_t size) {
+        return memory_counter_try_alloc(opaque, size);
+}
+
+static void memory_counter_brotli_free(void* opaque, void* address) {
+        memory_counter_free(opaque, address);
+}
+#endif
@@ -1,79 +1,257 @@
 #pragma once
 
-// Mutex convenience macros
+// Mutex convenience macros, the queue and task ones are in gstgz_queue.h
 
-#define INPUT_TASK_LOCK(element) REC_MUTEX_LOCK(&element->input_task_mutex)
-#define INPUT_TASK_UNLOCK(element) REC_MUTEX_UNLOCK(&element->input_task_mutex)
-#define SRCPAD_TASK_LOCK(element) REC_MUTEX_LOCK(GST_PAD_GET_STREAM_LOCK(&element->srcpad))
-#define SRCPAD_TASK_UNLOCK(element) REC_MUTEX_UNLOCK(GST_PAD_GET_STREAM_LOCK(&element->srcpad))
+#define ZIP_JOBS_LOCK(element) g_mutex_lock(&element->zip_jobs_mutex)
+#define ZIP_JOBS_UNLOCK(element) g_mutex_unlock(&element->zip_jobs_mutex)
+#define ZIP_JOBS_WAIT(element) g_cond_wait(&element->zip_jobs_cond, &element->zip_jobs_mutex)
+#define ZIP_JOBS_SIGNAL(element) g_cond_broadcast(&element->zip_jobs_cond)
 
-#define INPUT_QUEUE_WAIT(element) g_cond_wait(&element->input_queue_run_cond, &filter->input_queue_mutex)
-#define INPUT_QUEUE_SIGNAL(element) g_cond_signal(&element->input_queue_run_cond)
-
-#define OUTPUT_QUEUE_WAIT(element) g_cond_wait(&element->output_queue_run_cond, &filter->output_queue_mutex)
-#define OUTPUT_QUEUE_SIGNAL(element) g_cond_signal(&element->output_queue_run_cond)
-
-#define INPUT_QUEUE_LOCK(element) g_mutex_lock(&element->input_queue_mutex)
-#define INPUT_QUEUE_UNLOCK(element) g_mutex_unlock(&element->input_queue_mutex)
-
-#define OUTPUT_QUEUE_LOCK(element) g_mutex_lock(&element->output_queue_mutex)
-#define OUTPUT_QUEUE_UNLOCK(element) g_mutex_unlock(&element->output_queue_mutex)
+// With the output queue lock held, the producers wait for the srcpad task to make room
+#define OUTPUT_QUEUE_SPACE_WAIT(element) g_cond_wait(&element->output_queue_space_cond, &element->output_queue_mutex)
+#define OUTPUT_QUEUE_SPACE_SIGNAL(element) g_cond_broadcast(&element->output_queue_space_cond)
 
 // Decoder implementation adapters. This might come in handy if one would like to switch between implementations
 // for the same format at compile time.
 
 // Gzip
-#define CREATE_ZIP_DECODER(element, writer_func) zipdec_stream_new(element, writer_func)
+#define CREATE_ZIP_DECODER(element, writer_func, window_bits) zipdec_stream_new(element, writer_func, element->recover ? stream_resync_func : NULL, stream_switch_func, \
+                                                                                element->dictionaries, window_bits, element->verify, \
+                                                                                &element->memory, element->low_memory ? ZIP_DEC_STREAM_OUT_BUFFER_SIZE_SMALL : ZIP_DEC_STREAM_OUT_BUFFER_SIZE)
 #define ZIP_DECODER_DECODE zipdec_stream_digest_buffer
+#define ZIP_DECODER_AT_END zipdec_stream_at_end
 // Bzip
-#define CREATE_BZIP_DECODER(element, writer_func) bzipdec_stream_new(element, writer_func)
+#define CREATE_BZIP_DECODER(element, writer_func) bzipdec_stream_new(element, writer_func, element->recover ? stream_resync_func : NULL, stream_switch_func, \
+                                                                     element->low_memory, \
+                                                                     &element->memory, element->low_memory ? BZIP_DEC_STREAM_OUT_BUFFER_SIZE_SMALL : BZIP_DEC_STREAM_OUT_BUFFER_SIZE)
 #define BZIP_DECODER_DECODE bzipdec_stream_digest_buffer
+#define BZIP_DECODER_AT_END bzipdec_stream_at_end
+// Brotli
+#define CREATE_BROTLI_DECODER(element, writer_func) brotlidec_stream_new(element, writer_func, stream_switch_func, \
+                                                                         &element->memory, element->low_memory ? BROTLI_DEC_STREAM_OUT_BUFFER_SIZE_SMALL : BROTLI_DEC_STREAM_OUT_BUFFER_SIZE)
+#define BROTLI_DECODER_DECODE brotlidec_stream_digest_buffer
+#define BROTLI_DECODER_AT_END brotlidec_stream_at_end
+
+// Idle time after which a low-memory decoder sitting at a stream end gets freed
+#define LOW_MEMORY_IDLE_TIMEOUT (5 * G_TIME_SPAN_SECOND)
 
-static GstBuffer* input_queue_pop_buffer (GstGzDec *filter);
+// The ratio limit only applies past this much output, small inputs
+// (headers, highly redundant text) legitimately expand a lot at first
+#define MAX_RATIO_MIN_OUTPUT (1024 * 1024)
+
+static gpointer input_queue_pop (GstGzDec *filter);
 static void srcpad_task_func(gpointer user_data);
 static void output_queue_append_data (GstGzDec *filter, gpointer data, gsize bytes);
+static void output_queue_flush_split (GstGzDec *filter);
+static void output_queue_flush_sparse (GstGzDec *filter);
+static void entry_filter_setup (GstGzDec* filter);
+static void tar_setup (GstGzDec* filter);
+static void tar_finish (GstGzDec* filter);
+static gboolean zip_archive_digest_buffer (void* w, GstBuffer* buf);
+static void zip_archive_finish (GstGzDec* filter);
 static void setup_decoder (GstGzDec* filter, void* stream_writer_func);
+static gboolean setup_format_decoder (GstGzDec* filter, GstGzDecFormat format, void* stream_writer_func);
+static gboolean cache_setup (GstGzDec* filter, GstGzDecFormat format);
+static void cache_abort (GstGzDec* filter);
+static void cache_finish (GstGzDec* filter);
 
-// Just an adapter function resulting from the abstraction
+/*
+   Decompression bomb protection. This runs for every output chunk from within the
+   decoder loop, so a stream stops as soon as it crosses a limit and never
+   gets to queue more than one chunk beyond it.
+ */
+static gboolean output_limit_exceeded (GstGzDec* filter, gsize bytes) {
+        guint64 max_output_bytes = filter->limit_max_output_bytes;
+        guint max_ratio = filter->limit_max_ratio;
+        guint64 bytes_in, bytes_out;
+
+        if (G_LIKELY(!max_output_bytes && !max_ratio)) {
+                return FALSE;
+        }
+
+        bytes_in = filter->limit_bytes_in;
+        bytes_out = filter->limit_bytes_out += bytes;
+
+        if (max_output_bytes && bytes_out > max_output_bytes) {
+                GST_ELEMENT_ERROR (filter, STREAM, DECODE, ("Decompressed stream too large"),
+                                   ("Output of %" G_GUINT64_FORMAT " bytes exceeds max-output-bytes %" G_GUINT64_FORMAT,
+                                    bytes_out, max_output_bytes));
+                return TRUE;
+        }
+
+        // bytes_in counts the buffer being decoded as a whole, which errs on the safe side
+        if (max_ratio && bytes_out > MAX_RATIO_MIN_OUTPUT
+            && bytes_out > bytes_in * max_ratio) {
+                GST_ELEMENT_ERROR (filter, STREAM, DECODE, ("Decompression ratio too high"),
+                                   ("Output of %" G_GUINT64_FORMAT " bytes from %" G_GUINT64_FORMAT " input bytes exceeds max-ratio %u",
+                                    bytes_out, bytes_in, max_ratio));
+                return TRUE;
+        }
+
+        return FALSE;
+}
+
+// Decoding resumed after corrupt data, the next output buffer is marked as discontinuous
 static void
+stream_resync_func (gpointer user_data, guint64 skipped) {
+        GstGzDec* filter = GST_GZDEC(user_data);
+
+        GST_OBJECT_LOCK(filter);
+        filter->bytes_skipped += skipped;
+        GST_OBJECT_UNLOCK(filter);
+
+        OUTPUT_QUEUE_LOCK(filter);
+        filter->discont = TRUE;
+        OUTPUT_QUEUE_UNLOCK(filter);
+
+        // a damaged stream is not cached, a hit would lose the gaps
+        cache_abort (filter);
+
+        GST_ELEMENT_WARNING (filter, STREAM, DECODE, ("Corrupt compressed data, output is discontinuous"),
+                             ("Skipped %" G_GUINT64_FORMAT " input bytes to resynchronize", skipped));
+}
+
+/*
+   BYTES seek window. Output before the start is dropped before any buffer gets allocated
+   for it, only its offsets are accounted for. Once the stop is reached the decoder is
+   stopped, and the chain answers upstream with EOS.
+   Returns FALSE when decoding should stop, after the data that is left.
+ */
+static gboolean range_clip (GstGzDec* filter, gpointer* data, gsize* bytes) {
+        guint64 start, stop;
+        guint64 position = filter->range_position;
+        gsize skip = 0;
+
+        GST_OBJECT_LOCK(filter);
+        start = filter->range_start;
+        stop = filter->range_stop;
+        GST_OBJECT_UNLOCK(filter);
+
+        if (G_LIKELY(!start && stop == (guint64) -1)) {
+                return TRUE;
+        }
+
+        filter->range_position += *bytes;
+
+        if (position < start) {
+                skip = (gsize) MIN(start - position, (guint64) *bytes);
+                // keeps the offsets of what follows in the decompressed stream
+                OUTPUT_QUEUE_LOCK(filter);
+                filter->bytes_out += skip;
+                filter->bytes_pushed += skip;
+                OUTPUT_QUEUE_UNLOCK(filter);
+                *data = (guchar*) *data + skip;
+                *bytes -= skip;
+                position += skip;
+        }
+
+        if (stop == (guint64) -1 || filter->range_position < stop) {
+                return TRUE;
+        }
+
+        *bytes = position < stop ? (gsize) (stop - position) : 0;
+        GST_DEBUG_OBJECT (filter, "Reached the seek stop at %" G_GUINT64_FORMAT, stop);
+        GST_OBJECT_LOCK(filter);
+        filter->range_done = TRUE;
+        GST_OBJECT_UNLOCK(filter);
+        return FALSE;
+}
+
+// Just an adapter function resulting from the abstraction
+static gboolean
 stream_writer_func (gpointer user_data, gpointer data, gsize bytes) {
-        output_queue_append_data (user_data, data, bytes);
+        GstGzDec* filter = GST_GZDEC(user_data);
+        gboolean more;
+
+        if (G_UNLIKELY(output_limit_exceeded (filter, bytes))) {
+                GST_OBJECT_LOCK(filter);
+                filter->limit_exceeded = TRUE;
+                GST_OBJECT_UNLOCK(filter);
+                return FALSE;
+        }
+
+        // the entry holds the whole stream, whatever the seek window
+        if (filter->cache_writer) {
+                cache_writer_write (CACHE_WRITER(filter->cache_writer), data, bytes);
+        }
+
+        more = range_clip (filter, &data, &bytes);
+
+        if (filter->checksum_state) {
+                checksum_state_update (CHECKSUM_STATE(filter->checksum_state), data, bytes);
+        }
+
+        // no buffer at all, the checksums are all that is kept
+        if (filter->validate_mode) {
+                return more;
+        }
+
+        output_queue_append_data (filter, data, bytes);
+        return more;
+}
+
+// Posts the checksums of the decompressed stream, called from the input task at EOS.
+// In validate-only mode they come with the summary of the stream.
+static void checksum_post_message (GstGzDec* filter) {
+        GstStructure* s;
+        guint64 bytes_in, bytes_skipped;
+
+        if (!filter->checksum_state) {
+                return;
+        }
+
+        s = checksum_state_to_structure (CHECKSUM_STATE(filter->checksum_state),
+                                         filter->validate_mode ? "gzdec-validate" : "gzdec-checksum");
+        if (filter->validate_mode) {
+                INPUT_QUEUE_LOCK(filter);
+                bytes_in = filter->bytes_in;
+                INPUT_QUEUE_UNLOCK(filter);
+                GST_OBJECT_LOCK(filter);
+                bytes_skipped = filter->bytes_skipped;
+                GST_OBJECT_UNLOCK(filter);
+                gst_structure_set (s,
+                                   "input-size", G_TYPE_UINT64, bytes_in,
+                                   "complete", G_TYPE_BOOLEAN, filter->validate_complete,
+                                   "bytes-skipped", G_TYPE_UINT64, bytes_skipped,
+                                   "corrupt-entries", G_TYPE_UINT, filter->validate_corrupt_entries,
+                                   NULL);
+        }
+        GST_INFO_OBJECT (filter, "Checksums: %" GST_PTR_FORMAT, s);
+        gst_element_post_message (GST_ELEMENT(filter),
+                                  gst_message_new_element (GST_OBJECT(filter), s));
+
+        checksum_state_free (CHECKSUM_STATE(filter->checksum_state));
+        filter->checksum_state = NULL;
 }
 
 static void
 try_feed_stream_start(GstGzDec* filter, GstBuffer* buf)
 {
-        GstMapInfo map;
-        guchar *data;
-        guint size;
+        GstGzDecFormat format;
 
-        if (G_LIKELY(filter->stream_start_fill == sizeof(filter->stream_start))) {
+        g_assert(filter->decode_func == NULL);
+
+        GST_OBJECT_LOCK(filter);
+        format = filter->format != GST_GZDEC_FORMAT_AUTO ? filter->format : filter->caps_format;
+        GST_OBJECT_UNLOCK(filter);
+
+        // No need to peek into the stream when the format is known (from property or caps)
+        if (format != GST_GZDEC_FORMAT_AUTO) {
+                GST_INFO ("Setup decoder for configured format");
+                setup_decoder(filter, stream_writer_func);
                 return;
         }
 
-#ifdef USE_GSTREAMER_1_DOT_0_API
-        if(!gst_buffer_map(buf, &map, GST_MAP_READ)) {
-                GST_ERROR("Error mapping for read access");
+        if (G_LIKELY(filter->stream_start_fill == sizeof(filter->stream_start))) {
                 return;
         }
-        data = map.data;
-        size = map.size;
-#endif
 
-        for (; filter->stream_start_fill < sizeof(filter->stream_start)
-             && filter->stream_start_fill < size;
-             filter->stream_start_fill++) {
-                filter->stream_start[filter->stream_start_fill] = data[filter->stream_start_fill];
-        }
+        // the magic might be split across buffers, only copy out what is missing of it
+        filter->stream_start_fill += BUFFER_EXTRACT(buf, 0, filter->stream_start + filter->stream_start_fill,
+                                                    sizeof(filter->stream_start) - filter->stream_start_fill);
 
         GST_DEBUG ("Got stream starting chars: %x %x", filter->stream_start[0], filter->stream_start[1]);
 
-#ifdef USE_GSTREAMER_1_DOT_0_API
-        gst_buffer_unmap(buf, &map);
-#endif
-
-        g_assert(filter->decoder == NULL);
-
         if (filter->stream_start_fill == sizeof(filter->stream_start)) {
 
                 GST_INFO ("Setup decoder");
@@ -90,6 +268,8 @@ try_feed_stream_start(GstGzDec* filter, GstBuffer* buf)
    other elements for it. Using existing typefind functions for these formats would have
    been possible but in this case not offering any substantial advantage
    (except if one would like to do something with the caps, which we dont).
+
+   Raw deflate and Brotli have no magic at all, these can only be selected with the format property.
  */
 static gboolean stream_is_bzip(GstGzDec* filter) {
         return filter->stream_start[0] == 0x42
@@ -97,286 +277,2585 @@ static gboolean stream_is_bzip(GstGzDec* filter) {
 }
 
 static gboolean stream_is_gzip(GstGzDec* filter) {
-        return filter->stream_start[0] == 0x78
-               && filter->stream_start[1] == 0xffffff9c;
+        return filter->stream_start[0] == 0x1f
+               && filter->stream_start[1] == 0x8b;
 }
 
-/*
-        This is the factory that will create the necessary decoder implementation instance
-        and setup the according decoding function.
+// RFC 1950: CM is 8 (deflate), CINFO at most 7 (32K window)
+// and the header checksum makes CMF*256 + FLG a multiple of 31.
+// This covers all compression levels (78 01, 78 5e, 78 9c, 78 da) and smaller windows.
+static gboolean stream_is_zlib(GstGzDec* filter) {
+        guint cmf = filter->stream_start[0];
+        guint flg = filter->stream_start[1];
+        return (cmf & 0x0f) == 8
+               && (cmf >> 4) <= 7
+               && ((cmf << 8) | flg) % 31 == 0;
+}
 
-        We could have gone with a full-fledged abstract-class pattern declared on the decoder's side,
-        and the call that classe's functions will would redirect to the class implementation (virtual functions GObject style),
-        but it seemed a bit over-engineered for this tiny case with only one function type to abstract (GstGzDecFunc).
-        Therefore we simply initialize the instance and function pointers here as part of
-        the actual element's state. This allows the same flexibility at runtime for less framework code.
+static GstGzDecFormat detect_format(GstGzDec* filter) {
+        if (stream_is_bzip(filter)) {
+                return GST_GZDEC_FORMAT_BZIP2;
+        } else if (stream_is_gzip(filter)) {
+                return GST_GZDEC_FORMAT_GZIP;
+        } else if (stream_is_zlib(filter)) {
+                return GST_GZDEC_FORMAT_ZLIB;
+        }
+        return GST_GZDEC_FORMAT_AUTO;
+}
+
+/*
+   Concatenated streams of different formats (gzip log rotations followed by a bzip2 archive
+   and the like). At every stream end the decoder passes us what follows, which is sniffed like
+   the stream start. Another format takes over from there with its own decoder, see decode_block.
+   When the input block ends within the magic, what there is of it is held back and the decoder
+   stops, decode_block then completes it from the next block like the stream_start peek does.
  */
-static void setup_decoder (GstGzDec* filter, void* stream_writer_func) {
+static gboolean
+stream_switch_func (gpointer user_data, gconstpointer next, gsize avail) {
+        GstGzDec* filter = GST_GZDEC(user_data);
+        GstGzDecFormat format;
 
-        GST_DEBUG ("Got stream starting chars: %x %x",
-                   filter->stream_start[0],
-                   filter->stream_start[1]);
+        if (avail < sizeof(filter->stream_start)) {
+                memcpy (filter->stream_start, next, avail);
+                filter->switch_fill = avail;
+                return TRUE;
+        }
+        memcpy (filter->stream_start, next, sizeof(filter->stream_start));
+        format = detect_format (filter);
 
-        g_assert(!filter->decoder);
+        // Brotli has no magic, its data could pass the weak zlib header check
+        if (format == GST_GZDEC_FORMAT_AUTO || format == filter->stream_format
+            || (format == GST_GZDEC_FORMAT_ZLIB && filter->stream_format == GST_GZDEC_FORMAT_BROTLI)) {
+                return FALSE;
+        }
 
-        if (stream_is_bzip(filter)) {
-                GST_INFO ("Stream is bzip");
-                filter->stream_type = BZIP;
-                filter->decoder = CREATE_BZIP_DECODER(filter, stream_writer_func);
-                filter->decode_func = BZIP_DECODER_DECODE;
-                return;
+        filter->switch_format = format;
+        filter->switch_rest = avail;
+        return TRUE;
+}
+
+// Maps the sink caps to a format, see the sink pad template
+static GstGzDecFormat format_from_caps(GstCaps* caps) {
+        const gchar* name;
+
+        if (!caps || gst_caps_is_empty(caps) || gst_caps_is_any(caps)) {
+                return GST_GZDEC_FORMAT_AUTO;
         }
-        else if (stream_is_gzip(filter)) {
-                GST_INFO ("Stream is gzip");
-                filter->stream_type = GZIP;
-                filter->decoder = CREATE_ZIP_DECODER(filter, stream_writer_func);
-                filter->decode_func = ZIP_DECODER_DECODE;
-                return;
+
+        name = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+
+        if (g_str_equal(name, "application/x-gzip")) {
+                return GST_GZDEC_FORMAT_GZIP;
+        } else if (g_str_equal(name, "application/x-bzip")
+                   || g_str_equal(name, "application/x-bzip2")) {
+                return GST_GZDEC_FORMAT_BZIP2;
+        } else if (g_str_equal(name, "application/zlib")
+                   || g_str_equal(name, "application/x-zlib")) {
+                return GST_GZDEC_FORMAT_ZLIB;
+        } else if (g_str_equal(name, "application/x-deflate")) {
+                return GST_GZDEC_FORMAT_RAW_DEFLATE;
+        } else if (g_str_equal(name, "application/x-brotli")) {
+                return GST_GZDEC_FORMAT_BROTLI;
+        } else if (g_str_equal(name, "application/zip")) {
+                return GST_GZDEC_FORMAT_ZIP;
         }
+        return GST_GZDEC_FORMAT_AUTO;
+}
 
-        GST_WARNING ("Could not recongnize format in stream peek!");
+// Returns the local file upstream is reading from, if any
+static gchar* upstream_file_path (GstGzDec* filter) {
+        GstQuery* query = gst_query_new_uri ();
+        gchar* uri = NULL;
+        gchar* path = NULL;
+
+        if (gst_pad_peer_query (filter->sinkpad, query)) {
+                gst_query_parse_uri (query, &uri);
+        }
+        gst_query_unref (query);
 
-        g_warn_if_reached();
+        if (uri && g_str_has_prefix (uri, "file:")) {
+                path = g_filename_from_uri (uri, NULL, NULL);
+        }
+        g_free (uri);
+        return path;
 }
 
-void clear_decoder(GstGzDec* filter) {
-        g_assert(filter->decoder);
-        switch (filter->stream_type) {
+/*
+   Decoder pool. A decoder is kept when its stream is over (state cycle, or a switch to another
+   format) and reset for the next stream of its format: much cheaper than a new one for zlib,
+   whose state and window are kept. Bzip2 and Brotli have no reset, only their output chunk is
+   kept. Low-memory mode wants them freed.
+ */
+static void decoder_free (GstGzDecStreamType type, gpointer decoder) {
+        switch (type) {
         case GZIP:
-                zipdec_stream_free(ZIP_DECODER_STREAM(filter->decoder));
+                zipdec_stream_free(ZIP_DECODER_STREAM(decoder));
                 break;
         case BZIP:
-                bzipdec_stream_free(BZIP_DECODER_STREAM(filter->decoder));
+                bzipdec_stream_free(BZIP_DECODER_STREAM(decoder));
+                break;
+        case BROTLI:
+                brotlidec_stream_free(BROTLI_DECODER_STREAM(decoder));
+                break;
+        case PKZIP:
+                zip_archive_free(ZIP_ARCHIVE(decoder));
+                break;
+        case CACHED:
+                cache_entry_free(CACHE_ENTRY(decoder));
                 break;
         }
-        filter->decoder = NULL;
 }
 
-static void input_queue_signal_resume (GstGzDec* filter) {
-        INPUT_QUEUE_LOCK(filter);
-        // the queue might be empty
-        filter->input_task_resume = TRUE;
-        INPUT_QUEUE_SIGNAL(filter);
-        INPUT_QUEUE_UNLOCK(filter);
-}
+// A pooled decoder is only good for a stream with the very settings it was made with
+static gboolean pooled_decoder_matches (GstGzDec* filter, GstGzDecStreamType type, gpointer decoder,
+                                        void* stream_writer_func) {
+        StreamResyncFunc resync_func = filter->recover ? stream_resync_func : NULL;
 
-static void output_queue_signal_resume (GstGzDec* filter) {
-        OUTPUT_QUEUE_LOCK(filter);
-        // the queue might be empty
-        filter->srcpad_task_resume = TRUE;
-        OUTPUT_QUEUE_SIGNAL(filter);
-        OUTPUT_QUEUE_UNLOCK(filter);
+        switch (type) {
+        case GZIP:
+                return ZIP_DECODER_STREAM(decoder)->writer_func == stream_writer_func
+                       && ZIP_DECODER_STREAM(decoder)->verify == filter->verify
+                       && ZIP_DECODER_STREAM(decoder)->dictionaries == filter->dictionaries
+                       && ZIP_DECODER_STREAM(decoder)->resync_func == resync_func
+                       && ZIP_DECODER_STREAM(decoder)->out_size == (filter->low_memory ? ZIP_DEC_STREAM_OUT_BUFFER_SIZE_SMALL : ZIP_DEC_STREAM_OUT_BUFFER_SIZE);
+        case BZIP:
+                return BZIP_DECODER_STREAM(decoder)->writer_func == stream_writer_func
+                       && BZIP_DECODER_STREAM(decoder)->small == filter->low_memory
+                       && BZIP_DECODER_STREAM(decoder)->resync_func == resync_func
+                       && BZIP_DECODER_STREAM(decoder)->out_size == (filter->low_memory ? BZIP_DEC_STREAM_OUT_BUFFER_SIZE_SMALL : BZIP_DEC_STREAM_OUT_BUFFER_SIZE);
+        case BROTLI:
+                return BROTLI_DECODER_STREAM(decoder)->writer_func == stream_writer_func
+                       && BROTLI_DECODER_STREAM(decoder)->out_size == (filter->low_memory ? BROTLI_DEC_STREAM_OUT_BUFFER_SIZE_SMALL : BROTLI_DEC_STREAM_OUT_BUFFER_SIZE);
+        default:
+                return FALSE;
+        }
 }
 
-static void input_task_start(GstGzDec* filter) {
-        gst_task_start(filter->input_task);
-}
+// Returns the pooled decoder of the type reset for a new stream, or NULL. Call with the object lock held.
+static gpointer decoder_pool_take (GstGzDec* filter, GstGzDecStreamType type, void* stream_writer_func, int window_bits) {
+        gpointer decoder = filter->decoder_pool[type];
 
-static void input_task_pause(GstGzDec* filter) {
-        gst_task_pause(filter->input_task);
-        input_queue_signal_resume (filter);
-        // aquire input stream lock to make this
-        // blocks until we are actually paused
-        REC_MUTEX_LOCK(GST_TASK_GET_LOCK(filter->input_task));
-        REC_MUTEX_UNLOCK(GST_TASK_GET_LOCK(filter->input_task));
-}
+        if (!decoder) {
+                return NULL;
+        }
+        filter->decoder_pool[type] = NULL;
 
-static void input_task_join(GstGzDec* filter) {
-        gst_task_stop(filter->input_task);
-        input_queue_signal_resume (filter);
-        gst_task_join(filter->input_task);
-}
+        if (!pooled_decoder_matches (filter, type, decoder, stream_writer_func)) {
+                decoder_free (type, decoder);
+                return NULL;
+        }
 
-static void srcpad_task_start(GstGzDec* filter) {
-        GST_INFO_OBJECT (filter, "Starting srcpad task");
-        gst_pad_start_task (filter->srcpad, srcpad_task_func, filter, NULL);
+        GST_DEBUG_OBJECT (filter, "Reusing pooled decoder of stream type %d", (int) type);
+        switch (type) {
+        case GZIP:
+                zipdec_stream_reset (ZIP_DECODER_STREAM(decoder), window_bits);
+                break;
+        case BZIP:
+                bzipdec_stream_reset (BZIP_DECODER_STREAM(decoder));
+                break;
+        case BROTLI:
+                brotlidec_stream_reset (BROTLI_DECODER_STREAM(decoder));
+                break;
+        default:
+                break;
+        }
+        return decoder;
 }
 
-static void srcpad_task_pause(GstGzDec* filter) {
-        GST_INFO_OBJECT (filter, "Setting srcpad task to paused");
-        gst_task_pause (GST_PAD_TASK(filter->srcpad));
-        output_queue_signal_resume (filter);
-        // this will just make sure we block until
-        // the task is actually done as this
-        // function acquires the stream lock
-        gst_pad_pause_task(filter->srcpad);
-}
+static void decoder_pool_clear (GstGzDec* filter) {
+        guint i;
 
-static void srcpad_task_join(GstGzDec* filter) {
-        GST_INFO_OBJECT (filter, "Setting srcpad task to stopped");
-        // this looks hackish but we can't use
-        // the actual pad function as it will
-        // need to acquire the task lock which
-        // will only be released after we signaled the task
-        gst_task_stop (GST_PAD_TASK(filter->srcpad));
-        output_queue_signal_resume (filter);
-        // properly shutdown the pad task here now
-        // this will join the thread
-        gst_pad_stop_task(filter->srcpad);
+        for (i = 0; i < DECODER_POOL_SIZE; i++) {
+                if (filter->decoder_pool[i]) {
+                        decoder_free ((GstGzDecStreamType) i, filter->decoder_pool[i]);
+                        filter->decoder_pool[i] = NULL;
+                }
+        }
 }
 
-static void push_one_output_buffer (GstGzDec* filter, GstBuffer* buf) {
-
-        GST_TRACE_OBJECT (filter, "Pushing one buffer");
+static void setup_zip_decoder (GstGzDec* filter, void* stream_writer_func, int window_bits) {
+        filter->stream_type = GZIP;
+        // the decoder takes a reference on the current dictionary store
+        GST_OBJECT_LOCK(filter);
+        filter->decoder = decoder_pool_take (filter, GZIP, stream_writer_func, window_bits);
+        if (!filter->decoder) {
+                filter->decoder = CREATE_ZIP_DECODER(filter, stream_writer_func, window_bits);
+        }
+        GST_OBJECT_UNLOCK(filter);
+        filter->decode_func = ZIP_DECODER_DECODE;
+}
 
-        GstFlowReturn ret = gst_pad_push (filter->srcpad, buf);
+// Takes the memfd setting for the run, call with the object lock held
+static void memfd_setup (GstGzDec* filter) {
+        if (!filter->memfd || filter->memfd_ring) {
+                return;
+        }
+        filter->memfd_ring = memfd_ring_new ();
+        if (!filter->memfd_ring) {
+                GST_WARNING_OBJECT (filter, "No memfd output memory, using system memory");
+        }
+}
 
-        if (ret != GST_FLOW_OK) {
-                GST_ERROR_OBJECT (filter, "Flow returned: %s", gst_flow_get_name (ret));
+static void memfd_clear (GstGzDec* filter) {
+        if (filter->memfd_ring) {
+                memfd_ring_free (MEMFD_RING(filter->memfd_ring));
+                filter->memfd_ring = NULL;
         }
 }
 
-static void srcpad_check_pending_eos (GstGzDec* filter) {
-        GstEvent *event = NULL;
+// Takes the sparse settings for the run, call with the object lock held
+static void sparse_setup (GstGzDec* filter) {
+        filter->sparse_mode = filter->sparse;
+        filter->sparse_min_run = filter->sparse_threshold;
+}
 
-        GST_OBJECT_LOCK(filter);
-        GST_TRACE_OBJECT (filter, "Checking if EOS conds met");
-        // We received an EOS event AND have processed everything
-        // on the input queue (after EOS received in sync with data-flow, no more data can arrive in input queue).
-        // Now we can dispatch the pending EOS event!
-        if (filter->eos && filter->pending_eos) {
-                GST_INFO_OBJECT (filter, "Dispatching pending EOS!");
-                event = filter->pending_eos;
-                // make sure we don't dispatch it twice
-                filter->pending_eos = NULL;
+// Takes the split settings for the stream, call with the object lock held
+static void split_setup (GstGzDec* filter) {
+        gchar* delimiter = filter->delimiter ? g_strcompress (filter->delimiter) : g_strdup ("");
+
+        filter->split_mode = filter->split;
+        filter->split_record_size = filter->record_size;
+        filter->split_max_record_size = filter->max_record_size;
+        if (filter->split_delimiter) {
+                g_bytes_unref (filter->split_delimiter);
         }
-        GST_OBJECT_UNLOCK(filter);
+        filter->split_delimiter = g_bytes_new_take (delimiter, strlen (delimiter));
 
-        if (event) {
-                GST_LOG_OBJECT (filter, "Now handling pending EOS event on srcpad");
-                if (!gst_pad_event_default (filter->sinkpad, GST_OBJECT(filter), event)) {
-                        GST_WARNING_OBJECT(filter, "Failed to propagate pending EOS event: %" GST_PTR_FORMAT, event);
-                }
+        if (filter->split_mode == GST_GZDEC_SPLIT_DELIMITER && !g_bytes_get_size (filter->split_delimiter)) {
+                GST_WARNING_OBJECT (filter, "Empty delimiter, not splitting");
+                filter->split_mode = GST_GZDEC_SPLIT_NONE;
         }
 }
 
-static void srcpad_task_func(gpointer user_data) {
-        GstGzDec* filter = GST_GZDEC(user_data);
+/*
+        This is the factory that will create the necessary decoder implementation instance
+        and setup the according decoding function.
 
-        GST_TRACE_OBJECT (filter, "Entering srcpad task func");
+        We could have gone with a full-fledged abstract-class pattern declared on the decoder's side,
+        and the call that classe's functions will would redirect to the class implementation (virtual functions GObject style),
+        but it seemed a bit over-engineered for this tiny case with only one function type to abstract (GstGzDecFunc).
+        Therefore we simply initialize the instance and function pointers here as part of
+        the actual element's state. This allows the same flexibility at runtime for less framework code.
+ */
+static void setup_decoder (GstGzDec* filter, void* stream_writer_func) {
 
-        guint size;
-        gpointer data;
+        GstGzDecFormat format;
 
-        OUTPUT_QUEUE_LOCK(filter);
-        size = g_queue_get_length (filter->output_queue);
-        data = g_queue_pop_head (filter->output_queue);
-        OUTPUT_QUEUE_UNLOCK(filter);
+        g_assert(!filter->decoder);
 
-        GST_TRACE_OBJECT (filter, "Output queue length before pop: %d", (int) size);
+        GST_OBJECT_LOCK(filter);
+        format = filter->format != GST_GZDEC_FORMAT_AUTO ? filter->format : filter->caps_format;
+        GST_OBJECT_UNLOCK(filter);
 
-        if (data) {
-                push_one_output_buffer (filter, GST_BUFFER(data));
+        if (format == GST_GZDEC_FORMAT_AUTO) {
+                GST_DEBUG ("Got stream starting chars: %x %x",
+                           filter->stream_start[0],
+                           filter->stream_start[1]);
+                format = detect_format(filter);
         }
 
-        // output queue is currently empty, check if we should send EOS
-        OUTPUT_QUEUE_LOCK(filter);
-        while (g_queue_get_length (filter->output_queue) == 0 && !filter->srcpad_task_resume) {
-                // check if its time to EOS really, if yes this function will dispatch the EOS
-                // to the srcpad
-                srcpad_check_pending_eos(filter);
-                // anyway if the queue is empty we'll just wait
-                GST_TRACE_OBJECT (filter, "Waiting in srcpad task func");
-                OUTPUT_QUEUE_WAIT(filter);
-                GST_TRACE_OBJECT(filter, "Resuming srcpad task func");
+        GST_OBJECT_LOCK(filter);
+        filter->validate_mode = filter->validate_only;
+        // the summary is posted with the checksums, it gets at least the size
+        if ((filter->checksums || filter->validate_mode) && !filter->checksum_state) {
+                filter->checksum_state = checksum_state_new (filter->checksums);
         }
-        filter->srcpad_task_resume = FALSE;
-        OUTPUT_QUEUE_UNLOCK(filter);
-
-        GST_TRACE_OBJECT (filter, "Leaving srcpad task func");
-}
-
-static void process_one_input_buffer (GstGzDec* filter, GstBuffer* buf) {
+        // the limits hold for the whole stream, changes apply to the next one
+        filter->limit_max_output_bytes = filter->max_output_bytes;
+        filter->limit_max_ratio = filter->max_ratio;
+        split_setup (filter);
+        sparse_setup (filter);
+        memfd_setup (filter);
+        entry_filter_setup (filter);
+        tar_setup (filter);
+        GST_OBJECT_UNLOCK(filter);
 
-        GST_TRACE_OBJECT (filter, "Processing one input buffer: %" GST_PTR_FORMAT, buf);
+        if (cache_setup (filter, format)) {
+                return;
+        }
 
-        if (!filter->decode_func(filter->decoder, buf)) {
-                GST_ERROR("Failed to decode: %" GST_PTR_FORMAT, buf);
+        if (!setup_format_decoder (filter, format, stream_writer_func)) {
+                // known but not decodable, passing it through would hand compressed data on as decoded
+                if (filter->unsupported) {
+                        return;
+                }
+                GST_INFO ("Could not recognize format in stream peek, passing data through");
+                filter->passthrough = TRUE;
+                if (filter->validate_mode) {
+                        GST_ELEMENT_ERROR (filter, STREAM, WRONG_TYPE, ("Not a compressed stream, nothing to validate"), (NULL));
+                }
         }
 }
 
-static void input_task_func (gpointer data) {
-
-        GstGzDec *filter = GST_GZDEC (data);
-        GstBuffer* buf;
-        gboolean eos = FALSE;
+// Creates (or takes from the pool) the decoder of a format, returns FALSE when there is none
+static gboolean setup_format_decoder (GstGzDec* filter, GstGzDecFormat format, void* stream_writer_func) {
 
-        GST_TRACE_OBJECT(filter, "Entering input task function. Waiting for queue access ...");
+        filter->stream_format = format;
 
-        buf = input_queue_pop_buffer (filter);
-        if (buf != NULL) {
-                // takes ownership of the buffer
-                process_one_input_buffer(filter, buf);
-                // we can get rid of it now
-                gst_buffer_unref(buf);
-        } else {
-                // OPTIMIZABLE: this will run one iteration later than it could
+        switch (format) {
+        case GST_GZDEC_FORMAT_BZIP2:
+                GST_INFO ("Stream is bzip");
+                filter->stream_type = BZIP;
                 GST_OBJECT_LOCK(filter);
-                // There is an EOS event pending and the input queue is fully processed
-                // We are at EOS.
-                if (filter->pending_eos) {
-                        GST_DEBUG_OBJECT(filter, "Setting EOS flag");
-                        eos = filter->eos = TRUE;
-                }
+                filter->decoder = decoder_pool_take (filter, BZIP, stream_writer_func, 0);
                 GST_OBJECT_UNLOCK(filter);
+                if (!filter->decoder) {
+                        filter->decoder = CREATE_BZIP_DECODER(filter, stream_writer_func);
+                }
+                filter->decode_func = BZIP_DECODER_DECODE;
+                return TRUE;
+        case GST_GZDEC_FORMAT_GZIP:
+                GST_INFO ("Stream is gzip");
+                setup_zip_decoder(filter, stream_writer_func, ZLIB_INFLATE_WINDOW_BITS_GZIP);
+                return TRUE;
+        case GST_GZDEC_FORMAT_ZLIB:
+                GST_INFO ("Stream is zlib");
+                setup_zip_decoder(filter, stream_writer_func, ZLIB_INFLATE_WINDOW_BITS_ZLIB);
+                return TRUE;
+        case GST_GZDEC_FORMAT_RAW_DEFLATE:
+                GST_INFO ("Stream is raw deflate");
+                setup_zip_decoder(filter, stream_writer_func, ZLIB_INFLATE_WINDOW_BITS_RAW);
+                return TRUE;
+        case GST_GZDEC_FORMAT_BROTLI:
+#ifndef HAVE_BROTLI
+                GST_ELEMENT_ERROR (filter, STREAM, CODEC_NOT_FOUND, ("Built without Brotli support"), (NULL));
+                filter->unsupported = TRUE;
+                return FALSE;
+#endif
+                GST_INFO ("Stream is brotli");
+                filter->stream_type = BROTLI;
+                GST_OBJECT_LOCK(filter);
+                filter->decoder = decoder_pool_take (filter, BROTLI, stream_writer_func, 0);
+                GST_OBJECT_UNLOCK(filter);
+                if (!filter->decoder) {
+                        filter->decoder = CREATE_BROTLI_DECODER(filter, stream_writer_func);
+                }
+                filter->decode_func = BROTLI_DECODER_DECODE;
+                return TRUE;
+        case GST_GZDEC_FORMAT_ZIP:
+                GST_INFO ("Stream is a zip archive");
+                filter->stream_type = PKZIP;
+                filter->decoder = zip_archive_new(filter);
+                filter->decode_func = zip_archive_digest_buffer;
+                return TRUE;
+        case GST_GZDEC_FORMAT_AUTO:
+                break;
+        }
+        return FALSE;
+}
+
+static gboolean decoder_at_stream_end(GstGzDec* filter) {
+        g_assert(filter->decoder);
+        // the magic of a following stream is held back
+        if (filter->switch_fill) {
+                return FALSE;
+        }
+        switch (filter->stream_type) {
+        case GZIP:
+                return ZIP_DECODER_AT_END(filter->decoder);
+        case BZIP:
+                return BZIP_DECODER_AT_END(filter->decoder);
+        case BROTLI:
+                return BROTLI_DECODER_AT_END(filter->decoder);
+        case PKZIP:
+                // an archive being collected can't be dropped
+                return FALSE;
+        case CACHED:
+                return CACHE_ENTRY(filter->decoder)->served;
+        }
+        return FALSE;
+}
+
+void clear_decoder(GstGzDec* filter) {
+        g_assert(filter->decoder);
+        decoder_free(filter->stream_type, filter->decoder);
+        filter->decoder = NULL;
+}
+
+// Pools the decoder for the next stream of its format, see decoder_pool_take
+static void park_decoder (GstGzDec* filter) {
+        GstGzDecStreamType type = filter->stream_type;
+
+        if (type >= DECODER_POOL_SIZE || filter->low_memory) {
+                clear_decoder (filter);
+                return;
+        }
+        GST_DEBUG_OBJECT (filter, "Pooling decoder of stream type %d", (int) type);
+        if (filter->decoder_pool[type]) {
+                decoder_free (type, filter->decoder_pool[type]);
+        }
+        filter->decoder_pool[type] = filter->decoder;
+        filter->decoder = NULL;
+}
+
+/*
+   Queue levels. Buffering follows the output queue, it starts when the decompressed data
+   queued falls below the low watermark and ends (100%) once it reaches the high watermark.
+   Like in queue2, the percentage goes from 0 to 100 over the range up to the high watermark.
+   Past max-size-bytes the output queue emits overrun and the decoder blocks until the srcpad
+   task has pushed it back below, so the decoder pauses at the producer side of the output queue.
+   Only a running srcpad task makes room, when it is paused (flush, state change) the
+   decoder is let go, see output_queue_unblock. The input queue only signals its overrun.
+ */
+static void queue_level_settings (GstGzDec* filter, gboolean* use_buffering, guint64* max_size,
+                                  guint64* low, guint64* high) {
+        GST_OBJECT_LOCK(filter);
+        *use_buffering = filter->use_buffering;
+        *max_size = filter->max_size_bytes;
+        *low = filter->max_size_bytes * filter->low_watermark;
+        *high = filter->max_size_bytes * filter->high_watermark;
+        GST_OBJECT_UNLOCK(filter);
+}
+
+// Called with the output queue lock held, returns the percentage to post or -1
+static gint output_queue_update_buffering (GstGzDec* filter, guint64 low, guint64 high) {
+        guint64 level = filter->bytes_out - filter->bytes_pushed;
+        gint percent = high ? (gint) MIN(100, level * 100 / high) : 100;
+
+        if (filter->buffering) {
+                if (percent >= 100) {
+                        filter->buffering = FALSE;
+                }
+        } else if (level < low) {
+                filter->buffering = TRUE;
+        } else {
+                return -1;
+        }
+
+        if (percent == filter->buffering_percent) {
+                return -1;
+        }
+        filter->buffering_percent = percent;
+        return percent;
+}
+
+static void post_buffering (GstGzDec* filter, gint percent) {
+        if (percent < 0) {
+                return;
+        }
+        GST_DEBUG_OBJECT (filter, "Buffering %d%%", percent);
+        gst_element_post_message (GST_ELEMENT(filter),
+                                  gst_message_new_buffering (GST_OBJECT(filter), percent));
+}
+
+// Everything is decoded at EOS, there is nothing left to wait for
+static void output_queue_finish_buffering (GstGzDec* filter) {
+        gboolean use_buffering;
+        guint64 max_size, low, high;
+        gint percent = -1;
+
+        queue_level_settings (filter, &use_buffering, &max_size, &low, &high);
+        if (!use_buffering) {
+                return;
+        }
+
+        OUTPUT_QUEUE_LOCK(filter);
+        if (filter->buffering) {
+                filter->buffering = FALSE;
+                percent = filter->buffering_percent = 100;
+        }
+        OUTPUT_QUEUE_UNLOCK(filter);
+
+        post_buffering (filter, percent);
+}
+
+// The segment is held back until we have output caps to keep sticky events in order
+static void srcpad_push_pending_segment (GstGzDec* filter) {
+        GstEvent *event;
+
+        GST_OBJECT_LOCK(filter);
+        event = filter->pending_segment;
+        filter->pending_segment = NULL;
+        GST_OBJECT_UNLOCK(filter);
+
+        if (event) {
+                gst_pad_push_event (filter->srcpad, event);
+        }
+}
+
+// Typefinders look at the first few KiB, output is held back until there is that much
+// of it. Less is only typefound at an entry end or at EOS.
+#define TYPEFIND_MIN_SIZE (4 * 1024)
+
+// Sets the srcpad caps, in passthrough the ones upstream sent, otherwise from what the
+// decompressed data looks like, this saves a typefind element after us
+static void srcpad_set_caps (GstGzDec* filter, GstBuffer* buf) {
+        GstCaps* caps = NULL;
+        GstTypeFindProbability prob;
+
+        GST_OBJECT_LOCK(filter);
+        filter->src_caps_set = TRUE;
+        if (filter->passthrough && filter->sink_caps) {
+                caps = gst_caps_ref (filter->sink_caps);
+        }
+        GST_OBJECT_UNLOCK(filter);
+
+        if (!caps) {
+                caps = gst_type_find_helper_for_buffer (GST_OBJECT(filter), buf, &prob);
+                if (caps) {
+                        GST_INFO_OBJECT (filter, "Output typefound as %" GST_PTR_FORMAT " (probability %d)", caps, (int) prob);
+                } else {
+                        GST_INFO_OBJECT (filter, "Could not typefind output, it is just bytes");
+                        caps = gst_caps_new_empty_simple ("application/octet-stream");
+                }
+        }
+        gst_pad_set_caps (filter->srcpad, caps);
+        gst_caps_unref (caps);
+
+        srcpad_push_pending_segment (filter);
+}
+
+static void srcpad_push_buffer (GstGzDec* filter, GstBuffer* buf) {
+        GstFlowReturn ret = gst_pad_push (filter->srcpad, buf);
+
+        // flushing for a seek is no error
+        if (ret != GST_FLOW_OK && ret != GST_FLOW_FLUSHING) {
+                GST_ERROR_OBJECT (filter, "Flow returned: %s", gst_flow_get_name (ret));
+        }
+}
+
+// Sets the caps from all the output held back and pushes it
+static void srcpad_typefind_release (GstGzDec* filter) {
+        GstBuffer* probe = NULL;
+        GstBuffer* buf;
+        GList* l;
+
+        if (g_queue_is_empty (filter->typefind_queue)) {
+                return;
+        }
+
+        // the buffers share their memory with the probe
+        for (l = filter->typefind_queue->head; l; l = l->next) {
+                buf = gst_buffer_ref (GST_BUFFER(l->data));
+                probe = probe ? BUFFER_APPEND (probe, buf) : buf;
+        }
+        srcpad_set_caps (filter, probe);
+        gst_buffer_unref (probe);
+
+        filter->typefind_bytes = 0;
+        while ((buf = g_queue_pop_head (filter->typefind_queue))) {
+                srcpad_push_buffer (filter, buf);
+        }
+}
+
+// Drops the output held back for typefinding, on flushes and state changes
+static void srcpad_typefind_clear (GstGzDec* filter) {
+        gpointer data;
+
+        while ((data = g_queue_pop_head (filter->typefind_queue))) {
+                gst_mini_object_unref (data);
+        }
+        filter->typefind_bytes = 0;
+}
+
+static void push_one_output_buffer (GstGzDec* filter, GstBuffer* buf) {
+
+        GST_TRACE_OBJECT (filter, "Pushing one buffer");
+
+        if (G_LIKELY(filter->src_caps_set)) {
+                srcpad_push_buffer (filter, buf);
+                return;
+        }
+
+        filter->typefind_bytes += BUFFER_SIZE(buf);
+        g_queue_push_tail (filter->typefind_queue, buf);
+        if (filter->typefind_bytes >= TYPEFIND_MIN_SIZE) {
+                srcpad_typefind_release (filter);
+        }
+}
+
+// Entry events of the archive modes, the entry data that follows gets typefound anew
+static void push_one_output_event (GstGzDec* filter, GstEvent* event) {
+
+        GST_DEBUG_OBJECT (filter, "Pushing %" GST_PTR_FORMAT, event);
+
+        // the end of the entry before, typefound on what there is of it
+        srcpad_typefind_release (filter);
+
+        if (!gst_pad_push_event (filter->srcpad, event)) {
+                GST_DEBUG_OBJECT (filter, "Event was not handled downstream");
+        }
+
+        GST_OBJECT_LOCK(filter);
+        filter->src_caps_set = FALSE;
+        GST_OBJECT_UNLOCK(filter);
+}
+
+static void srcpad_check_pending_eos (GstGzDec* filter) {
+        GstEvent *event = NULL;
+
+        GST_OBJECT_LOCK(filter);
+        GST_TRACE_OBJECT (filter, "Checking if EOS conds met");
+        // We received an EOS event AND have processed everything
+        // on the input queue (after EOS received in sync with data-flow, no more data can arrive in input queue).
+        // Now we can dispatch the pending EOS event!
+        if (filter->eos && filter->pending_eos) {
+                GST_INFO_OBJECT (filter, "Dispatching pending EOS!");
+                event = filter->pending_eos;
+                // make sure we don't dispatch it twice
+                filter->pending_eos = NULL;
+        }
+        GST_OBJECT_UNLOCK(filter);
+
+        if (event) {
+                // a short stream is typefound on what there is of it
+                srcpad_typefind_release (filter);
+                // empty stream, still needs its segment before EOS
+                srcpad_push_pending_segment (filter);
+                GST_LOG_OBJECT (filter, "Now handling pending EOS event on srcpad");
+                if (!gst_pad_event_default (filter->sinkpad, GST_OBJECT(filter), event)) {
+                        GST_WARNING_OBJECT(filter, "Failed to propagate pending EOS event: %" GST_PTR_FORMAT, event);
+                }
+        }
+}
+
+static void srcpad_task_func(gpointer user_data) {
+        GstGzDec* filter = GST_GZDEC(user_data);
+
+        GST_TRACE_OBJECT (filter, "Entering srcpad task func");
+
+        guint size;
+        gpointer data;
+        gboolean use_buffering, empty = FALSE, at_eos;
+        guint64 max_size, low, high;
+        gint percent = -1;
+
+        queue_level_settings (filter, &use_buffering, &max_size, &low, &high);
+
+        OUTPUT_QUEUE_LOCK(filter);
+        size = g_queue_get_length (filter->output_queue);
+        data = g_queue_pop_head (filter->output_queue);
+        if (data) {
+                empty = g_queue_is_empty (filter->output_queue);
+        }
+        // the queue also holds events in the archive modes
+        if (data && !GST_IS_EVENT(data)) {
+                filter->bytes_pushed += BUFFER_SIZE(GST_BUFFER(data));
+                if (filter->bytes_out - filter->bytes_pushed <= max_size) {
+                        filter->output_overrun = FALSE;
+                        OUTPUT_QUEUE_SPACE_SIGNAL(filter);
+                }
+                if (use_buffering) {
+                        percent = output_queue_update_buffering (filter, low, high);
+                }
+        }
+        OUTPUT_QUEUE_UNLOCK(filter);
+
+        GST_TRACE_OBJECT (filter, "Output queue length before pop: %d", (int) size);
+
+        post_buffering (filter, percent);
+
+        if (empty) {
+                GST_OBJECT_LOCK(filter);
+                at_eos = filter->eos;
+                GST_OBJECT_UNLOCK(filter);
+                if (!at_eos) {
+                        GST_DEBUG_OBJECT (filter, "Output queue underrun");
+                        g_signal_emit (filter, gst_gz_dec_signals[SIGNAL_UNDERRUN], 0);
+                }
+        }
+
+        if (data && GST_IS_EVENT(data)) {
+                push_one_output_event (filter, GST_EVENT(data));
+        } else if (data) {
+                push_one_output_buffer (filter, GST_BUFFER(data));
+        }
+
+        // output queue is currently empty, check if we should send EOS
+        OUTPUT_QUEUE_LOCK(filter);
+        while (g_queue_get_length (filter->output_queue) == 0 && !filter->srcpad_task_resume) {
+                // check if its time to EOS really, if yes this function will dispatch the EOS
+                // to the srcpad
+                srcpad_check_pending_eos(filter);
+                // anyway if the queue is empty we'll just wait
+                GST_TRACE_OBJECT (filter, "Waiting in srcpad task func");
+                OUTPUT_QUEUE_WAIT(filter);
+                GST_TRACE_OBJECT(filter, "Resuming srcpad task func");
+        }
+        filter->srcpad_task_resume = FALSE;
+        OUTPUT_QUEUE_UNLOCK(filter);
+
+        GST_TRACE_OBJECT (filter, "Leaving srcpad task func");
+}
+
+// The following stream is of another format, its decoder takes over (see stream_switch_func)
+static void switch_decoder (GstGzDec* filter) {
+        GstGzDecFormat format = filter->switch_format;
+
+        GST_INFO_OBJECT (filter, "Stream of format %d follows one of format %d, switching decoder",
+                         (int) format, (int) filter->stream_format);
+        filter->switch_format = GST_GZDEC_FORMAT_AUTO;
+        park_decoder (filter);
+        setup_format_decoder (filter, format, stream_writer_func);
+}
+
+// Decodes one block of input, the rest of it goes to the next decoder at every switch
+static gboolean decode_block_switching (GstGzDec* filter, GstBuffer* block) {
+        GstBuffer* rest;
+        gboolean ret;
+
+        gst_buffer_ref (block);
+        while ((ret = filter->decode_func (filter->decoder, block))
+               && filter->switch_format != GST_GZDEC_FORMAT_AUTO) {
+                rest = BUFFER_SUB (block, BUFFER_SIZE(block) - filter->switch_rest, filter->switch_rest);
+                gst_buffer_unref (block);
+                block = rest;
+                switch_decoder (filter);
+        }
+        gst_buffer_unref (block);
+        return ret;
+}
+
+// The last block ended within the magic of a stream (see stream_switch_func), the magic
+// is completed from this block and decoded on its own before the rest of the block
+static gboolean decode_block (GstGzDec* filter, GstBuffer* block) {
+        guint8 magic[sizeof(filter->stream_start)];
+        gsize size = BUFFER_SIZE(block);
+        gsize taken;
+        GstBuffer* part;
+        gboolean ret;
+
+        if (G_LIKELY(!filter->switch_fill)) {
+                return decode_block_switching (filter, block);
+        }
+
+        // a block too small to complete it holds the magic back again
+        memcpy (magic, filter->stream_start, filter->switch_fill);
+        taken = BUFFER_EXTRACT (block, 0, magic + filter->switch_fill, sizeof(magic) - filter->switch_fill);
+        part = BUFFER_NEW_WRAPPED_STATIC (magic, filter->switch_fill + taken);
+        filter->switch_fill = 0;
+        ret = decode_block_switching (filter, part);
+        gst_buffer_unref (part);
+
+        if (!ret || taken == size) {
+                return ret;
+        }
+
+        part = BUFFER_SUB (block, taken, size - taken);
+        ret = decode_block_switching (filter, part);
+        gst_buffer_unref (part);
+        return ret;
+}
+
+// A switch leaves the rest of the memory block the stream ended in, so a buffer made
+// of several blocks is decoded block by block, each one in a buffer sharing its memory
+static gboolean decode_input (GstGzDec* filter, GstBuffer* buf) {
+#ifdef USE_GSTREAMER_1_DOT_0_API
+        guint i, n = gst_buffer_n_memory (buf);
+        gsize offset = 0, size;
+        GstBuffer* block;
+        gboolean ret = TRUE;
+
+        if (n > 1) {
+                for (i = 0; ret && i < n; i++) {
+                        size = gst_memory_get_sizes (gst_buffer_peek_memory (buf, i), NULL, NULL);
+                        block = BUFFER_SUB (buf, offset, size);
+                        ret = decode_block (filter, block);
+                        gst_buffer_unref (block);
+                        offset += size;
+                }
+                return ret;
+        }
+#endif
+        return decode_block (filter, buf);
+}
+
+// Whether the stream ended properly, for the summary. Called at EOS before the decoder is parked.
+static void validate_finish (GstGzDec* filter) {
+        gboolean stopped;
+
+        if (!filter->validate_mode) {
+                return;
+        }
+
+        GST_OBJECT_LOCK(filter);
+        stopped = filter->limit_exceeded || filter->range_done;
+        GST_OBJECT_UNLOCK(filter);
+
+        if (stopped) {
+                filter->validate_complete = FALSE;
+        } else if (!filter->decoder) {
+                // freed at a stream end in low-memory mode
+                filter->validate_complete = filter->decode_func != NULL;
+        } else if (filter->stream_type == PKZIP) {
+                filter->validate_complete = !filter->validate_corrupt_entries;
+        } else {
+                filter->validate_complete = decoder_at_stream_end (filter);
+        }
+}
+
+static void process_one_input_buffer (GstGzDec* filter, GstBuffer* buf) {
+
+        GST_TRACE_OBJECT (filter, "Processing one input buffer: %" GST_PTR_FORMAT, buf);
+
+        // drop whatever was queued behind the buffer that hit a limit or the seek stop
+        GST_OBJECT_LOCK(filter);
+        if (G_UNLIKELY(filter->limit_exceeded || filter->range_done)) {
+                GST_OBJECT_UNLOCK(filter);
+                GST_LOG_OBJECT (filter, "Output limit or seek stop reached, dropping input");
+                return;
+        }
+        GST_OBJECT_UNLOCK(filter);
+
+        // freed while idle in low-memory mode, the next stream gets a new one
+        if (G_UNLIKELY(!filter->decoder)) {
+                GST_DEBUG_OBJECT (filter, "Rebuilding decoder");
+                setup_decoder(filter, stream_writer_func);
+        }
+
+        if (G_UNLIKELY(gst_gz_dec_latency_tracing())) {
+                GstGzDecLatencyMeta* meta = gst_buffer_get_gz_dec_latency_meta(buf);
+                filter->latency_queued = meta ? meta->queued : GST_CLOCK_TIME_NONE;
+                filter->latency_decode_start = gst_util_get_timestamp();
+        }
+
+        if (!decode_input(filter, buf)) {
+                GST_OBJECT_LOCK(filter);
+                if (filter->limit_exceeded || filter->range_done) {
+                        GST_OBJECT_UNLOCK(filter);
+                        // stopped mid-stream, the next stream needs a fresh decoder
+                        clear_decoder(filter);
+                        return;
+                }
+                GST_OBJECT_UNLOCK(filter);
+                GST_ERROR("Failed to decode: %" GST_PTR_FORMAT, buf);
+                cache_abort(filter);
+        }
+}
+
+// A stream start, queued behind the data of the stream before. The state of the input
+// task is reset here, in between the two streams, rather than in the streaming thread.
+static void input_stream_reset (GstGzDec* filter) {
+        GST_DEBUG_OBJECT(filter, "Stream start, resetting the input task state");
+        filter->switch_fill = 0;
+        filter->limit_bytes_in = filter->limit_bytes_out = 0;
+        g_byte_array_set_size(filter->split_tail, 0);
+        filter->range_position = 0;
+}
+
+static void input_task_func (gpointer data) {
+
+        GstGzDec *filter = GST_GZDEC (data);
+        gpointer item;
+        GstBuffer* buf;
+        gboolean eos = FALSE;
+
+        GST_TRACE_OBJECT(filter, "Entering input task function. Waiting for queue access ...");
+
+        item = input_queue_pop (filter);
+        if (item != NULL && GST_IS_EVENT(item)) {
+                input_stream_reset(filter);
+                gst_event_unref(GST_EVENT(item));
+        } else if (item != NULL) {
+                buf = GST_BUFFER(item);
+                filter->limit_bytes_in += BUFFER_SIZE(buf);
+                // takes ownership of the buffer
+                process_one_input_buffer(filter, buf);
+                // we can get rid of it now
+                gst_buffer_unref(buf);
+        } else {
+                // OPTIMIZABLE: this will run one iteration later than it could
+                GST_OBJECT_LOCK(filter);
+                // There is an EOS event pending and the input queue is fully processed
+                // We are at EOS.
+                eos = filter->pending_eos && !filter->eos;
+                GST_OBJECT_UNLOCK(filter);
+
+                if (eos) {
+                        // before the flag, the srcpad task sends EOS once it sees it and the queue is empty
+                        zip_archive_finish(filter);
+                        validate_finish(filter);
+                        if (filter->switch_fill) {
+                                GST_WARNING_OBJECT(filter, "Discarding %d bytes of trailing data after the stream end",
+                                                   (int) filter->switch_fill);
+                                filter->switch_fill = 0;
+                        }
+                        cache_finish(filter);
+                        tar_finish(filter);
+                        output_queue_flush_split(filter);
+                        output_queue_flush_sparse(filter);
+                        GST_OBJECT_LOCK(filter);
+                        GST_DEBUG_OBJECT(filter, "Setting EOS flag");
+                        filter->eos = TRUE;
+                        GST_OBJECT_UNLOCK(filter);
+                }
+
+                // we should signal EOS to srcpad queue
+                // only after releasing the object lock
+                // since the srcpad task might wait for it as well
+                if (eos) {
+                        checksum_post_message(filter);
+                        output_queue_finish_buffering(filter);
+                        OUTPUT_QUEUE_RESUME(filter);
+                }
+
+                // Wait around empty queue condition
+                INPUT_QUEUE_LOCK(filter);
+                while(g_queue_get_length(filter->input_queue) == 0
+                      && !filter->input_task_resume) {
+                        GST_TRACE_OBJECT(filter, "Waiting in input task func");
+                        // The decoder state can only be dropped in between two streams,
+                        // as there is no way to resume in the middle of one
+                        if (filter->low_memory && filter->decoder && decoder_at_stream_end(filter)) {
+                                if (!g_cond_wait_until(&filter->input_queue_run_cond, &filter->input_queue_mutex,
+                                                       g_get_monotonic_time() + LOW_MEMORY_IDLE_TIMEOUT)) {
+                                        GST_DEBUG_OBJECT(filter, "Idle, freeing decoder state");
+                                        clear_decoder(filter);
+                                }
+                        } else {
+                                INPUT_QUEUE_WAIT(filter);
+                        }
+                        GST_TRACE_OBJECT(filter, "Resuming input task func");
+                }
+                // reset resume flag in case it was set before signal
+                filter->input_task_resume = FALSE;
+                INPUT_QUEUE_UNLOCK(filter);
+        }
+
+        GST_TRACE_OBJECT(filter, "Leaving input task function");
+}
+
+// A buffer, or an event the input task handles in order with the buffers (see input_stream_reset)
+static gpointer input_queue_pop (GstGzDec *filter) {
+        gpointer data;
+        guint size;
+
+        INPUT_QUEUE_LOCK(filter);
+        GST_TRACE_OBJECT(filter, "Pop-ing buffer");
+        size = g_queue_get_length (filter->input_queue);
+        data = g_queue_pop_head (filter->input_queue);
+        if (data && !GST_IS_EVENT(data)) {
+                filter->bytes_in += BUFFER_SIZE(GST_BUFFER(data));
+                filter->input_queue_bytes -= BUFFER_SIZE(GST_BUFFER(data));
+        }
+        INPUT_QUEUE_UNLOCK(filter);
+
+        GST_TRACE_OBJECT(filter, "Input queue length before pop: %d", (int) size);
+
+        return data;
+}
+
+static void input_queue_append_event (GstGzDec *filter, GstEvent* event) {
+        INPUT_QUEUE_LOCK(filter);
+        g_queue_push_tail (filter->input_queue, event);
+        INPUT_QUEUE_SIGNAL(filter);
+        INPUT_QUEUE_UNLOCK(filter);
+}
+
+static void input_queue_append_buffer (GstGzDec *filter, GstBuffer* buf) {
+        gboolean overrun = FALSE;
+        guint max_size;
+
+        GST_OBJECT_LOCK(filter);
+        max_size = filter->max_size_bytes;
+        GST_OBJECT_UNLOCK(filter);
+
+        INPUT_QUEUE_LOCK(filter);
+        GST_TRACE_OBJECT (filter, "Appending data to input buffer");
+        g_queue_push_tail (filter->input_queue, buf);
+        filter->input_queue_bytes += BUFFER_SIZE(buf);
+        if (filter->input_queue_bytes > max_size) {
+                overrun = !filter->input_overrun;
+                filter->input_overrun = TRUE;
+        } else {
+                filter->input_overrun = FALSE;
+        }
+        GST_TRACE_OBJECT(filter, "Input queue length after append: %d", (int) g_queue_get_length (filter->input_queue));
+        INPUT_QUEUE_SIGNAL(filter);
+        INPUT_QUEUE_UNLOCK(filter);
+
+        if (overrun) {
+                GST_DEBUG_OBJECT (filter, "Input queue overrun");
+                g_signal_emit (filter, gst_gz_dec_signals[SIGNAL_OVERRUN], 0);
+        }
+}
+
+// Hands the buffers held back while peeking the stream start to
+// the decoder (or downstream in passthrough) in their original order.
+static GstFlowReturn stream_start_queue_release (GstGzDec *filter) {
+        GstBuffer* buf;
+        GstFlowReturn ret = GST_FLOW_OK;
+
+        while ((buf = g_queue_pop_head (filter->stream_start_queue))) {
+                if (filter->passthrough) {
+                        // nothing to validate, see setup_decoder
+                        if (filter->validate_mode) {
+                                ret = GST_FLOW_ERROR;
+                        }
+                        if (ret == GST_FLOW_OK) {
+                                if (!filter->src_caps_set) {
+                                        srcpad_set_caps (filter, buf);
+                                }
+                                ret = gst_pad_push (filter->srcpad, buf);
+                        } else {
+                                gst_buffer_unref (buf);
+                        }
+                } else {
+                        input_queue_append_buffer (filter, buf);
+                }
+        }
+        return ret;
+}
+
+static void output_queue_append_buffer (GstGzDec *filter, GstBuffer* buf) {
+
+        gsize bytes = BUFFER_SIZE(buf);
+        gboolean use_buffering, overrun = FALSE;
+        guint64 max_size, low, high;
+        gint percent = -1;
+
+        if (G_UNLIKELY(gst_gz_dec_latency_tracing())) {
+                GstGzDecLatencyMeta* meta = gst_buffer_add_gz_dec_latency_meta(buf);
+                meta->queued = filter->latency_queued;
+                meta->decode_start = filter->latency_decode_start;
+                meta->decoded = gst_util_get_timestamp();
+                meta->element = filter;
+        }
+
+        queue_level_settings (filter, &use_buffering, &max_size, &low, &high);
+
+        OUTPUT_QUEUE_LOCK(filter);
+        // offsets in the decompressed stream
+        GST_BUFFER_OFFSET(buf) = filter->bytes_out;
+        filter->bytes_out += bytes;
+        GST_BUFFER_OFFSET_END(buf) = filter->bytes_out;
+        if (G_UNLIKELY(filter->discont)) {
+                GST_BUFFER_FLAG_SET(buf, GST_BUFFER_FLAG_DISCONT);
+                filter->discont = FALSE;
+        }
+
+        GST_TRACE_OBJECT (filter, "Queueing new output buffer: %" GST_PTR_FORMAT, buf);
+
+        g_queue_push_tail (filter->output_queue, buf);
+        if (filter->bytes_out - filter->bytes_pushed > max_size) {
+                overrun = !filter->output_overrun;
+                filter->output_overrun = TRUE;
+        }
+        if (use_buffering) {
+                percent = output_queue_update_buffering (filter, low, high);
+        }
+        OUTPUT_QUEUE_SIGNAL(filter);
+        OUTPUT_QUEUE_UNLOCK(filter);
+
+        post_buffering (filter, percent);
+
+        if (overrun) {
+                GST_DEBUG_OBJECT (filter, "Output queue overrun");
+                g_signal_emit (filter, gst_gz_dec_signals[SIGNAL_OVERRUN], 0);
+        }
+
+        // the buffer is queued already, a buffer larger than the queue can't wait forever
+        OUTPUT_QUEUE_LOCK(filter);
+        while (filter->bytes_out - filter->bytes_pushed > max_size
+               && gst_task_get_state (filter->srcpad_task) == GST_TASK_STARTED) {
+                GST_TRACE_OBJECT (filter, "Output queue full, waiting");
+                OUTPUT_QUEUE_SPACE_WAIT(filter);
+        }
+        OUTPUT_QUEUE_UNLOCK(filter);
+}
+
+// Lets a decoder waiting on a full output queue go, call once the srcpad task is paused
+static void output_queue_unblock (GstGzDec *filter) {
+        OUTPUT_QUEUE_LOCK(filter);
+        OUTPUT_QUEUE_SPACE_SIGNAL(filter);
+        OUTPUT_QUEUE_UNLOCK(filter);
+}
+
+
+// A copy of head and data, in memfd memory when asked for (see gstgzdec_memfd.h).
+// Data served from the cache is not copied, the buffer keeps the entry mapped.
+static GstBuffer* output_buffer_new (GstGzDec *filter, gconstpointer head, gsize head_size,
+                                     gconstpointer data, gsize bytes) {
+        GstBuffer* buf;
+        guint8* dest;
+
+#ifdef USE_GSTREAMER_1_DOT_0_API
+        if (filter->stream_type == CACHED && filter->decoder && !head_size && !filter->memfd_ring
+            && cache_entry_contains (CACHE_ENTRY(filter->decoder), data, bytes)) {
+                GMappedFile* file = CACHE_ENTRY(filter->decoder)->file;
+                return gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, (gpointer) data, bytes, 0, bytes,
+                                                    g_mapped_file_ref (file), (GDestroyNotify) g_mapped_file_unref);
+        }
+#endif
+
+        if (filter->memfd_ring) {
+                buf = memfd_ring_buffer_new (MEMFD_RING(filter->memfd_ring), head_size + bytes, &dest);
+                if (G_LIKELY(buf)) {
+                        if (head_size) {
+                                memcpy (dest, head, head_size);
+                        }
+                        memcpy (dest + head_size, data, bytes);
+                        return buf;
+                }
+                GST_WARNING_OBJECT (filter, "Out of memfd memory, falling back to system memory");
+        }
+
+        buf = BUFFER_ALLOC(head_size + bytes);
+        if (head_size) {
+                BUFFER_FILL(buf, 0, head, head_size);
+        }
+        BUFFER_FILL(buf, head_size, data, bytes);
+        return buf;
+}
+
+// Queues the held back tail and as much of the data as ends on a record boundary
+static void output_queue_append_split (GstGzDec *filter, gpointer data, gsize bytes) {
+        GByteArray* tail = filter->split_tail;
+        const guchar* delimiter;
+        gsize delimiter_size;
+        gsize cut;
+        GstBuffer* buf;
+
+        if (filter->split_mode == GST_GZDEC_SPLIT_RECORD) {
+                cut = split_find_record (tail->len, bytes, filter->split_record_size);
+        } else {
+                delimiter = g_bytes_get_data (filter->split_delimiter, &delimiter_size);
+                cut = split_find_delimiter (tail->data, tail->len, data, bytes, delimiter, delimiter_size);
+        }
+
+        if (!cut) {
+                // no delimiter in sight, the tail doesn't grow without bound
+                if (!filter->split_max_record_size || tail->len + bytes <= filter->split_max_record_size) {
+                        g_byte_array_append (tail, data, bytes);
+                        return;
+                }
+                GST_WARNING_OBJECT (filter, "No delimiter in %" G_GSIZE_FORMAT " bytes, pushing the partial record",
+                                    (gsize) tail->len + bytes);
+                cut = bytes;
+        }
+
+        buf = output_buffer_new (filter, tail->data, tail->len, data, cut);
+        g_byte_array_set_size (tail, 0);
+        g_byte_array_append (tail, (const guint8*) data + cut, bytes - cut);
+
+        output_queue_append_buffer (filter, buf);
+}
+
+// The last record goes out at EOS whether it is complete or not
+static void output_queue_flush_split (GstGzDec *filter) {
+        GByteArray* tail = filter->split_tail;
+        GstBuffer* buf;
+
+        if (!tail->len) {
+                return;
+        }
+
+        GST_DEBUG_OBJECT (filter, "Flushing %d bytes of partial record", (int) tail->len);
+        buf = output_buffer_new (filter, NULL, 0, tail->data, tail->len);
+        g_byte_array_set_size (tail, 0);
+        output_queue_append_buffer (filter, buf);
+}
+
+// Pushes the zeros held back, as gaps when the run is long enough
+static void output_queue_flush_sparse (GstGzDec *filter) {
+        gsize size;
+
+        if (!filter->sparse_run) {
+                return;
+        }
+
+        if (filter->sparse_run < filter->sparse_min_run) {
+                output_queue_append_buffer (filter, output_buffer_new (filter, NULL, 0, sparse_zero_memory, filter->sparse_run));
+                filter->sparse_run = 0;
+                return;
+        }
+
+        GST_LOG_OBJECT (filter, "Gap of %" G_GUINT64_FORMAT " zero bytes", filter->sparse_run);
+        while (filter->sparse_run) {
+                size = MIN(filter->sparse_run, SPARSE_ZERO_SIZE);
+                output_queue_append_buffer (filter, sparse_gap_buffer_new (size));
+                filter->sparse_run -= size;
+        }
+}
+
+// Data following a run of zeros, a short run goes out in the same buffer
+static void output_queue_append_sparse_data (GstGzDec *filter, gconstpointer data, gsize bytes) {
+        GstBuffer* buf;
+
+        if (filter->sparse_run >= filter->sparse_min_run) {
+                output_queue_flush_sparse (filter);
+        }
+        buf = output_buffer_new (filter, sparse_zero_memory, filter->sparse_run, data, bytes);
+        filter->sparse_run = 0;
+        output_queue_append_buffer (filter, buf);
+}
+
+// Zero blocks are held back, a run can go on in the next chunk
+static void output_queue_append_sparse (GstGzDec *filter, gpointer data, gsize bytes) {
+        const guint8* p = data;
+        const guint8* end = p + bytes;
+        const guint8* start = NULL;
+        gsize block;
+
+        while (p < end) {
+                block = sparse_block_size (filter->sparse_position, end - p);
+                if (sparse_is_zero (p, block)) {
+                        if (start) {
+                                output_queue_append_sparse_data (filter, start, p - start);
+                                start = NULL;
+                        }
+                        filter->sparse_run += block;
+                } else if (!start) {
+                        start = p;
+                }
+                filter->sparse_position += block;
+                p += block;
+        }
+
+        if (start) {
+                output_queue_append_sparse_data (filter, start, p - start);
+        }
+}
+
+// Data of one tar entry or of the whole stream
+static void output_queue_append_chunk (GstGzDec *filter, gpointer data, gsize bytes) {
+
+        GstBuffer* buf;
+
+        if (filter->split_mode != GST_GZDEC_SPLIT_NONE) {
+                output_queue_append_split (filter, data, bytes);
+                return;
+        }
+
+        if (filter->sparse_mode) {
+                output_queue_append_sparse (filter, data, bytes);
+                return;
+        }
+
+        buf = output_buffer_new (filter, NULL, 0, data, bytes);
+        output_queue_append_buffer (filter, buf);
+}
+
+static void output_queue_append_event (GstGzDec *filter, GstEvent* event) {
+        OUTPUT_QUEUE_LOCK(filter);
+        GST_TRACE_OBJECT (filter, "Queueing event: %" GST_PTR_FORMAT, event);
+        g_queue_push_tail (filter->output_queue, event);
+        OUTPUT_QUEUE_SIGNAL(filter);
+        OUTPUT_QUEUE_UNLOCK(filter);
+}
+
+// Compiles the entry-filter patterns for the run, call with the object lock held
+static void entry_filter_setup (GstGzDec* filter) {
+        gchar** globs;
+        gchar** glob;
+
+        if (filter->entry_patterns) {
+                return;
+        }
+
+        filter->entry_patterns = g_ptr_array_new_with_free_func ((GDestroyNotify) g_pattern_spec_free);
+
+        if (filter->entry_filter) {
+                globs = g_strsplit (filter->entry_filter, ",", -1);
+                for (glob = globs; *glob; glob++) {
+                        g_strstrip (*glob);
+                        if (**glob) {
+                                g_ptr_array_add (filter->entry_patterns, g_pattern_spec_new (*glob));
+                        }
+                }
+                g_strfreev (globs);
+        }
+}
+
+static void entry_filter_clear (GstGzDec* filter) {
+        if (filter->entry_patterns) {
+                g_ptr_array_unref (filter->entry_patterns);
+                filter->entry_patterns = NULL;
+        }
+}
+
+static gboolean entry_wanted (GstGzDec* filter, const gchar* name) {
+        GPtrArray* patterns = filter->entry_patterns;
+        guint i;
+
+        if (!patterns->len) {
+                return TRUE;
+        }
+        for (i = 0; i < patterns->len; i++) {
+                if (g_pattern_match_string (g_ptr_array_index (patterns, i), name)) {
+                        return TRUE;
+                }
+        }
+        return FALSE;
+}
+
+/*
+   Tar mode. The archive is parsed as it comes out of the decoder, all entries go out on the
+   one source pad, each one announced by a custom event carrying its name, size, mode and mtime.
+   The data of entries not matching the filter is stepped over without being copied.
+ */
+static gboolean tar_entry_func (gpointer user_data, const TarEntry* entry) {
+        GstGzDec* filter = GST_GZDEC(user_data);
+
+        if (!entry_wanted (filter, entry->name)) {
+                GST_DEBUG_OBJECT (filter, "Skipping tar entry %s", entry->name);
+                return FALSE;
+        }
+
+        output_queue_append_event (filter,
+                                   gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM,
+                                                         gst_structure_new (TAR_ENTRY_EVENT_NAME,
+                                                                            "name", G_TYPE_STRING, entry->name,
+                                                                            "size", G_TYPE_UINT64, entry->size,
+                                                                            "mode", G_TYPE_UINT, entry->mode,
+                                                                            "mtime", G_TYPE_UINT64, entry->mtime,
+                                                                            NULL)));
+        return TRUE;
+}
+
+static void tar_data_func (gpointer user_data, gconstpointer data, gsize bytes) {
+        output_queue_append_chunk (GST_GZDEC(user_data), (gpointer) data, bytes);
+}
+
+// Split records and zero runs don't run across entries
+static void tar_entry_end_func (gpointer user_data) {
+        output_queue_flush_split (GST_GZDEC(user_data));
+        output_queue_flush_sparse (GST_GZDEC(user_data));
+}
+
+// Takes the tar setting for the run, call with the object lock held
+static void tar_setup (GstGzDec* filter) {
+        if (!filter->tar || filter->tar_parser) {
+                return;
+        }
+        filter->tar_parser = tar_parser_new (filter, tar_entry_func, tar_data_func, tar_entry_end_func);
+}
+
+static void tar_clear (GstGzDec* filter) {
+        if (filter->tar_parser) {
+                tar_parser_free (TAR_PARSER(filter->tar_parser));
+                filter->tar_parser = NULL;
+        }
+}
+
+static void tar_feed (GstGzDec* filter, gconstpointer data, gsize bytes) {
+        TarParser* parser = TAR_PARSER(filter->tar_parser);
+        gboolean failed = parser->state == TAR_FAILED;
+
+        tar_parser_feed (parser, data, bytes);
+
+        if (!failed && parser->state == TAR_FAILED) {
+                GST_ELEMENT_ERROR (filter, STREAM, DEMUX, ("Not a tar archive or corrupt tar header"), (NULL));
+        }
+}
+
+// End of the stream, the next one starts a new archive
+static void tar_finish (GstGzDec* filter) {
+        TarParser* parser = TAR_PARSER(filter->tar_parser);
+
+        if (!parser) {
+                return;
+        }
+        if (!tar_parser_finish (parser)) {
+                GST_ELEMENT_WARNING (filter, STREAM, DEMUX, ("Tar archive is truncated"), (NULL));
+        }
+        tar_parser_reset (parser);
+}
+
+/*
+   Zip mode. The entries are found through the central directory at the end of the archive.
+   When upstream can seek in bytes, the input task reads the tail, the central directory and
+   the wanted entries through seeks to byte ranges, so only those are ever read: one entry of
+   a huge archive comes without the rest of it. The flushes, segments and EOS upstream sends
+   for these seeks are the input task's own (see zip_seeking_event). Otherwise the archive is
+   spooled to a temporary file until EOS. Entries are decoded in parallel on the pool and
+   pushed in the order of the central directory, each one after a custom event like in tar
+   mode. Entries too large to hold are decoded by the input task as they are read.
+ */
+
+// Compressed data is handed to the decoders in slices of this size
+#define ZIP_INPUT_SLICE_SIZE (1024 * 1024)
+// Output an entry holds while waiting for the ones before it, the decoder then waits too
+#define ZIP_JOB_OUTPUT_MAX (4 * 1024 * 1024)
+// Entries up to this compressed size are read in whole and decoded on the pool
+#define ZIP_JOB_INPUT_MAX (4 * 1024 * 1024)
+// A gap up to this size in the range upstream sends is read through rather than seeked over
+#define ZIP_SKIP_MAX (256 * 1024)
+
+// Called with the parts of the archive that are read, the buffer is borrowed
+typedef gboolean (*ZipReadFunc) (gpointer user_data, GstBuffer* buf);
+
+static void zip_job_free (ZipJob* job) {
+        zip_entry_free (ZIP_ENTRY(job->entry));
+        if (job->input) {
+                gst_buffer_unref (job->input);
+        }
+        g_byte_array_unref (job->output);
+        g_free (job);
+}
+
+// The entry reached the head of the queue. Only this job writes to the element until it
+// is done, through stream_writer_func like the decoder of any other stream.
+static gboolean zip_job_start (GstGzDec* filter, ZipJob* job) {
+        ZipEntry* entry = ZIP_ENTRY(job->entry);
+        gboolean stopped;
+
+        job->streaming = TRUE;
+
+        GST_OBJECT_LOCK(filter);
+        stopped = filter->limit_exceeded || filter->range_done;
+        GST_OBJECT_UNLOCK(filter);
+        if (stopped) {
+                job->stopped = TRUE;
+                return FALSE;
+        }
+
+        // the ratio is checked against the whole compressed entry
+        filter->limit_bytes_in += entry->compressed_size;
+
+        if (!filter->validate_mode) {
+                output_queue_append_event (filter,
+                                           gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM,
+                                                                 gst_structure_new (ZIP_ENTRY_EVENT_NAME,
+                                                                                    "name", G_TYPE_STRING, entry->name,
+                                                                                    "size", G_TYPE_UINT64, entry->size,
+                                                                                    "mode", G_TYPE_UINT, entry->mode,
+                                                                                    "mtime", G_TYPE_UINT64, entry->mtime,
+                                                                                    NULL)));
+        }
+
+        if (job->output->len && !stream_writer_func (filter, job->output->data, job->output->len)) {
+                job->stopped = TRUE;
+        }
+        g_byte_array_set_size (job->output, 0);
+        return !job->stopped;
+}
+
+// The size in the central directory is a hard limit, anything beyond is corrupt or a bomb
+static gboolean zip_job_writer_func (gpointer user_data, gpointer data, gsize bytes) {
+        ZipJob* job = user_data;
+        GstGzDec* filter = job->filter;
+
+        if (bytes == 0) {
+                return TRUE;
+        }
+        if (job->size + bytes > ZIP_ENTRY(job->entry)->size) {
+                GST_WARNING ("Zip entry %s decodes to more than its size", ZIP_ENTRY(job->entry)->name);
+                return FALSE;
+        }
+        if (job->verify) {
+                job->crc = crc32 (job->crc, data, (uInt) bytes);
+        }
+        job->size += bytes;
+
+        if (!job->streaming) {
+                // the head only changes when the head job is done, so this holds once the lock is released
+                ZIP_JOBS_LOCK(filter);
+                while (g_queue_peek_head (filter->zip_jobs) != job
+                       && job->output->len + bytes > ZIP_JOB_OUTPUT_MAX) {
+                        ZIP_JOBS_WAIT(filter);
+                }
+                if (g_queue_peek_head (filter->zip_jobs) != job) {
+                        g_byte_array_append (job->output, data, (guint) bytes);
+                        ZIP_JOBS_UNLOCK(filter);
+                        return TRUE;
+                }
+                ZIP_JOBS_UNLOCK(filter);
+
+                if (!zip_job_start (filter, job)) {
+                        return FALSE;
+                }
+        }
+
+        if (!stream_writer_func (filter, data, bytes)) {
+                job->stopped = TRUE;
+                return FALSE;
+        }
+        return TRUE;
+}
+
+static gboolean zip_job_store_chunk (gpointer user_data, const guint8* data, gsize size) {
+        return zip_job_writer_func (user_data, (gpointer) data, size);
+}
+
+// The same decoder wrappers as the element, stored entries have none
+static gboolean zip_job_decoder_new (GstGzDec* filter, ZipJob* job) {
+        ZipEntry* entry = ZIP_ENTRY(job->entry);
+
+        job->ok = TRUE;
+        switch (entry->method) {
+        case ZIP_METHOD_DEFLATE:
+                job->decoder = zipdec_stream_new (job, zip_job_writer_func, NULL, NULL, NULL, ZLIB_INFLATE_WINDOW_BITS_RAW, TRUE,
+                                                  &filter->memory, filter->low_memory ? ZIP_DEC_STREAM_OUT_BUFFER_SIZE_SMALL : ZIP_DEC_STREAM_OUT_BUFFER_SIZE);
+                job->decode_func = ZIP_DECODER_DECODE;
+                break;
+        case ZIP_METHOD_BZIP2:
+                job->decoder = bzipdec_stream_new (job, zip_job_writer_func, NULL, NULL, filter->low_memory,
+                                                   &filter->memory, filter->low_memory ? BZIP_DEC_STREAM_OUT_BUFFER_SIZE_SMALL : BZIP_DEC_STREAM_OUT_BUFFER_SIZE);
+                job->decode_func = BZIP_DECODER_DECODE;
+                break;
+        }
+
+        // out of memory for the decoder state, not a stored entry
+        if (entry->method != ZIP_METHOD_STORED && !job->decoder) {
+                GST_WARNING ("Failed to create the decoder for zip entry %s", entry->name);
+                job->failed = TRUE;
+                return FALSE;
+        }
+        return TRUE;
+}
+
+// Decodes the next part of the compressed data, a ZipReadFunc
+static gboolean zip_job_decode_buffer (gpointer user_data, GstBuffer* buf) {
+        ZipJob* job = user_data;
+
+        if (job->ok) {
+                job->ok = job->decoder ? job->decode_func (job->decoder, buf)
+                                       : buffer_foreach_chunk (buf, zip_job_store_chunk, job);
+        }
+        return job->ok;
+}
+
+static void zip_job_decoder_finish (ZipJob* job) {
+        ZipEntry* entry = ZIP_ENTRY(job->entry);
+        gboolean ok = job->ok;
+
+        if (entry->method == ZIP_METHOD_DEFLATE) {
+                ok = ok && ZIP_DECODER_AT_END(job->decoder);
+                zipdec_stream_free (ZIP_DECODER_STREAM(job->decoder));
+        } else if (entry->method == ZIP_METHOD_BZIP2) {
+                ok = ok && BZIP_DECODER_AT_END(job->decoder);
+                bzipdec_stream_free (BZIP_DECODER_STREAM(job->decoder));
+        }
+        job->decoder = NULL;
+
+        // cut short on purpose, not corrupt
+        job->failed = !job->stopped
+                      && (!ok || job->size != entry->size
+                          || (job->verify && job->crc != entry->crc));
+}
+
+// Runs on a worker thread, the compressed data was read in whole
+static void zip_job_decode (GstGzDec* filter, ZipJob* job) {
+        gsize size = job->input ? BUFFER_SIZE(job->input) : 0;
+        gsize pos, n;
+        GstBuffer* slice;
+
+        if (!zip_job_decoder_new (filter, job)) {
+                return;
+        }
+        for (pos = 0; job->ok && pos < size; pos += n) {
+                n = MIN(size - pos, ZIP_INPUT_SLICE_SIZE);
+                slice = BUFFER_SUB(job->input, pos, n);
+                zip_job_decode_buffer (job, slice);
+                gst_buffer_unref (slice);
+        }
+        zip_job_decoder_finish (job);
+}
+
+// Call with the jobs lock held, the job is done and at the head of the queue
+static void zip_job_push (GstGzDec* filter, ZipJob* job) {
+        ZipEntry* entry = ZIP_ENTRY(job->entry);
+
+        if (job->failed) {
+                filter->validate_corrupt_entries++;
+                if (job->streaming) {
+                        GST_ELEMENT_WARNING (filter, STREAM, DECODE, ("Corrupt zip entry truncated"),
+                                             ("%s, the output up to the error was pushed", entry->name));
+                } else {
+                        GST_ELEMENT_WARNING (filter, STREAM, DECODE, ("Corrupt zip entry skipped"), ("%s", entry->name));
+                        return;
+                }
+        } else if (!job->streaming) {
+                zip_job_start (filter, job);
+        }
+
+        // split records and zero runs don't run across entries
+        output_queue_flush_split (filter);
+        output_queue_flush_sparse (filter);
+}
+
+// Call with the jobs lock held. Pushes the entries done at the head of the queue,
+// so entries keep their order. The input task waits meanwhile, nothing else pushes.
+static void zip_jobs_flush_done (GstGzDec* filter) {
+        ZipJob* job;
+
+        while ((job = g_queue_peek_head (filter->zip_jobs)) && job->done) {
+                g_queue_pop_head (filter->zip_jobs);
+                zip_job_push (filter, job);
+                zip_job_free (job);
+        }
+}
+
+// The entry is decoded, it is pushed once the ones before it are
+static void zip_job_done (GstGzDec* filter, ZipJob* job) {
+        ZIP_JOBS_LOCK(filter);
+        job->done = TRUE;
+        zip_jobs_flush_done (filter);
+        ZIP_JOBS_SIGNAL(filter);
+        ZIP_JOBS_UNLOCK(filter);
+}
+
+// Runs on the worker threads of the pool
+static void zip_job_func (gpointer data, gpointer user_data) {
+        ZipJob* job = data;
+        GstGzDec* filter = GST_GZDEC(user_data);
+
+        GST_TRACE_OBJECT (filter, "Decoding zip entry %s", ZIP_ENTRY(job->entry)->name);
+
+        zip_job_decode (filter, job);
+        zip_job_done (filter, job);
+}
+
+static gboolean zip_entry_supported (GstGzDec* filter, const ZipEntry* entry) {
+        if (entry->flags & ZIP_FLAG_ENCRYPTED) {
+                GST_ELEMENT_WARNING (filter, STREAM, DECRYPT, ("Encrypted zip entry skipped"), ("%s", entry->name));
+                return FALSE;
+        }
+        if (entry->method != ZIP_METHOD_STORED && entry->method != ZIP_METHOD_DEFLATE
+            && entry->method != ZIP_METHOD_BZIP2) {
+                GST_ELEMENT_WARNING (filter, STREAM, CODEC_NOT_FOUND, ("Zip entry with unsupported compression skipped"),
+                                     ("%s uses method %u", entry->name, entry->method));
+                return FALSE;
+        }
+        return TRUE;
+}
+
+// Seek mode, the next buffer upstream sends in the range. NULL at the end of the range,
+// or when the task is paused or stopped meanwhile.
+static GstBuffer* zip_archive_pop (GstGzDec* filter, ZipArchive* archive) {
+        gpointer data;
+
+        INPUT_QUEUE_LOCK(filter);
+        while (!(data = g_queue_pop_head (filter->input_queue))) {
+                if (filter->input_task_resume) {
+                        filter->input_task_resume = FALSE;
+                        if (gst_task_get_state (filter->input_task) != GST_TASK_STARTED) {
+                                archive->aborted = TRUE;
+                                break;
+                        }
+                }
+                INPUT_QUEUE_WAIT(filter);
+        }
+        if (data && !GST_IS_EVENT(data)) {
+                filter->bytes_in += BUFFER_SIZE(GST_BUFFER(data));
+                filter->input_queue_bytes -= BUFFER_SIZE(GST_BUFFER(data));
+        }
+        INPUT_QUEUE_UNLOCK(filter);
+
+        // the EOS upstream sent at the end of the range
+        if (data && GST_IS_EVENT(data)) {
+                archive->range_eos = GST_EVENT_TYPE (data) == GST_EVENT_EOS;
+                gst_event_unref (GST_EVENT(data));
+                return NULL;
+        }
+        return GST_BUFFER(data);
+}
+
+// Seek mode, has upstream send [start, stop) of the archive
+static gboolean zip_archive_seek (GstGzDec* filter, ZipArchive* archive, guint64 start, guint64 stop) {
+        GstEvent* seek;
+
+        GST_DEBUG_OBJECT (filter, "Reading zip archive range %" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT, start, stop);
+
+        if (archive->pending) {
+                gst_buffer_unref (archive->pending);
+                archive->pending = NULL;
+        }
+        archive->position = start;
+        archive->range_end = stop;
+        archive->range_eos = FALSE;
+
+        seek = gst_event_new_seek (1.0, GST_FORMAT_BYTES, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+                                   GST_SEEK_TYPE_SET, (gint64) start, GST_SEEK_TYPE_SET, (gint64) stop);
+        // the flush comes back in this thread and drops what was queued of the range before
+        if (!gst_pad_push_event (filter->sinkpad, seek)) {
+                // upstream refuses seeks while it shuts down, no error then
+                if (gst_task_get_state (filter->input_task) == GST_TASK_STARTED) {
+                        GST_ELEMENT_ERROR (filter, STREAM, DEMUX, ("Upstream failed to seek in the zip archive"), (NULL));
+                }
+                archive->aborted = TRUE;
+                return FALSE;
+        }
+        return TRUE;
+}
+
+// Spool mode, the mapping is kept until all entries are pushed
+static gboolean zip_archive_read_spool (ZipArchive* archive, guint64 offset, guint64 size,
+                                        ZipReadFunc func, gpointer user_data) {
+        const guchar* data = (const guchar*) g_mapped_file_get_contents (archive->spool);
+        GstBuffer* buf;
+        gsize n;
+        gboolean ok = TRUE;
+
+        for (; ok && size > 0; offset += n, size -= n) {
+                n = (gsize) MIN(size, ZIP_INPUT_SLICE_SIZE);
+                buf = BUFFER_NEW_WRAPPED_STATIC(data + offset, n);
+                ok = func (user_data, buf);
+                gst_buffer_unref (buf);
+        }
+        return ok;
+}
+
+// Reads [offset, offset + size) of the archive. In seek mode upstream is asked for
+// [offset, stop) unless that part comes next in the range it sends already, so what
+// follows up to stop is read without another seek.
+static gboolean zip_archive_read (GstGzDec* filter, ZipArchive* archive, guint64 offset, guint64 size,
+                                  guint64 stop, ZipReadFunc func, gpointer user_data) {
+        guint64 archive_size = archive->seeking ? archive->size : g_mapped_file_get_length (archive->spool);
+        GstBuffer* buf;
+        gsize n;
+        gboolean ok = TRUE;
+
+        if (offset > archive_size || size > archive_size - offset) {
+                GST_DEBUG_OBJECT (filter, "Zip archive read out of bounds");
+                return FALSE;
+        }
+        if (size == 0) {
+                return TRUE;
+        }
+        if (!archive->seeking) {
+                return zip_archive_read_spool (archive, offset, size, func, user_data);
+        }
+
+        if (archive->range_eos || offset < archive->position || offset + size > archive->range_end
+            || offset - archive->position > ZIP_SKIP_MAX) {
+                if (!zip_archive_seek (filter, archive, offset, MIN(MAX(stop, offset + size), archive_size))) {
+                        return FALSE;
+                }
+        }
+
+        while (ok && size > 0) {
+                if (!archive->pending) {
+                        archive->pending = zip_archive_pop (filter, archive);
+                        archive->pending_skip = 0;
+                        if (!archive->pending) {
+                                if (!archive->aborted) {
+                                        GST_WARNING_OBJECT (filter, "Zip archive range ended early");
+                                }
+                                return FALSE;
+                        }
+                }
+                n = BUFFER_SIZE(archive->pending) - archive->pending_skip;
+                if (archive->position < offset) {
+                        // a gap in the range, read through
+                        n = (gsize) MIN(n, offset - archive->position);
+                } else {
+                        n = (gsize) MIN(n, size);
+                        buf = BUFFER_SUB(archive->pending, archive->pending_skip, n);
+                        ok = func (user_data, buf);
+                        gst_buffer_unref (buf);
+                        size -= n;
+                }
+                archive->position += n;
+                archive->pending_skip += n;
+                if (archive->pending_skip == BUFFER_SIZE(archive->pending)) {
+                        gst_buffer_unref (archive->pending);
+                        archive->pending = NULL;
+                }
+        }
+        return ok;
+}
+
+static gboolean zip_archive_append (gpointer data, const guint8* chunk, gsize size) {
+        g_byte_array_append ((GByteArray*) data, chunk, size);
+        return TRUE;
+}
+
+// A ZipReadFunc copying to a GByteArray, for the records
+static gboolean zip_read_bytes (gpointer user_data, GstBuffer* buf) {
+        return buffer_foreach_chunk (buf, zip_archive_append, user_data);
+}
+
+// A ZipReadFunc collecting the buffers of an entry, they share their memory with upstream's or the spool
+static gboolean zip_read_buffer (gpointer user_data, GstBuffer* buf) {
+        GstBuffer** input = user_data;
+
+        gst_buffer_ref (buf);
+        *input = *input ? BUFFER_APPEND (*input, buf) : buf;
+        return TRUE;
+}
+
+static GByteArray* zip_archive_read_bytes (GstGzDec* filter, ZipArchive* archive, guint64 offset, guint64 size) {
+        GByteArray* bytes = g_byte_array_sized_new ((guint) size);
+
+        if (!zip_archive_read (filter, archive, offset, size, offset + size, zip_read_bytes, bytes)) {
+                g_byte_array_unref (bytes);
+                return NULL;
+        }
+        return bytes;
+}
+
+// Reads the central directory, NULL if there is none or it is corrupt
+static GPtrArray* zip_archive_read_directory (GstGzDec* filter, ZipArchive* archive, guint64 size, guint64* cd_offset) {
+        ZipDirectoryInfo info;
+        GByteArray* bytes;
+        GPtrArray* entries;
+        guint64 tail_size = MIN(size, ZIP_TAIL_SIZE);
+        gboolean ok;
+
+        bytes = zip_archive_read_bytes (filter, archive, size - tail_size, tail_size);
+        if (!bytes) {
+                return NULL;
+        }
+        ok = zip_read_eocd (bytes->data, bytes->len, &info);
+        g_byte_array_unref (bytes);
+        if (!ok) {
+                return NULL;
+        }
 
-                // we should signal EOS to srcpad queue
-                // only after releasing the object lock
-                // since the srcpad task might wait for it as well
-                if (eos) {
-                        output_queue_signal_resume(filter);
+        if (info.zip64_offset != G_MAXUINT64) {
+                bytes = zip_archive_read_bytes (filter, archive, info.zip64_offset, ZIP64_EOCD_SIZE);
+                if (!bytes) {
+                        GST_ERROR_OBJECT (filter, "Zip64 end of central directory record is out of bounds");
+                        return NULL;
                 }
+                ok = zip_read_zip64_eocd (bytes->data, &info);
+                g_byte_array_unref (bytes);
+                if (!ok) {
+                        return NULL;
+                }
+        }
 
-                // Wait around empty queue condition
-                INPUT_QUEUE_LOCK(filter);
-                while(g_queue_get_length(filter->input_queue) == 0
-                      && !filter->input_task_resume) {
-                        GST_TRACE_OBJECT(filter, "Waiting in input task func");
-                        INPUT_QUEUE_WAIT(filter);
-                        GST_TRACE_OBJECT(filter, "Resuming input task func");
+        if (info.offset > size || info.size > size - info.offset || info.size > G_MAXUINT) {
+                GST_ERROR_OBJECT (filter, "Central directory is out of bounds");
+                return NULL;
+        }
+        bytes = zip_archive_read_bytes (filter, archive, info.offset, info.size);
+        if (!bytes) {
+                return NULL;
+        }
+        entries = zip_read_central_directory (bytes->data, bytes->len, info.count);
+        g_byte_array_unref (bytes);
+
+        *cd_offset = info.offset;
+        return entries;
+}
+
+// Returns where the data of an entry starts, after its local header, 0 if there is none
+static guint64 zip_archive_read_local_header (GstGzDec* filter, ZipArchive* archive, const ZipEntry* entry, guint64 stop) {
+        GByteArray* header = g_byte_array_sized_new (ZIP_LOCAL_SIZE);
+        guint header_size = 0;
+
+        if (zip_archive_read (filter, archive, entry->offset, ZIP_LOCAL_SIZE, stop, zip_read_bytes, header)) {
+                header_size = zip_local_header_size (header->data);
+        }
+        g_byte_array_unref (header);
+        return header_size ? entry->offset + header_size : 0;
+}
+
+// Queues a job in central directory order. Finished entries wait for the ones before them,
+// this bounds how many are held.
+static void zip_jobs_push (GstGzDec* filter, ZipJob* job, guint threads) {
+        ZIP_JOBS_LOCK(filter);
+        while (g_queue_get_length (filter->zip_jobs) >= 2 * threads) {
+                ZIP_JOBS_WAIT(filter);
+        }
+        g_queue_push_tail (filter->zip_jobs, job);
+        ZIP_JOBS_UNLOCK(filter);
+
+        GST_TRACE_OBJECT (filter, "Submitting zip entry %s", ZIP_ENTRY(job->entry)->name);
+}
+
+// Decodes the wanted entries of an archive of size bytes and waits until all are pushed
+static void zip_archive_extract (GstGzDec* filter, ZipArchive* archive, guint64 size) {
+        GPtrArray* entries;
+        GArray* offsets;
+        gboolean* wanted;
+        ZipEntry* entry;
+        ZipJob* job;
+        guint64 cd_offset = 0, data_start, stop;
+        guint threads, i, j;
+        gboolean verify, stopped;
+
+        entries = zip_archive_read_directory (filter, archive, size, &cd_offset);
+        if (!entries) {
+                if (!archive->aborted) {
+                        GST_ELEMENT_ERROR (filter, STREAM, DEMUX, ("Not a zip archive or corrupt central directory"), (NULL));
                 }
-                // reset resume flag in case it was set before signal
-                filter->input_task_resume = FALSE;
-                INPUT_QUEUE_UNLOCK(filter);
+                return;
         }
 
-        GST_TRACE_OBJECT(filter, "Leaving input task function");
+        GST_OBJECT_LOCK(filter);
+        threads = filter->threads ? filter->threads : g_get_num_processors ();
+        verify = filter->verify;
+        GST_OBJECT_UNLOCK(filter);
+
+        // kept over state cycles, the threads setting might have changed since
+        GST_INFO_OBJECT (filter, "Decoding zip entries on %d threads", (int) threads);
+        if (!filter->zip_pool) {
+                filter->zip_pool = g_thread_pool_new (zip_job_func, filter, threads, FALSE, NULL);
+        } else {
+                g_thread_pool_set_max_threads (filter->zip_pool, threads, NULL);
+        }
+
+        wanted = g_new0 (gboolean, entries->len);
+        for (i = 0; i < entries->len; i++) {
+                entry = g_ptr_array_index (entries, i);
+                if (!zip_entry_is_regular (entry) || !entry_wanted (filter, entry->name)) {
+                        GST_DEBUG_OBJECT (filter, "Skipping zip entry %s", entry->name);
+                        continue;
+                }
+                wanted[i] = zip_entry_supported (filter, entry);
+        }
+        offsets = zip_entry_offsets (entries, cd_offset);
+
+        for (i = 0; i < entries->len && !archive->aborted; i++) {
+                if (!wanted[i]) {
+                        continue;
+                }
+                entry = g_ptr_array_index (entries, i);
+
+                GST_OBJECT_LOCK(filter);
+                stopped = filter->limit_exceeded || filter->range_done;
+                GST_OBJECT_UNLOCK(filter);
+                if (stopped) {
+                        GST_DEBUG_OBJECT (filter, "Output stopped, not decoding the remaining zip entries");
+                        break;
+                }
+
+                // in seek mode one range runs over the wanted entries that follow each other
+                stop = zip_extent_end (offsets, entry->offset);
+                for (j = i + 1; j < entries->len && wanted[j]
+                     && ZIP_ENTRY(g_ptr_array_index (entries, j))->offset == stop; j++) {
+                        stop = zip_extent_end (offsets, stop);
+                }
+
+                data_start = zip_archive_read_local_header (filter, archive, entry, stop);
+                if (!data_start) {
+                        if (!archive->aborted) {
+                                GST_ELEMENT_WARNING (filter, STREAM, DEMUX, ("Zip entry out of bounds skipped"), ("%s", entry->name));
+                        }
+                        continue;
+                }
+
+                job = g_new0 (ZipJob, 1);
+                job->filter = filter;
+                // the job takes the entry over
+                job->entry = entry;
+                g_ptr_array_index (entries, i) = NULL;
+                job->verify = verify;
+                job->output = g_byte_array_new ();
+                job->crc = crc32 (0L, Z_NULL, 0);
+
+                if (entry->compressed_size <= ZIP_JOB_INPUT_MAX) {
+                        if (!zip_archive_read (filter, archive, data_start, entry->compressed_size, stop,
+                                               zip_read_buffer, &job->input)) {
+                                if (!archive->aborted) {
+                                        GST_ELEMENT_WARNING (filter, STREAM, DEMUX, ("Zip entry out of bounds skipped"), ("%s", entry->name));
+                                }
+                                zip_job_free (job);
+                                continue;
+                        }
+                        zip_jobs_push (filter, job, threads);
+                        g_thread_pool_push (filter->zip_pool, job, NULL);
+                        continue;
+                }
+
+                // too large to hold, decoded here as it is read
+                zip_jobs_push (filter, job, threads);
+                if (zip_job_decoder_new (filter, job)) {
+                        // a read error rather than a decoding one
+                        if (!zip_archive_read (filter, archive, data_start, entry->compressed_size, stop,
+                                               zip_job_decode_buffer, job)) {
+                                job->ok = FALSE;
+                        }
+                        zip_job_decoder_finish (job);
+                }
+                zip_job_done (filter, job);
+        }
+
+        ZIP_JOBS_LOCK(filter);
+        while (!g_queue_is_empty (filter->zip_jobs)) {
+                ZIP_JOBS_WAIT(filter);
+        }
+        ZIP_JOBS_UNLOCK(filter);
+
+        g_array_unref (offsets);
+        g_free (wanted);
+        g_ptr_array_unref (entries);
 }
 
-static GstBuffer* input_queue_pop_buffer (GstGzDec *filter) {
+// Whether upstream can seek in bytes and tells the size, so only what we need of the archive is read
+static gboolean zip_archive_seekable (GstGzDec* filter, ZipArchive* archive) {
+        GstQuery* query = gst_query_new_seeking (GST_FORMAT_BYTES);
+        gboolean seekable = FALSE;
+        gint64 size = -1;
+
+        if (gst_pad_peer_query (filter->sinkpad, query)) {
+                gst_query_parse_seeking (query, NULL, &seekable, NULL, NULL);
+        }
+        gst_query_unref (query);
+
+        if (!seekable || !gst_pad_peer_query_duration (filter->sinkpad, GST_FORMAT_BYTES, &size) || size <= 0) {
+                return FALSE;
+        }
+        archive->size = size;
+        return TRUE;
+}
+
+// Seek mode, from the first buffer on. The flushes, segments and EOS upstream
+// sends meanwhile are the input task's (see zip_seeking_event).
+static void zip_archive_extract_seeking (GstGzDec* filter, ZipArchive* archive) {
+        GstEvent* eos;
         gpointer data;
-        guint size;
+
+        GST_INFO_OBJECT (filter, "Reading zip archive of %" G_GUINT64_FORMAT " bytes through upstream seeks", archive->size);
 
         INPUT_QUEUE_LOCK(filter);
-        GST_TRACE_OBJECT(filter, "Pop-ing buffer");
-        size = g_queue_get_length (filter->input_queue);
-        data = g_queue_pop_head (filter->input_queue);
+        filter->zip_seeking = TRUE;
         INPUT_QUEUE_UNLOCK(filter);
+        // an EOS that came already is of the stream from the start, the ranges have their own
+        GST_OBJECT_LOCK(filter);
+        eos = filter->pending_eos;
+        filter->pending_eos = NULL;
+        GST_OBJECT_UNLOCK(filter);
 
-        GST_TRACE_OBJECT(filter, "Input queue length before pop: %d", (int) size);
+        zip_archive_extract (filter, archive, archive->size);
 
-        return GST_BUFFER(data);
+        INPUT_QUEUE_LOCK(filter);
+        filter->zip_seeking = FALSE;
+        // what is left of the last range
+        while ((data = g_queue_pop_head (filter->input_queue))) {
+                if (GST_IS_EVENT(data)) {
+                        archive->range_eos = archive->range_eos || GST_EVENT_TYPE (data) == GST_EVENT_EOS;
+                } else {
+                        filter->input_queue_bytes -= BUFFER_SIZE(GST_BUFFER(data));
+                }
+                gst_mini_object_unref (data);
+        }
+        INPUT_QUEUE_UNLOCK(filter);
+
+        GST_OBJECT_LOCK(filter);
+        filter->zip_done = TRUE;
+        // upstream is idle after the EOS of the last range (or of the stream, without any seek).
+        // Otherwise the chain function returns GST_FLOW_EOS and upstream sends one.
+        if (!filter->pending_eos && (archive->range_eos || (eos && !archive->range_end))) {
+                filter->pending_eos = eos ? gst_event_ref (eos) : gst_event_new_eos ();
+        }
+        GST_OBJECT_UNLOCK(filter);
+
+        if (eos) {
+                gst_event_unref (eos);
+        }
 }
 
-static void input_queue_append_buffer (GstGzDec *filter, GstBuffer* buf) {
+static gboolean zip_archive_digest_buffer (void* w, GstBuffer* buf) {
+        ZipArchive* archive = ZIP_ARCHIVE(w);
+        GstGzDec* filter = GST_GZDEC(archive->user_data);
+        GError* error = NULL;
+
+        if (!archive->started) {
+                archive->started = TRUE;
+                archive->seeking = zip_archive_seekable (filter, archive);
+                if (archive->seeking) {
+                        zip_archive_extract_seeking (filter, archive);
+                } else if (zip_archive_spool_open (archive, &error)) {
+                        GST_INFO_OBJECT (filter, "Upstream can't seek, spooling the zip archive until EOS");
+                } else {
+                        GST_ELEMENT_ERROR (filter, RESOURCE, OPEN_WRITE, ("Failed to spool the zip archive"), ("%s", error->message));
+                        g_error_free (error);
+                }
+        }
+
+        // extracted already, what upstream sent before it stopped is dropped
+        if (archive->seeking) {
+                return TRUE;
+        }
+        if (archive->spool_fd < 0) {
+                return FALSE;
+        }
+        if (!buffer_foreach_chunk (buf, zip_archive_spool_write, archive)) {
+                GST_ELEMENT_ERROR (filter, RESOURCE, WRITE, ("Failed to spool the zip archive"), (NULL));
+                close (archive->spool_fd);
+                archive->spool_fd = -1;
+                return FALSE;
+        }
+        return TRUE;
+}
+
+// EOS, a spooled archive is complete now
+static void zip_archive_finish (GstGzDec* filter) {
+        ZipArchive* archive;
+        GError* error = NULL;
+
+        if (filter->stream_type != PKZIP || !filter->decoder) {
+                return;
+        }
+        archive = ZIP_ARCHIVE(filter->decoder);
+
+        if (archive->spool_fd >= 0) {
+                if (zip_archive_spool_map (archive, &error)) {
+                        zip_archive_extract (filter, archive, g_mapped_file_get_length (archive->spool));
+                } else {
+                        GST_ELEMENT_ERROR (filter, RESOURCE, READ, ("Failed to map the spooled zip archive"), ("%s", error->message));
+                        g_error_free (error);
+                }
+        }
+
+        // the next stream starts a new archive
+        zip_archive_reset (archive);
+        GST_OBJECT_LOCK(filter);
+        filter->zip_done = FALSE;
+        filter->cache_hit = FALSE;
+        GST_OBJECT_UNLOCK(filter);
+}
+
+// Seek mode of the zip archive. The flushes and segments upstream sends for the input task's
+// seeks don't go downstream, the EOS at the end of a range is queued for the input task.
+// Returns whether the event was taken.
+static gboolean zip_seeking_event (GstGzDec* filter, GstEvent* event) {
+        gpointer data;
+
+        switch (GST_EVENT_TYPE (event)) {
+        case GST_EVENT_FLUSH_START:
+        case GST_EVENT_FLUSH_STOP:
+        case GST_EVENT_SEGMENT:
+        case GST_EVENT_EOS:
+                break;
+        default:
+                return FALSE;
+        }
+
         INPUT_QUEUE_LOCK(filter);
-        GST_TRACE_OBJECT (filter, "Appending data to input buffer");
-        g_queue_push_tail (filter->input_queue, buf);
-        GST_TRACE_OBJECT(filter, "Input queue length after append: %d", (int) g_queue_get_length (filter->input_queue));
-        INPUT_QUEUE_SIGNAL(filter);
+        if (!filter->zip_seeking) {
+                INPUT_QUEUE_UNLOCK(filter);
+                return FALSE;
+        }
+        GST_DEBUG_OBJECT (filter, "Zip archive range %" GST_PTR_FORMAT, event);
+        if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+                // what was queued of the range before
+                while ((data = g_queue_pop_head (filter->input_queue))) {
+                        if (!GST_IS_EVENT(data)) {
+                                filter->input_queue_bytes -= BUFFER_SIZE(GST_BUFFER(data));
+                        }
+                        gst_mini_object_unref (data);
+                }
+        }
+        if (GST_EVENT_TYPE (event) == GST_EVENT_EOS) {
+                g_queue_push_tail (filter->input_queue, event);
+                INPUT_QUEUE_SIGNAL(filter);
+        } else {
+                gst_event_unref (event);
+        }
+        INPUT_QUEUE_UNLOCK(filter);
+        return TRUE;
+}
+
+static void zip_pool_free (GstGzDec* filter) {
+        if (filter->zip_pool) {
+                g_thread_pool_free (filter->zip_pool, FALSE, TRUE);
+                filter->zip_pool = NULL;
+        }
+}
+
+/*
+   Cache of decompressed streams (see gstgzdec_cache.h). The key is taken from the input
+   file before decoding starts, so only streams upstream reads from a local file are cached.
+   On a hit the entry stands in for the decoder and upstream is
+   stopped after its first buffer, like in zip mode. On a miss the output is written to a new
+   entry as it is decoded, which is committed at EOS if the stream ended properly.
+ */
+
+static gint cache_compare_ids (gconstpointer a, gconstpointer b) {
+        guint ia = GPOINTER_TO_UINT(a);
+        guint ib = GPOINTER_TO_UINT(b);
+        return ia < ib ? -1 : ia > ib;
+}
+
+// What the decompressed bytes depend on besides the compressed stream, call with the object lock held.
+// Damaged streams are never cached, so recover does not matter.
+static gchar* cache_params (GstGzDec* filter, GstGzDecFormat format) {
+        GString* params = g_string_new (NULL);
+        GList* ids = NULL;
+        GList* id;
+
+        g_string_append_printf (params, "format=%d verify=%d dictionaries=", (int) format, (int) filter->verify);
+        if (filter->dictionaries) {
+                ids = g_list_sort (g_hash_table_get_keys (filter->dictionaries), cache_compare_ids);
+        }
+        for (id = ids; id; id = id->next) {
+                g_string_append_printf (params, "%08x,", GPOINTER_TO_UINT(id->data));
+        }
+        g_list_free (ids);
+        return g_string_free (params, FALSE);
+}
+
+// A hit, the whole stream goes out on the first buffer, what upstream sent before it stopped is dropped
+static gboolean cache_entry_digest_buffer (void* w, GstBuffer* buf) {
+        CacheEntry* entry = CACHE_ENTRY(w);
+        GstGzDec* filter = GST_GZDEC(entry->user_data);
+        const guchar* data = (const guchar*) g_mapped_file_get_contents (entry->file);
+        gsize size = g_mapped_file_get_length (entry->file);
+        gsize pos, n;
+
+        if (entry->served) {
+                return TRUE;
+        }
+        entry->served = TRUE;
+
+        // the whole compressed stream is accounted for, for the ratio limit and the duration
+        INPUT_QUEUE_LOCK(filter);
+        filter->bytes_in = entry->input_size;
         INPUT_QUEUE_UNLOCK(filter);
+
+        // goes through the writer like decoded data: limits, seek window, checksums, tar and split apply
+        for (pos = 0; pos < size; pos += n) {
+                n = MIN(size - pos, CACHE_CHUNK_SIZE);
+                if (!stream_writer_func (filter, (gpointer) (data + pos), n)) {
+                        return FALSE;
+                }
+        }
+        return TRUE;
+}
+
+// Returns TRUE on a hit, the entry is then the decoder
+static gboolean cache_setup (GstGzDec* filter, GstGzDecFormat format) {
+        gchar* dir;
+        guint64 max_bytes;
+        gchar* params;
+        gchar* path = NULL;
+        gchar* key;
+        GStatBuf st;
+        GMappedFile* input;
+        GMappedFile* entry;
+        GError* error = NULL;
+        gboolean hit = FALSE;
+
+        // rebuilt in between two streams of a multi-member input (low-memory mode), the entry goes on
+        if (filter->cache_writer || format == GST_GZDEC_FORMAT_AUTO || format == GST_GZDEC_FORMAT_ZIP) {
+                return FALSE;
+        }
+        // a hit would skip the very decoding to be checked
+        if (filter->validate_mode) {
+                return FALSE;
+        }
+
+        GST_OBJECT_LOCK(filter);
+        dir = g_strdup (filter->cache_dir);
+        max_bytes = filter->cache_max_bytes;
+        params = dir ? cache_params (filter, format) : NULL;
+        GST_OBJECT_UNLOCK(filter);
+
+        if (!dir) {
+                return FALSE;
+        }
+
+        path = upstream_file_path (filter);
+        if (!path) {
+                GST_INFO_OBJECT (filter, "Upstream is not a local file, not caching");
+                goto done;
+        }
+        if (g_stat (path, &st) != 0) {
+                GST_WARNING_OBJECT (filter, "Failed to stat %s (%s), not caching", path, g_strerror (errno));
+                goto done;
+        }
+        input = g_mapped_file_new (path, FALSE, &error);
+        if (!input) {
+                GST_WARNING_OBJECT (filter, "Failed to map %s (%s), not caching", path, error->message);
+                g_error_free (error);
+                goto done;
+        }
+        // the key is taken over the file as it was seen in between
+        if ((guint64) st.st_size != g_mapped_file_get_length (input)) {
+                GST_WARNING_OBJECT (filter, "%s changed while opening it, not caching", path);
+                g_mapped_file_unref (input);
+                goto done;
+        }
+
+        key = cache_key (params, &st, (const guchar*) g_mapped_file_get_contents (input), g_mapped_file_get_length (input));
+        entry = cache_lookup (dir, key);
+        if (entry) {
+                GST_INFO_OBJECT (filter, "Cache hit for %s (%s)", path, key);
+                hit = TRUE;
+                filter->stream_type = CACHED;
+                filter->decoder = cache_entry_new (filter, entry, g_mapped_file_get_length (input));
+                filter->decode_func = cache_entry_digest_buffer;
+                GST_OBJECT_LOCK(filter);
+                // the size is known up front
+                filter->isize = g_mapped_file_get_length (entry);
+                filter->cache_hit = TRUE;
+                GST_OBJECT_UNLOCK(filter);
+        } else {
+                GST_INFO_OBJECT (filter, "Cache miss for %s (%s), caching the output", path, key);
+                filter->cache_writer = cache_writer_new (dir, key, max_bytes);
+        }
+        g_free (key);
+        g_mapped_file_unref (input);
+
+done:
+        g_free (path);
+        g_free (params);
+        g_free (dir);
+        return hit;
+}
+
+static void cache_abort (GstGzDec* filter) {
+        if (filter->cache_writer) {
+                cache_writer_abort (CACHE_WRITER(filter->cache_writer));
+                filter->cache_writer = NULL;
+        }
+}
+
+// EOS, the new entry is complete unless decoding stopped short. The next stream is looked up anew.
+static void cache_finish (GstGzDec* filter) {
+        gboolean stopped;
+
+        GST_OBJECT_LOCK(filter);
+        stopped = filter->limit_exceeded || filter->range_done;
+        filter->cache_hit = FALSE;
+        GST_OBJECT_UNLOCK(filter);
+
+        if (filter->cache_writer) {
+                if (stopped || (filter->decoder && !decoder_at_stream_end (filter))) {
+                        GST_INFO_OBJECT (filter, "Stream did not end properly, not caching it");
+                        cache_abort (filter);
+                } else {
+                        cache_writer_commit (CACHE_WRITER(filter->cache_writer));
+                        filter->cache_writer = NULL;
+                }
+        } else if (filter->stream_type != CACHED) {
+                return;
+        }
+
+        if (filter->decoder) {
+                park_decoder (filter);
+        }
 }
 
 static void output_queue_append_data (GstGzDec *filter, gpointer data, gsize bytes) {
 
-        GstBuffer* buf = BUFFER_ALLOC(bytes);
-        BUFFER_SET_DATA(buf, data, bytes);
+        if (bytes == 0) {
+                return;
+        }
 
-        GST_TRACE_OBJECT (filter, "Queueing new output buffer: %" GST_PTR_FORMAT, buf);
+        if (filter->tar_parser) {
+                tar_feed (filter, data, bytes);
+                return;
+        }
 
+        output_queue_append_chunk (filter, data, bytes);
+}
+
+// Decompressed size: exact at EOS or from the gzip trailer,
+// otherwise extrapolated from the upstream size with the ratio observed so far.
+static gboolean query_duration_bytes (GstGzDec* filter, gint64* duration) {
+        guint64 bytes_in, bytes_out;
+        gint64 upstream_size;
+        gint64 isize;
+        gboolean eos;
+
+        INPUT_QUEUE_LOCK(filter);
+        bytes_in = filter->bytes_in;
+        INPUT_QUEUE_UNLOCK(filter);
         OUTPUT_QUEUE_LOCK(filter);
-        g_queue_push_tail (filter->output_queue, buf);
-        OUTPUT_QUEUE_SIGNAL(filter);
+        bytes_out = filter->bytes_out;
+        OUTPUT_QUEUE_UNLOCK(filter);
+        GST_OBJECT_LOCK(filter);
+        eos = filter->eos;
+        isize = filter->isize;
+        GST_OBJECT_UNLOCK(filter);
+
+        if (eos) {
+                *duration = bytes_out;
+                return TRUE;
+        }
+
+        if (isize >= 0) {
+                *duration = isize;
+                return TRUE;
+        }
+
+        if (bytes_in == 0 || bytes_out == 0
+            || !gst_pad_peer_query_duration (filter->sinkpad, GST_FORMAT_BYTES, &upstream_size)
+            || upstream_size <= 0) {
+                return FALSE;
+        }
+
+        *duration = gst_util_uint64_scale (upstream_size, bytes_out, bytes_in);
+        GST_LOG_OBJECT (filter, "Estimated duration %" G_GINT64_FORMAT " from ratio %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT,
+                        *duration, bytes_out, bytes_in);
+        return TRUE;
+}
+
+static gboolean query_position_bytes (GstGzDec* filter, gint64* position) {
+        OUTPUT_QUEUE_LOCK(filter);
+        *position = filter->bytes_pushed;
         OUTPUT_QUEUE_UNLOCK(filter);
+        return TRUE;
+}
+
+// Tar and zip output is a sequence of entries, not one decompressed stream to seek in
+static gboolean archive_mode (GstGzDec* filter) {
+        gboolean archive;
+
+        GST_OBJECT_LOCK(filter);
+        archive = filter->tar || filter->format == GST_GZDEC_FORMAT_ZIP
+                  || filter->caps_format == GST_GZDEC_FORMAT_ZIP;
+        GST_OBJECT_UNLOCK(filter);
+        return archive;
+}
+
+// Seekable when upstream can go back to its start, see srcpad_seek_bytes
+static gboolean query_seeking_bytes (GstGzDec* filter, GstQuery* query) {
+        GstQuery* upstream = gst_query_new_seeking (GST_FORMAT_BYTES);
+        gboolean seekable = FALSE;
+        gint64 duration;
+
+        if (gst_pad_peer_query (filter->sinkpad, upstream)) {
+                gst_query_parse_seeking (upstream, NULL, &seekable, NULL, NULL);
+        }
+        gst_query_unref (upstream);
+
+        if (!query_duration_bytes (filter, &duration)) {
+                duration = -1;
+        }
+        gst_query_set_seeking (query, GST_FORMAT_BYTES, seekable && !archive_mode (filter), 0, duration);
+        return TRUE;
+}
+
+/*
+   BYTES seeks in the decompressed stream. It can only be produced from its beginning,
+   so upstream is rewound with a flushing seek to its start and the window is cut out
+   of the output by range_clip. Only flushing seeks forward at normal rate are supported.
+ */
+static gboolean srcpad_seek_bytes (GstGzDec* filter, GstEvent* event) {
+        gdouble rate;
+        GstFormat format;
+        GstSeekFlags flags;
+        GstSeekType start_type, stop_type;
+        gint64 start, stop;
+        guint64 old_start, old_stop;
+        GstEvent* rewind;
+
+        gst_event_parse_seek (event, &rate, &format, &flags, &start_type, &start, &stop_type, &stop);
+
+        if (format != GST_FORMAT_BYTES || rate != 1.0 || !(flags & GST_SEEK_FLAG_FLUSH)
+            || start_type == GST_SEEK_TYPE_END || stop_type == GST_SEEK_TYPE_END
+            || archive_mode (filter)) {
+                GST_DEBUG_OBJECT (filter, "Unsupported seek: %" GST_PTR_FORMAT, event);
+                return FALSE;
+        }
+
+        if (start_type != GST_SEEK_TYPE_SET || start < 0) {
+                start = 0;
+        }
+        if (stop_type != GST_SEEK_TYPE_SET || stop < 0) {
+                stop = -1;
+        }
+        if (stop != -1 && stop < start) {
+                GST_DEBUG_OBJECT (filter, "Seek stop before start: %" GST_PTR_FORMAT, event);
+                return FALSE;
+        }
+
+        GST_INFO_OBJECT (filter, "Seeking to bytes %" G_GINT64_FORMAT " - %" G_GINT64_FORMAT, start, stop);
+
+        // before the rewind, upstream starts pushing again from within the seek
+        GST_OBJECT_LOCK(filter);
+        old_start = filter->range_start;
+        old_stop = filter->range_stop;
+        filter->range_start = start;
+        filter->range_stop = stop;
+        GST_OBJECT_UNLOCK(filter);
+
+        rewind = gst_event_new_seek (1.0, GST_FORMAT_BYTES, GST_SEEK_FLAG_FLUSH,
+                                     GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_NONE, -1);
+        gst_event_set_seqnum (rewind, gst_event_get_seqnum (event));
+        if (gst_pad_push_event (filter->sinkpad, rewind)) {
+                return TRUE;
+        }
+
+        GST_WARNING_OBJECT (filter, "Upstream can't seek back to the start of the stream");
+        GST_OBJECT_LOCK(filter);
+        filter->range_start = old_start;
+        filter->range_stop = old_stop;
+        GST_OBJECT_UNLOCK(filter);
+        return FALSE;
+}
+
+// With a seek window the segment is the window in the decompressed stream
+static GstEvent* range_segment (GstGzDec* filter, GstEvent* event) {
+        GstSegment segment;
+        GstEvent* ranged;
+        guint64 start, stop;
+
+        GST_OBJECT_LOCK(filter);
+        start = filter->range_start;
+        stop = filter->range_stop;
+        GST_OBJECT_UNLOCK(filter);
+
+        if (!start && stop == (guint64) -1) {
+                return event;
+        }
+
+        gst_segment_init (&segment, GST_FORMAT_BYTES);
+        segment.start = segment.position = segment.time = start;
+        segment.stop = stop;
+        ranged = gst_event_new_segment (&segment);
+        gst_event_set_seqnum (ranged, gst_event_get_seqnum (event));
+        gst_event_unref (event);
+        return ranged;
+}
+
+// FLUSH_START, downstream is flushing already so the srcpad task can't be stuck pushing
+static void flush_pause_tasks (GstGzDec* filter) {
+        if (filter->srcpad_task) {
+                SRCPAD_TASK_PAUSE(filter);
+                output_queue_unblock(filter);
+        }
+        if (filter->input_task) {
+                INPUT_TASK_PAUSE(filter);
+        }
 }
 
+// FLUSH_STOP, with the tasks paused. Everything queued is dropped and decoding starts
+// over with the next data, upstream sends the stream from its start again after a seek.
+static void flush_reset (GstGzDec* filter) {
+        gpointer data;
+
+        INPUT_QUEUE_LOCK(filter);
+        while ((data = g_queue_pop_head (filter->input_queue))) {
+                gst_mini_object_unref (data);
+        }
+        filter->input_queue_bytes = 0;
+        filter->input_overrun = FALSE;
+        filter->bytes_in = 0;
+        INPUT_QUEUE_UNLOCK(filter);
+
+        OUTPUT_QUEUE_LOCK(filter);
+        while ((data = g_queue_pop_head (filter->output_queue))) {
+                gst_mini_object_unref (data);
+        }
+        filter->bytes_out = filter->bytes_pushed = 0;
+        filter->discont = FALSE;
+        filter->output_overrun = FALSE;
+        filter->buffering = TRUE;
+        filter->buffering_percent = -1;
+        OUTPUT_QUEUE_UNLOCK(filter);
+
+        while ((data = g_queue_pop_head (filter->stream_start_queue))) {
+                gst_mini_object_unref (data);
+        }
+        filter->stream_start_fill = filter->stream_start[0] = filter->stream_start[1] = 0;
+        filter->passthrough = filter->unsupported = FALSE;
+        filter->limit_bytes_in = filter->limit_bytes_out = 0;
+
+        cache_abort (filter);
+        if (filter->decoder) {
+                park_decoder (filter);
+        }
+        filter->decode_func = NULL;
+        filter->switch_format = GST_GZDEC_FORMAT_AUTO;
+        filter->switch_fill = 0;
+        if (filter->tar_parser) {
+                tar_parser_reset (TAR_PARSER(filter->tar_parser));
+        }
+        g_byte_array_set_size (filter->split_tail, 0);
+        filter->sparse_position = filter->sparse_run = 0;
+        filter->validate_complete = FALSE;
+        filter->validate_corrupt_entries = 0;
+        if (filter->checksum_state) {
+                checksum_state_free (CHECKSUM_STATE(filter->checksum_state));
+                filter->checksum_state = NULL;
+        }
+        filter->range_position = 0;
+        srcpad_typefind_clear (filter);
+
+        GST_OBJECT_LOCK(filter);
+        filter->eos = FALSE;
+        gst_event_replace (&filter->pending_eos, NULL);
+        filter->limit_exceeded = FALSE;
+        filter->range_done = FALSE;
+        filter->zip_done = FALSE;
+        GST_OBJECT_UNLOCK(filter);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+/* Sparse output for disk and VM images, which are mostly zeros. The decompressed data is
+   scanned in blocks aligned to the stream, and runs of zero blocks of at least the threshold
+   go out as GST_BUFFER_FLAG_GAP buffers instead of copies. Their memory is a static region of
+   zeros shared by all of them, so nothing is written or touched for a gap; a sparse aware
+   sink can seek over it (or punch a hole) using the buffer offsets, any other sink still
+   reads zeros. Shorter runs go out with the data that follows them. */
+
+#define SPARSE_BLOCK_SIZE 4096
+#define SPARSE_DEFAULT_THRESHOLD (64 * 1024)
+// size of the shared zeros, gaps beyond it are pushed in several buffers
+#define SPARSE_ZERO_SIZE (1024 * 1024)
+// words OR'ed together between the checks, a cache line
+#define SPARSE_LINE_WORDS 8
+
+// In .bss, its pages are only ever read: they all map the same zero page
+static guint8 sparse_zero_memory[SPARSE_ZERO_SIZE];
+
+// The inner loop has no branch, so the compiler vectorizes it
+static gboolean sparse_is_zero(const guint8* data, gsize size) {
+        const guint64* words;
+        guint64 acc = 0;
+        gsize i, j, n;
+
+        while (size && ((guintptr) data & (sizeof(guint64) - 1))) {
+                acc |= *data++;
+                size--;
+        }
+
+        words = (const guint64*) data;
+        n = size / sizeof(guint64);
+        for (i = 0; i + SPARSE_LINE_WORDS <= n; i += SPARSE_LINE_WORDS) {
+                for (j = 0; j < SPARSE_LINE_WORDS; j++) {
+                        acc |= words[i + j];
+                }
+                if (acc) {
+                        return FALSE;
+                }
+        }
+        for (; i < n; i++) {
+                acc |= words[i];
+        }
+
+        data += n * sizeof(guint64);
+        size -= n * sizeof(guint64);
+        while (size--) {
+                acc |= *data++;
+        }
+        return !acc;
+}
+
+// Up to the next block boundary of the stream
+static gsize sparse_block_size(guint64 position, gsize available) {
+        return MIN(available, SPARSE_BLOCK_SIZE - position % SPARSE_BLOCK_SIZE);
+}
+
+static GstBuffer* sparse_gap_buffer_new(gsize size) {
+        GstBuffer* buf = BUFFER_NEW_WRAPPED_STATIC(sparse_zero_memory, size);
+        GST_BUFFER_FLAG_SET(buf, GST_BUFFER_FLAG_GAP);
+        return buf;
+}
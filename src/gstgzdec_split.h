@@ -0,0 +1,69 @@
+#pragma once
+
+/* Finds record boundaries in the decompressed data, so that pushed buffers hold whole
+   records (lines, NDJSON documents, fixed size records) and downstream can parse each one
+   on its own. Only the end of each chunk is searched: the last delimiter is what counts,
+   so memrchr (a vectorized scan in glibc) stops after the last, partial record. */
+
+#define SPLIT_DEFAULT_DELIMITER "\\n"
+#define SPLIT_DEFAULT_RECORD_SIZE 4096
+// A record without a delimiter in this much data goes out as it is
+#define SPLIT_DEFAULT_MAX_RECORD_SIZE (16 * 1024 * 1024)
+
+static const guchar* split_memrchr(const guchar* data, guchar c, gsize size) {
+#ifdef HAVE_MEMRCHR
+        return memrchr(data, c, size);
+#else
+        while (size--) {
+                if (data[size] == c) {
+                        return data + size;
+                }
+        }
+        return NULL;
+#endif
+}
+
+// The delimiter might have started in the data held back from before
+static gboolean split_delimiter_ends_at(const guchar* tail, gsize tail_size,
+                                        const guchar* data, gsize end,
+                                        const guchar* delimiter, gsize delimiter_size) {
+        gsize i;
+        guchar c;
+
+        for (i = 1; i < delimiter_size; i++) {
+                if (end >= i) {
+                        c = data[end - i];
+                } else if (tail_size >= i - end) {
+                        c = tail[tail_size - (i - end)];
+                } else {
+                        return FALSE;
+                }
+                if (c != delimiter[delimiter_size - 1 - i]) {
+                        return FALSE;
+                }
+        }
+        return TRUE;
+}
+
+// Returns how much of data goes out with the tail, up to and including the last delimiter, 0 for none
+static gsize split_find_delimiter(const guchar* tail, gsize tail_size,
+                                  const guchar* data, gsize size,
+                                  const guchar* delimiter, gsize delimiter_size) {
+        guchar last = delimiter[delimiter_size - 1];
+        const guchar* p;
+
+        while (size && (p = split_memrchr(data, last, size))) {
+                size = p - data;
+                if (split_delimiter_ends_at(tail, tail_size, data, size, delimiter, delimiter_size)) {
+                        return size + 1;
+                }
+        }
+        return 0;
+}
+
+// Same for fixed size records, the tail is always shorter than one record
+static gsize split_find_record(gsize tail_size, gsize size, gsize record_size) {
+        gsize total = tail_size + size;
+        gsize aligned = total - total % record_size;
+        return aligned > tail_size ? aligned - tail_size : 0;
+}
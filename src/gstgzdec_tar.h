@@ -0,0 +1,333 @@
+#pragma once
+
+/* Splits a tar archive (ustar, pax and the GNU long name extension) coming out of the
+   decoder into entries. Only regular files are handed on: the header to the entry
+   function, which decides whether the entry is wanted, then the data of wanted entries
+   as it comes in, without copying it. Everything else is stepped over. */
+
+#define TAR_BLOCK_SIZE 512
+// pax and GNU long name data beyond this is stepped over, the size comes from the header
+#define TAR_META_MAX_SIZE (1024 * 1024)
+
+// Custom downstream event announcing the entry whose data follows
+#define TAR_ENTRY_EVENT_NAME "gzdec-tar-entry"
+
+#define TAR_PARSER(ptr) ((TarParser*)ptr)
+typedef struct _TarParser TarParser;
+typedef struct _TarEntry TarEntry;
+
+struct _TarEntry {
+        gchar* name;
+        guint64 size;
+        guint mode;
+        guint64 mtime;
+};
+
+// returns whether the entry data should be passed on
+typedef gboolean (*TarEntryFunc)(gpointer user_data, const TarEntry* entry);
+typedef void (*TarDataFunc)(gpointer user_data, gconstpointer data, gsize bytes);
+typedef void (*TarEntryEndFunc)(gpointer user_data);
+
+typedef enum {
+        TAR_HEADER,
+        // data of a regular file
+        TAR_DATA,
+        // pax extended header or GNU long name, collected for the next entry
+        TAR_META,
+        // data we step over, and the padding to the next block
+        TAR_SKIP,
+        TAR_END,
+        TAR_FAILED
+} TarParserState;
+
+struct _TarParser {
+        gpointer user_data;
+        TarEntryFunc entry_func;
+        TarDataFunc data_func;
+        TarEntryEndFunc entry_end_func;
+
+        TarParserState state;
+        guchar header[TAR_BLOCK_SIZE];
+        gsize header_fill;
+        guint64 remaining;
+        guint64 padding;
+        gboolean wanted;
+
+        // pax/GNU data and what it says about the next entry
+        GByteArray* meta;
+        gchar meta_type;
+        gboolean meta_oversized;
+        gchar* next_name;
+        guint64 next_size;
+        gboolean next_size_set;
+};
+
+static TarParser* tar_parser_new(gpointer user_data, TarEntryFunc entry_func,
+                                 TarDataFunc data_func, TarEntryEndFunc entry_end_func) {
+        TarParser* parser = g_new0(TarParser, 1);
+        parser->user_data = user_data;
+        parser->entry_func = entry_func;
+        parser->data_func = data_func;
+        parser->entry_end_func = entry_end_func;
+        parser->state = TAR_HEADER;
+        parser->meta = g_byte_array_new();
+        return parser;
+}
+
+static void tar_parser_free(TarParser* parser) {
+        g_byte_array_unref(parser->meta);
+        g_free(parser->next_name);
+        g_free(parser);
+}
+
+// Numeric fields are octal, NUL or space terminated, or base-256 for large values (GNU)
+static guint64 tar_parse_number(const guchar* field, gsize size) {
+        guint64 value = 0;
+        gsize i;
+
+        if (field[0] & 0x80) {
+                value = field[0] & 0x7f;
+                for (i = 1; i < size; i++) {
+                        value = (value << 8) | field[i];
+                }
+                return value;
+        }
+
+        for (i = 0; i < size && field[i] == ' '; i++);
+        for (; i < size && field[i] >= '0' && field[i] <= '7'; i++) {
+                value = (value << 3) | (field[i] - '0');
+        }
+        return value;
+}
+
+static gboolean tar_header_is_zero(const guchar* header) {
+        gsize i;
+        for (i = 0; i < TAR_BLOCK_SIZE; i++) {
+                if (header[i]) {
+                        return FALSE;
+                }
+        }
+        return TRUE;
+}
+
+// The checksum field itself counts as spaces
+static gboolean tar_header_checksum_ok(const guchar* header) {
+        guint64 stored = tar_parse_number(header + 148, 8);
+        guint64 sum = 0;
+        gsize i;
+
+        for (i = 0; i < TAR_BLOCK_SIZE; i++) {
+                sum += (i >= 148 && i < 156) ? ' ' : header[i];
+        }
+        return sum == stored;
+}
+
+static gchar* tar_header_name(const guchar* header) {
+        gchar* name = g_strndup((const gchar*) header, 100);
+        gchar* prefix;
+        gchar* path;
+
+        // ustar splits long paths into prefix and name
+        if (memcmp(header + 257, "ustar", 5) == 0 && header[345]) {
+                prefix = g_strndup((const gchar*) header + 345, 155);
+                path = g_strconcat(prefix, "/", name, NULL);
+                g_free(prefix);
+                g_free(name);
+                return path;
+        }
+        return name;
+}
+
+// pax records are "<length> <key>=<value>\n", we only care about the path and the size
+static void tar_parse_pax(TarParser* parser) {
+        const gchar* data = (const gchar*) parser->meta->data;
+        gsize size = parser->meta->len;
+        gsize pos = 0;
+        guint64 length;
+        gchar* end;
+        const gchar* key;
+        const gchar* eq;
+
+        // so that the number parsing stops at the end
+        g_byte_array_append(parser->meta, (const guint8*) "", 1);
+        data = (const gchar*) parser->meta->data;
+
+        while (pos < size) {
+                length = g_ascii_strtoull(data + pos, &end, 10);
+                if (!length || pos + length > size || *end != ' ') {
+                        GST_WARNING("Malformed pax record");
+                        return;
+                }
+                key = end + 1;
+                eq = memchr(key, '=', data + pos + length - key);
+                if (eq) {
+                        gsize value_size = data + pos + length - 1 - (eq + 1);
+                        if (eq - key == 4 && memcmp(key, "path", 4) == 0) {
+                                g_free(parser->next_name);
+                                parser->next_name = g_strndup(eq + 1, value_size);
+                        } else if (eq - key == 4 && memcmp(key, "size", 4) == 0) {
+                                gchar* value = g_strndup(eq + 1, value_size);
+                                parser->next_size = g_ascii_strtoull(value, NULL, 10);
+                                parser->next_size_set = TRUE;
+                                g_free(value);
+                        }
+                }
+                pos += length;
+        }
+}
+
+static void tar_meta_done(TarParser* parser) {
+        if (parser->meta_oversized) {
+                GST_WARNING("Ignoring tar meta data of type '%c' larger than %d bytes", parser->meta_type, TAR_META_MAX_SIZE);
+        } else if (parser->meta_type == 'x') {
+                tar_parse_pax(parser);
+        } else if (parser->meta_type == 'L') {
+                g_free(parser->next_name);
+                parser->next_name = g_strndup((const gchar*) parser->meta->data, parser->meta->len);
+        }
+        g_byte_array_set_size(parser->meta, 0);
+        parser->meta_oversized = FALSE;
+}
+
+static void tar_parse_header(TarParser* parser) {
+        const guchar* header = parser->header;
+        gchar type = header[156];
+        TarEntry entry;
+
+        if (tar_header_is_zero(header)) {
+                if (parser->state != TAR_END) {
+                        GST_DEBUG("End of archive");
+                }
+                parser->state = TAR_END;
+                return;
+        }
+
+        if (!tar_header_checksum_ok(header)) {
+                // concatenated archives go on after the end blocks, anything else is ignored
+                if (parser->state == TAR_END) {
+                        GST_DEBUG("Ignoring trailing data after end of archive");
+                        return;
+                }
+                GST_ERROR("Bad tar header checksum, not a tar archive or corrupt");
+                parser->state = TAR_FAILED;
+                return;
+        }
+
+        entry.size = tar_parse_number(header + 124, 12);
+        if (parser->next_size_set) {
+                entry.size = parser->next_size;
+        }
+        parser->remaining = entry.size;
+        parser->padding = (TAR_BLOCK_SIZE - entry.size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+
+        switch (type) {
+        case 'x':
+        case 'L':
+                parser->meta_type = type;
+                parser->state = TAR_META;
+                return;
+        case '0':
+        case '\0':
+        case '7':
+                break;
+        default:
+                // directories, links, devices, global pax headers and the like
+                GST_DEBUG("Stepping over tar entry of type '%c'", type ? type : '0');
+                parser->state = TAR_SKIP;
+                goto done;
+        }
+
+        entry.name = parser->next_name ? parser->next_name : tar_header_name(header);
+        parser->next_name = NULL;
+        entry.mode = (guint) tar_parse_number(header + 100, 8);
+        entry.mtime = tar_parse_number(header + 136, 12);
+
+        GST_DEBUG("Tar entry %s (%" G_GUINT64_FORMAT " bytes)", entry.name, entry.size);
+
+        parser->wanted = parser->entry_func(parser->user_data, &entry);
+        parser->state = parser->wanted ? TAR_DATA : TAR_SKIP;
+        g_free(entry.name);
+
+done:
+        g_free(parser->next_name);
+        parser->next_name = NULL;
+        parser->next_size_set = FALSE;
+}
+
+static void tar_parser_feed(TarParser* parser, const guchar* data, gsize bytes) {
+        gsize n;
+
+        while (bytes) {
+                switch (parser->state) {
+                case TAR_HEADER:
+                case TAR_END:
+                        n = MIN(bytes, TAR_BLOCK_SIZE - parser->header_fill);
+                        memcpy(parser->header + parser->header_fill, data, n);
+                        parser->header_fill += n;
+                        if (parser->header_fill == TAR_BLOCK_SIZE) {
+                                parser->header_fill = 0;
+                                tar_parse_header(parser);
+                        }
+                        break;
+                case TAR_DATA:
+                case TAR_META:
+                case TAR_SKIP:
+                        n = (gsize) MIN((guint64) bytes, parser->remaining);
+                        if (n) {
+                                if (parser->state == TAR_DATA) {
+                                        parser->data_func(parser->user_data, data, n);
+                                } else if (parser->state == TAR_META && !parser->meta_oversized) {
+                                        if (parser->meta->len + n > TAR_META_MAX_SIZE) {
+                                                parser->meta_oversized = TRUE;
+                                                g_byte_array_set_size(parser->meta, 0);
+                                        } else {
+                                                g_byte_array_append(parser->meta, data, n);
+                                        }
+                                }
+                                parser->remaining -= n;
+                                break;
+                        }
+                        // on to the padding
+                        if (parser->state == TAR_DATA) {
+                                parser->entry_end_func(parser->user_data);
+                        } else if (parser->state == TAR_META) {
+                                tar_meta_done(parser);
+                        }
+                        parser->state = TAR_SKIP;
+                        parser->remaining = parser->padding;
+                        parser->padding = 0;
+                        if (!parser->remaining) {
+                                parser->state = TAR_HEADER;
+                        }
+                        n = 0;
+                        break;
+                case TAR_FAILED:
+                        return;
+                }
+                data += n;
+                bytes -= n;
+        }
+}
+
+// Returns FALSE when the input ended in the middle of an entry.
+// An entry ending right with the input (without its padding) still needs its end signaled.
+static gboolean tar_parser_finish(TarParser* parser) {
+        if (parser->state == TAR_DATA && !parser->remaining) {
+                parser->entry_end_func(parser->user_data);
+                parser->state = TAR_HEADER;
+        }
+        return parser->state == TAR_FAILED || parser->state == TAR_END
+               || (parser->state == TAR_HEADER && !parser->header_fill);
+}
+
+// Ready for the next archive
+static void tar_parser_reset(TarParser* parser) {
+        parser->state = TAR_HEADER;
+        parser->header_fill = 0;
+        parser->remaining = parser->padding = 0;
+        g_byte_array_set_size(parser->meta, 0);
+        parser->meta_oversized = FALSE;
+        g_free(parser->next_name);
+        parser->next_name = NULL;
+        parser->next_size_set = FALSE;
+}
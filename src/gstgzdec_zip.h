@@ -0,0 +1,374 @@
+#pragma once
+
+/* Reads the central directory of a PKZIP archive (with the Zip64 extensions). It gives
+   every entry's offset and sizes, so entries can be decoded on their own, in any order,
+   without going through the rest of the archive. Entry data is stored, deflated or bzip2.
+
+   The parsers only see the parts of the archive they need: the tail with the end of central
+   directory record, the Zip64 record it points to, the central directory and local headers. */
+
+#include <errno.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATE 8
+#define ZIP_METHOD_BZIP2 12
+
+#define ZIP_FLAG_ENCRYPTED (1 << 0)
+
+#define ZIP_EOCD_SIGNATURE 0x06054b50
+#define ZIP_EOCD_SIZE 22
+#define ZIP64_EOCD_LOCATOR_SIGNATURE 0x07064b50
+#define ZIP64_EOCD_LOCATOR_SIZE 20
+#define ZIP64_EOCD_SIGNATURE 0x06064b50
+#define ZIP64_EOCD_SIZE 56
+#define ZIP_CENTRAL_SIGNATURE 0x02014b50
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_LOCAL_SIGNATURE 0x04034b50
+#define ZIP_LOCAL_SIZE 30
+#define ZIP64_EXTRA_ID 0x0001
+// the end of central directory record is followed by a comment of up to 64K, the Zip64 locator precedes it
+#define ZIP_TAIL_SIZE (ZIP64_EOCD_LOCATOR_SIZE + ZIP_EOCD_SIZE + G_MAXUINT16)
+#define ZIP_HOST_UNIX 3
+#define ZIP_UNIX_TYPE_MASK 0170000
+#define ZIP_UNIX_TYPE_REGULAR 0100000
+
+// Custom downstream event announcing the entry whose data follows
+#define ZIP_ENTRY_EVENT_NAME "gzdec-zip-entry"
+
+#define ZIP_ENTRY(ptr) ((ZipEntry*)ptr)
+typedef struct _ZipEntry ZipEntry;
+
+struct _ZipEntry {
+        gchar* name;
+        guint method;
+        guint flags;
+        guint32 crc;
+        guint64 compressed_size;
+        guint64 size;
+        // of the local header
+        guint64 offset;
+        guint mode;
+        // unix file type bits, 0 when not made on unix
+        guint type;
+        guint64 mtime;
+};
+
+static void zip_entry_free(ZipEntry* entry) {
+        if (!entry) {
+                return;
+        }
+        g_free(entry->name);
+        g_free(entry);
+}
+
+// Directories end with a slash, symlinks and the like are only told apart on unix
+static gboolean zip_entry_is_regular(const ZipEntry* entry) {
+        return !g_str_has_suffix(entry->name, "/")
+               && (!entry->type || entry->type == ZIP_UNIX_TYPE_REGULAR);
+}
+
+// MS-DOS date and time, in local time with a 2 second resolution
+static guint64 zip_dos_time(guint time, guint date) {
+        GDateTime* dt = g_date_time_new_local(1980 + (date >> 9), (date >> 5) & 0x0f, date & 0x1f,
+                                              time >> 11, (time >> 5) & 0x3f, (time & 0x1f) * 2);
+        guint64 mtime;
+
+        if (!dt) {
+                return 0;
+        }
+        mtime = g_date_time_to_unix(dt);
+        g_date_time_unref(dt);
+        return mtime;
+}
+
+// The end of central directory record is followed by a comment of up to 64K
+static const guchar* zip_find_eocd(const guchar* data, gsize size) {
+        gsize min, i;
+
+        if (size < ZIP_EOCD_SIZE) {
+                return NULL;
+        }
+        min = size - ZIP_EOCD_SIZE > G_MAXUINT16 ? size - ZIP_EOCD_SIZE - G_MAXUINT16 : 0;
+        for (i = size - ZIP_EOCD_SIZE; ; i--) {
+                if (GST_READ_UINT32_LE(data + i) == ZIP_EOCD_SIGNATURE) {
+                        return data + i;
+                }
+                if (i == min) {
+                        return NULL;
+                }
+        }
+}
+
+// Zip64 values are only present for the fields saturated in the record itself, in this order
+static void zip_parse_zip64_extra(ZipEntry* entry, const guchar* extra, gsize size) {
+        const guchar* end = extra + size;
+
+        if (entry->size == G_MAXUINT32 && end - extra >= 8) {
+                entry->size = GST_READ_UINT64_LE(extra);
+                extra += 8;
+        }
+        if (entry->compressed_size == G_MAXUINT32 && end - extra >= 8) {
+                entry->compressed_size = GST_READ_UINT64_LE(extra);
+                extra += 8;
+        }
+        if (entry->offset == G_MAXUINT32 && end - extra >= 8) {
+                entry->offset = GST_READ_UINT64_LE(extra);
+        }
+}
+
+static void zip_parse_extra(ZipEntry* entry, const guchar* extra, gsize size) {
+        guint id, length;
+
+        while (size >= 4) {
+                id = GST_READ_UINT16_LE(extra);
+                length = GST_READ_UINT16_LE(extra + 2);
+                if (length > size - 4) {
+                        return;
+                }
+                if (id == ZIP64_EXTRA_ID) {
+                        zip_parse_zip64_extra(entry, extra + 4, length);
+                }
+                extra += 4 + length;
+                size -= 4 + length;
+        }
+}
+
+/* Where the central directory is */
+typedef struct {
+        guint64 count;
+        guint64 offset;
+        guint64 size;
+        // the Zip64 end of central directory record holds the values instead, G_MAXUINT64 if none
+        guint64 zip64_offset;
+} ZipDirectoryInfo;
+
+// The tail is the last ZIP_TAIL_SIZE bytes of the archive (or all of it)
+static gboolean zip_read_eocd(const guchar* tail, gsize size, ZipDirectoryInfo* info) {
+        const guchar* eocd = zip_find_eocd(tail, size);
+        const guchar* locator;
+
+        if (!eocd) {
+                GST_ERROR("No end of central directory record, not a zip archive");
+                return FALSE;
+        }
+
+        info->count = GST_READ_UINT16_LE(eocd + 10);
+        info->size = GST_READ_UINT32_LE(eocd + 12);
+        info->offset = GST_READ_UINT32_LE(eocd + 16);
+        info->zip64_offset = G_MAXUINT64;
+
+        if (info->count == G_MAXUINT16 || info->size == G_MAXUINT32 || info->offset == G_MAXUINT32) {
+                locator = eocd - ZIP64_EOCD_LOCATOR_SIZE;
+                if (eocd - tail >= ZIP64_EOCD_LOCATOR_SIZE
+                    && GST_READ_UINT32_LE(locator) == ZIP64_EOCD_LOCATOR_SIGNATURE) {
+                        info->zip64_offset = GST_READ_UINT64_LE(locator + 8);
+                }
+        }
+        return TRUE;
+}
+
+// The ZIP64_EOCD_SIZE bytes at zip64_offset
+static gboolean zip_read_zip64_eocd(const guchar* record, ZipDirectoryInfo* info) {
+        if (GST_READ_UINT32_LE(record) != ZIP64_EOCD_SIGNATURE) {
+                GST_ERROR("No Zip64 end of central directory record where the locator points");
+                return FALSE;
+        }
+        info->count = GST_READ_UINT64_LE(record + 32);
+        info->size = GST_READ_UINT64_LE(record + 40);
+        info->offset = GST_READ_UINT64_LE(record + 48);
+        return TRUE;
+}
+
+// Returns the entries in the order of the central directory, NULL if it is corrupt
+static GPtrArray* zip_read_central_directory(const guchar* data, gsize size, guint64 count) {
+        const guchar* p = data;
+        const guchar* end = data + size;
+        guint64 i;
+        guint name_size, extra_size, comment_size;
+        GPtrArray* entries;
+        ZipEntry* entry;
+
+        GST_DEBUG("Central directory of %" G_GUINT64_FORMAT " entries", count);
+
+        entries = g_ptr_array_new_with_free_func((GDestroyNotify) zip_entry_free);
+
+        for (i = 0; i < count; i++) {
+                if (end - p < ZIP_CENTRAL_SIZE || GST_READ_UINT32_LE(p) != ZIP_CENTRAL_SIGNATURE) {
+                        goto corrupt;
+                }
+                name_size = GST_READ_UINT16_LE(p + 28);
+                extra_size = GST_READ_UINT16_LE(p + 30);
+                comment_size = GST_READ_UINT16_LE(p + 32);
+                if ((gsize) (end - p) < ZIP_CENTRAL_SIZE + name_size + extra_size + comment_size) {
+                        goto corrupt;
+                }
+
+                entry = g_new0(ZipEntry, 1);
+                entry->flags = GST_READ_UINT16_LE(p + 8);
+                entry->method = GST_READ_UINT16_LE(p + 10);
+                entry->mtime = zip_dos_time(GST_READ_UINT16_LE(p + 12), GST_READ_UINT16_LE(p + 14));
+                entry->crc = GST_READ_UINT32_LE(p + 16);
+                entry->compressed_size = GST_READ_UINT32_LE(p + 20);
+                entry->size = GST_READ_UINT32_LE(p + 24);
+                entry->offset = GST_READ_UINT32_LE(p + 42);
+                // the unix mode is in the upper half of the external attributes
+                if ((GST_READ_UINT16_LE(p + 4) >> 8) == ZIP_HOST_UNIX) {
+                        entry->mode = (GST_READ_UINT32_LE(p + 38) >> 16) & 07777;
+                        entry->type = (GST_READ_UINT32_LE(p + 38) >> 16) & ZIP_UNIX_TYPE_MASK;
+                } else {
+                        entry->mode = 0644;
+                }
+                entry->name = g_strndup((const gchar*) p + ZIP_CENTRAL_SIZE, name_size);
+                zip_parse_extra(entry, p + ZIP_CENTRAL_SIZE + name_size, extra_size);
+                g_ptr_array_add(entries, entry);
+
+                p += ZIP_CENTRAL_SIZE + name_size + extra_size + comment_size;
+        }
+
+        return entries;
+
+corrupt:
+        GST_ERROR("Corrupt central directory record %" G_GUINT64_FORMAT, i);
+        g_ptr_array_unref(entries);
+        return NULL;
+}
+
+// The local header repeats the name and has its own extra field, the data follows it.
+// Returns the size of the ZIP_LOCAL_SIZE bytes header and what follows it, 0 if it is none.
+static guint zip_local_header_size(const guchar* header) {
+        if (GST_READ_UINT32_LE(header) != ZIP_LOCAL_SIGNATURE) {
+                return 0;
+        }
+        return ZIP_LOCAL_SIZE + GST_READ_UINT16_LE(header + 26) + GST_READ_UINT16_LE(header + 28);
+}
+
+static gint zip_offset_compare(gconstpointer a, gconstpointer b) {
+        guint64 x = *(const guint64*) a, y = *(const guint64*) b;
+        return x < y ? -1 : x > y;
+}
+
+// The local header offsets in order, with the central directory after them
+static GArray* zip_entry_offsets(GPtrArray* entries, guint64 cd_offset) {
+        GArray* offsets = g_array_sized_new(FALSE, FALSE, sizeof(guint64), entries->len + 1);
+        guint i;
+
+        for (i = 0; i < entries->len; i++) {
+                g_array_append_val(offsets, ZIP_ENTRY(g_ptr_array_index(entries, i))->offset);
+        }
+        g_array_append_val(offsets, cd_offset);
+        g_array_sort(offsets, zip_offset_compare);
+        return offsets;
+}
+
+// Where the entry at offset ends at the latest: at the next local header or the central directory
+static guint64 zip_extent_end(GArray* offsets, guint64 offset) {
+        guint lo = 0, hi = offsets->len, mid;
+
+        while (lo < hi) {
+                mid = (lo + hi) / 2;
+                if (g_array_index(offsets, guint64, mid) <= offset) {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+        return lo < offsets->len ? g_array_index(offsets, guint64, lo) : offset;
+}
+
+#define ZIP_ARCHIVE(ptr) ((ZipArchive*)ptr)
+typedef struct _ZipArchive ZipArchive;
+
+struct _ZipArchive {
+        gpointer user_data;
+        gboolean started;
+
+        // upstream can seek, the parts we need are read through seeks to byte ranges
+        gboolean seeking;
+        guint64 size;
+        // the range upstream sends since the last seek, and where it is at
+        guint64 position;
+        guint64 range_end;
+        // what is left of the buffer the position is in
+        GstBuffer* pending;
+        gsize pending_skip;
+        // upstream sent EOS at the end of the range, and is idle until the next seek
+        gboolean range_eos;
+        // the input task was paused or stopped, or a seek failed
+        gboolean aborted;
+
+        // or the archive is spooled to an unlinked file until EOS, and mapped from there
+        gint spool_fd;
+        guint64 spool_size;
+        GMappedFile* spool;
+};
+
+static ZipArchive* zip_archive_new(gpointer user_data) {
+        ZipArchive* archive = g_new0(ZipArchive, 1);
+        archive->user_data = user_data;
+        archive->spool_fd = -1;
+        return archive;
+}
+
+// Ready for the next stream
+static void zip_archive_reset(ZipArchive* archive) {
+        if (archive->pending) {
+                gst_buffer_unref(archive->pending);
+                archive->pending = NULL;
+        }
+        if (archive->spool) {
+                g_mapped_file_unref(archive->spool);
+                archive->spool = NULL;
+        }
+        if (archive->spool_fd >= 0) {
+                close(archive->spool_fd);
+                archive->spool_fd = -1;
+        }
+        archive->started = archive->seeking = archive->range_eos = archive->aborted = FALSE;
+        archive->size = archive->position = archive->range_end = archive->spool_size = 0;
+        archive->pending_skip = 0;
+}
+
+// Spooling, for upstreams that can't seek. The file is unlinked right away, nothing is left behind.
+static gboolean zip_archive_spool_open(ZipArchive* archive, GError** error) {
+        gchar* path = NULL;
+
+        archive->spool_fd = g_file_open_tmp("gzdec-zip-XXXXXX", &path, error);
+        if (archive->spool_fd < 0) {
+                return FALSE;
+        }
+        g_unlink(path);
+        g_free(path);
+        return TRUE;
+}
+
+static gboolean zip_archive_spool_write(gpointer user_data, const guint8* data, gsize size) {
+        ZipArchive* archive = ZIP_ARCHIVE(user_data);
+        gssize n;
+
+        while (size > 0) {
+                n = write(archive->spool_fd, data, size);
+                if (n < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        GST_ERROR("Failed to spool the zip archive: %s", g_strerror(errno));
+                        return FALSE;
+                }
+                data += n;
+                size -= n;
+                archive->spool_size += n;
+        }
+        return TRUE;
+}
+
+static gboolean zip_archive_spool_map(ZipArchive* archive, GError** error) {
+        archive->spool = g_mapped_file_new_from_fd(archive->spool_fd, FALSE, error);
+        return archive->spool != NULL;
+}
+
+static void zip_archive_free(ZipArchive* archive) {
+        zip_archive_reset(archive);
+        g_free(archive);
+}
@@ -3,15 +3,26 @@
 /* This is stream wrapper for Zlib inflate */
 
 #define ZIP_DEC_STREAM_OUT_BUFFER_SIZE 16*1024
-#define ZLIB_INFLATE_WINDOW_BITS 32 // This value (32) enables gzip as well as zlib formats
-// by automatic header detection.
-// Force to Gzip only with 16
-// TODO: one could make this a run-time param
-// of the wrapper constructor.
+#define ZIP_DEC_STREAM_OUT_BUFFER_SIZE_SMALL 4*1024
+// Window bits passed to inflateInit2 for the different framings of deflate data
+#define ZLIB_INFLATE_WINDOW_BITS_ZLIB MAX_WBITS
+#define ZLIB_INFLATE_WINDOW_BITS_GZIP (16 + MAX_WBITS)
+#define ZLIB_INFLATE_WINDOW_BITS_RAW (-MAX_WBITS) // no header nor trailer at all
+// Trailer sizes: CRC-32 and ISIZE for gzip, Adler-32 for zlib
+#define GZIP_TRAILER_SIZE 8
+#define ZLIB_TRAILER_SIZE 4
+// Input inflated on trial to confirm a zlib header found while resyncing
+#define ZIP_RESYNC_TRIAL_SIZE 1024
 
 #define ZIP_DECODER_STREAM(ptr) ((ZipDecoderStream*)ptr)
 typedef struct _ZipDecoderStream ZipDecoderStream;
-typedef void (*StreamWriterFunc)(gpointer user_data, gpointer data, gsize bytes);
+// returns FALSE when decoding should stop
+typedef gboolean (*StreamWriterFunc)(gpointer user_data, gpointer data, gsize bytes);
+// called when decoding resumes after corrupt data, with the number of input bytes given up
+typedef void (*StreamResyncFunc)(gpointer user_data, guint64 skipped);
+// called at a stream end with more input following, with that input. Returns TRUE
+// when the stream that follows is of another format, this decoder then stops there.
+typedef gboolean (*StreamSwitchFunc)(gpointer user_data, gconstpointer next, gsize avail);
 typedef z_stream ZStream;
 
 struct _ZipDecoderStream {
@@ -19,34 +30,253 @@ struct _ZipDecoderStream {
         gpointer user_data;
         StreamWriterFunc writer_func;
         gboolean header;
+        DictionaryStore* dictionaries;
+        int window_bits;
+        // output chunk
+        guchar* out;
+        gsize out_size;
+        MemoryCounter* memory;
+        // reached the end of a stream, more input starts a new one
+        gboolean ended;
+        gboolean verify;
+        // error recovery, only when there is a resync function
+        StreamResyncFunc resync_func;
+        // looking for a point to resume from after corrupt data
+        gboolean resyncing;
+        guint64 skipped;
+        // resumed at a sync flush point, decoding raw deflate until the stream end
+        gboolean raw_resync;
+        // of the stream resumed in raw, stepped over at its end
+        guint trailer_left;
+        // hands over to another decoder at a stream end, optional
+        StreamSwitchFunc switch_func;
 };
 
-static ZipDecoderStream* zipdec_stream_new(gpointer user_data, StreamWriterFunc writer_func) {
-        ZipDecoderStream* wrapper = ZIP_DECODER_STREAM(g_malloc(sizeof(ZipDecoderStream)));
+static ZipDecoderStream* zipdec_stream_new(gpointer user_data, StreamWriterFunc writer_func,
+                                           StreamResyncFunc resync_func, StreamSwitchFunc switch_func,
+                                           DictionaryStore* dictionaries, int window_bits,
+                                           gboolean verify, MemoryCounter* memory, gsize out_size) {
+        ZipDecoderStream* wrapper = ZIP_DECODER_STREAM(memory_counter_alloc(memory, sizeof(ZipDecoderStream)));
         wrapper->user_data = user_data;
         wrapper->writer_func = writer_func;
-        wrapper->stream.zalloc = Z_NULL;
-        wrapper->stream.zfree = Z_NULL;
-        wrapper->stream.opaque = Z_NULL;
+        wrapper->resync_func = resync_func;
+        wrapper->switch_func = switch_func;
+        wrapper->resyncing = wrapper->raw_resync = FALSE;
+        wrapper->trailer_left = 0;
+        wrapper->skipped = 0;
+        wrapper->verify = verify;
+        wrapper->dictionaries = dictionaries ? dictionary_store_ref(dictionaries) : NULL;
+        wrapper->memory = memory;
+        wrapper->out_size = out_size;
+        wrapper->out = memory_counter_alloc(memory, out_size);
+        wrapper->ended = FALSE;
+        // zlib always allocates a full window of the size announced by the stream
+        wrapper->stream.zalloc = memory_counter_zalloc;
+        wrapper->stream.zfree = memory_counter_zfree;
+        wrapper->stream.opaque = memory;
         wrapper->stream.avail_in = 0;
         wrapper->stream.next_in = Z_NULL;
-        int ret = inflateInit2(&wrapper->stream, ZLIB_INFLATE_WINDOW_BITS);
+        wrapper->window_bits = window_bits;
+        int ret = inflateInit2(&wrapper->stream, window_bits);
         if (ret != Z_OK) {
                 GST_ERROR("Got code %d when calling Zlib inflateInit2", (int) ret);
         }
+#if ZLIB_VERNUM >= 0x1290
+        // trusted input: don't compute nor check the Adler-32/CRC-32 trailer
+        if (!verify) {
+                inflateValidate(&wrapper->stream, 0);
+        }
+#else
+        if (!verify) {
+                GST_WARNING("Zlib is too old to skip checksum verification");
+        }
+#endif
         return wrapper;
 }
 
 static void zipdec_stream_free(ZipDecoderStream* wrapper) {
         inflateEnd(&wrapper->stream);
-        g_free(wrapper);
+        if (wrapper->dictionaries) {
+                dictionary_store_unref(wrapper->dictionaries);
+        }
+        memory_counter_free(wrapper->memory, wrapper->out);
+        memory_counter_free(wrapper->memory, wrapper);
 }
 
-static gboolean zipdec_stream_digest_buffer(void *w, GstBuffer* buf) {
+// Called when inflate returned Z_NEED_DICT, the requested dictionary ID is in strm->adler
+static gboolean zipdec_stream_set_dictionary(ZipDecoderStream* wrapper) {
+        ZStream* strm = &wrapper->stream;
+        GBytes* dictionary = dictionary_store_lookup(wrapper->dictionaries, (guint32) strm->adler);
+        gconstpointer data;
+        gsize size;
 
-        ZipDecoderStream *wrapper = ZIP_DECODER_STREAM(w);
+        if (!dictionary) {
+                GST_ERROR("Stream needs dictionary with ID %08x which we don't have", (guint32) strm->adler);
+                return FALSE;
+        }
 
-        GST_TRACE("Processing one buffer for inflation: %" GST_PTR_FORMAT, buf);
+        data = g_bytes_get_data(dictionary, &size);
+        if (inflateSetDictionary(strm, data, (uInt) size) != Z_OK) {
+                GST_ERROR("Failed to set dictionary with ID %08x", (guint32) strm->adler);
+                return FALSE;
+        }
+
+        GST_DEBUG("Applied dictionary with ID %08x (%d bytes)", (guint32) strm->adler, (int) size);
+        return TRUE;
+}
+
+// Restarts inflate with another framing, inflateReset2 also turns checksum verification back on
+static void zipdec_stream_reset_framing(ZipDecoderStream* wrapper, int window_bits) {
+        inflateReset2(&wrapper->stream, window_bits);
+#if ZLIB_VERNUM >= 0x1290
+        if (!wrapper->verify) {
+                inflateValidate(&wrapper->stream, 0);
+        }
+#endif
+}
+
+// Ready for a new stream, the zlib state, its window and the output chunk stay allocated
+static void zipdec_stream_reset(ZipDecoderStream* wrapper, int window_bits) {
+        wrapper->window_bits = window_bits;
+        zipdec_stream_reset_framing(wrapper, window_bits);
+        wrapper->ended = FALSE;
+        wrapper->resyncing = wrapper->raw_resync = FALSE;
+        wrapper->trailer_left = 0;
+        wrapper->skipped = 0;
+}
+
+static guint zipdec_stream_trailer_size(ZipDecoderStream* wrapper) {
+        switch (wrapper->window_bits) {
+        case ZLIB_INFLATE_WINDOW_BITS_GZIP:
+                return GZIP_TRAILER_SIZE;
+        case ZLIB_INFLATE_WINDOW_BITS_ZLIB:
+                return ZLIB_TRAILER_SIZE;
+        default:
+                return 0;
+        }
+}
+
+static void zipdec_stream_reset_raw_with_window(ZipDecoderStream* wrapper) {
+#if ZLIB_VERNUM >= 0x1280
+        uInt size = 1 << MAX_WBITS;
+        Bytef* window = memory_counter_alloc(wrapper->memory, size);
+
+        if (inflateGetDictionary(&wrapper->stream, window, &size) != Z_OK) {
+                size = 0;
+        }
+        zipdec_stream_reset_framing(wrapper, ZLIB_INFLATE_WINDOW_BITS_RAW);
+        if (size) {
+                inflateSetDictionary(&wrapper->stream, window, size);
+        }
+        memory_counter_free(wrapper->memory, window);
+#else
+        zipdec_stream_reset_framing(wrapper, ZLIB_INFLATE_WINDOW_BITS_RAW);
+#endif
+}
+
+/*
+   Two bytes pass the zlib header check (0x78, FCHECK) by chance every 8K or so of corrupt
+   data. A candidate also needs FDICT clear (unless we have dictionaries), a valid first block
+   type, and to inflate its first bytes without error, the output chunk serving as scratch.
+ */
+static gboolean zipdec_stream_zlib_header_at(ZipDecoderStream* wrapper, const guchar* data, guint size) {
+        ZStream trial;
+        int ret;
+
+        if (size < 3 || data[0] != 0x78 || ((data[0] << 8) | data[1]) % 31 != 0
+            || ((data[1] & 0x20) && !wrapper->dictionaries) || ((data[2] >> 1) & 0x03) == 0x03) {
+                return FALSE;
+        }
+
+        memset(&trial, 0, sizeof(trial));
+        trial.zalloc = memory_counter_zalloc;
+        trial.zfree = memory_counter_zfree;
+        trial.opaque = wrapper->memory;
+        if (inflateInit2(&trial, ZLIB_INFLATE_WINDOW_BITS_ZLIB) != Z_OK) {
+                return FALSE;
+        }
+        trial.next_in = (Bytef*) data;
+        trial.avail_in = MIN(size, ZIP_RESYNC_TRIAL_SIZE);
+        do {
+                trial.next_out = wrapper->out;
+                trial.avail_out = wrapper->out_size;
+                ret = inflate(&trial, Z_NO_FLUSH);
+        } while (ret == Z_OK && trial.avail_in);
+        inflateEnd(&trial);
+
+        return ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR || ret == Z_NEED_DICT;
+}
+
+/*
+   Looks for a point to resume inflating from after corrupt data: the header of the next
+   gzip member or zlib stream, or a sync flush point (the empty stored block 00 00 ff ff that
+   Z_SYNC_FLUSH and Z_FULL_FLUSH leave, byte aligned, in between two deflate blocks).
+   After a sync flush point we go on as raw deflate, with the window inflate had before the error
+   as dictionary since a sync flush (unlike a full flush) leaves back references across it.
+   Those into the corrupt part give wrong data, but keep the stream going.
+   A marker split across two buffers is missed.
+   Returns FALSE when the input ran out without finding anything.
+ */
+static gboolean zipdec_stream_resync(ZipDecoderStream* wrapper) {
+        ZStream* strm = &wrapper->stream;
+        const guchar* data = strm->next_in;
+        guint size = strm->avail_in;
+        gboolean found = FALSE;
+        guint i;
+
+        for (i = 0; i < size; i++) {
+                if (wrapper->window_bits != ZLIB_INFLATE_WINDOW_BITS_RAW
+                    && i + 2 < size && data[i] == 0x1f && data[i + 1] == 0x8b && data[i + 2] == 0x08) {
+                        GST_DEBUG("Resyncing at gzip member header");
+                        zipdec_stream_reset_framing(wrapper, wrapper->window_bits);
+                        wrapper->raw_resync = FALSE;
+                        found = TRUE;
+                        break;
+                }
+                if (wrapper->window_bits == ZLIB_INFLATE_WINDOW_BITS_ZLIB
+                    && zipdec_stream_zlib_header_at(wrapper, data + i, size - i)) {
+                        GST_DEBUG("Resyncing at zlib stream header");
+                        zipdec_stream_reset_framing(wrapper, wrapper->window_bits);
+                        wrapper->raw_resync = FALSE;
+                        found = TRUE;
+                        break;
+                }
+                if (i + 3 < size && data[i] == 0x00 && data[i + 1] == 0x00
+                    && data[i + 2] == 0xff && data[i + 3] == 0xff) {
+                        GST_DEBUG("Resyncing at sync flush point");
+                        zipdec_stream_reset_raw_with_window(wrapper);
+                        wrapper->raw_resync = TRUE;
+                        found = TRUE;
+                        i += 4;
+                        break;
+                }
+        }
+
+        wrapper->skipped += i;
+        strm->next_in += i;
+        strm->avail_in -= i;
+
+        if (!found) {
+                return FALSE;
+        }
+
+        GST_WARNING("Resuming inflate after skipping %" G_GUINT64_FORMAT " bytes", wrapper->skipped);
+        wrapper->resyncing = FALSE;
+        wrapper->trailer_left = 0;
+        wrapper->ended = FALSE;
+        wrapper->resync_func(wrapper->user_data, wrapper->skipped);
+        wrapper->skipped = 0;
+        return TRUE;
+}
+
+static gboolean zipdec_stream_at_end(void *w) {
+        return ZIP_DECODER_STREAM(w)->ended;
+}
+
+// Inflates one memory block of an input buffer
+static gboolean zipdec_stream_digest(gpointer w, const guint8* buffer_data, gsize buffer_size) {
+
+        ZipDecoderStream *wrapper = ZIP_DECODER_STREAM(w);
 
         // unwrap components
         gpointer user_data = wrapper->user_data;
@@ -59,29 +289,12 @@ static gboolean zipdec_stream_digest_buffer(void *w, GstBuffer* buf) {
         gboolean success = FALSE;
 
         // deflate output buffer
-        guchar out[ZIP_DEC_STREAM_OUT_BUFFER_SIZE];
-        guint out_size = sizeof(out);
-
-        // input buffer
-        guint buffer_size;
-        gpointer buffer_data;
-
-#ifdef USE_GSTREAMER_1_DOT_0_API
-        GstMapInfo map;
-        if (!gst_buffer_map(buf, &map, GST_MAP_READ)) {
-                GST_ERROR ("Error mapping buffer for read access: %" GST_PTR_FORMAT, buf);
-                return Z_ERRNO;
-        }
-        buffer_size = map.size;
-        buffer_data = map.data;
-#else
-        buffer_size = BUFFER_SIZE(buf)
-                      buffer_data = GST_BUFFER_DATA(buf);
-#endif
+        guchar* out = wrapper->out;
+        guint out_size = wrapper->out_size;
 
 #if 0
         // debug: prints hex dump of input buffer
-        guchar* buffer_chars = buffer_data;
+        const guchar* buffer_chars = buffer_data;
         for (gint i = 0; i < buffer_size; i++)
         {
                 if (i > 0) g_print(":");
@@ -96,10 +309,41 @@ static gboolean zipdec_stream_digest_buffer(void *w, GstBuffer* buf) {
 
         // set initial input pointer and size
         strm->avail_in = buffer_size;
-        strm->next_in = buffer_data;
+        strm->next_in = (guchar*) buffer_data;
 
         while(strm->avail_in) {
 
+                if (wrapper->resyncing && !zipdec_stream_resync(wrapper)) {
+                        break;
+                }
+
+                // gzip files may consist of several members (e.g concatenated with cat)
+                // and message feeds send one zlib stream after the other
+                if (wrapper->ended) {
+                        if (wrapper->raw_resync) {
+                                // raw deflate stops before the gzip/zlib trailer, which has nothing to be checked
+                                // against since the start of the stream was lost. The next stream has a header.
+                                wrapper->trailer_left = zipdec_stream_trailer_size(wrapper);
+                                zipdec_stream_reset_framing(wrapper, wrapper->window_bits);
+                                wrapper->raw_resync = FALSE;
+                        }
+                        if (wrapper->trailer_left) {
+                                have = MIN(strm->avail_in, wrapper->trailer_left);
+                                strm->next_in += have;
+                                strm->avail_in -= have;
+                                wrapper->trailer_left -= have;
+                                continue;
+                        }
+                        if (wrapper->switch_func
+                            && wrapper->switch_func(user_data, strm->next_in, strm->avail_in)) {
+                                GST_DEBUG("Stream end with %d bytes left for another decoder", (int) strm->avail_in);
+                                break;
+                        }
+                        GST_DEBUG("Stream end with %d bytes left, resetting for next stream", (int) strm->avail_in);
+                        inflateReset(strm);
+                        wrapper->ended = FALSE;
+                }
+
                 // reset output buffer on every iteration
                 strm->avail_out = out_size;
                 strm->next_out = out;
@@ -116,9 +360,20 @@ static gboolean zipdec_stream_digest_buffer(void *w, GstBuffer* buf) {
                 GST_TRACE("Inflate returned %d", (int) ret);
                 switch (ret) {
                 case Z_NEED_DICT:
+                        GST_DEBUG("Zlib code: Z_NEED_DICT");
+                        if (zipdec_stream_set_dictionary(wrapper)) {
+                                // nothing was inflated yet, just go on
+                                continue;
+                        }
                         ret = Z_DATA_ERROR; /* and fall through */
-                        GST_WARNING("Zlib code: Z_NEED_DICT");
                 case Z_DATA_ERROR:
+                        if (wrapper->resync_func) {
+                                GST_WARNING("Corrupt data (%s), looking for a point to resync", strm->msg ? strm->msg : "no message");
+                                // write out what was inflated before the error
+                                wrapper->resyncing = TRUE;
+                                break;
+                        }
+                        /* fall through */
                 case Z_MEM_ERROR:
                         GST_ERROR("Data/Memory error or missing dictionnary (code: %d)", ret);
                         goto done;
@@ -130,15 +385,25 @@ static gboolean zipdec_stream_digest_buffer(void *w, GstBuffer* buf) {
 
                 GST_TRACE("Have %d inflated bytes, writing to output stream", (int) have);
 
-                writer_func(user_data, out, have);
+                if (!writer_func(user_data, out, have)) {
+                        GST_DEBUG("Writer stopped decoding");
+                        goto done;
+                }
+
+                if (ret == Z_STREAM_END) {
+                        wrapper->ended = TRUE;
+                }
         }
 
         success = TRUE;
 
 done:
-#ifdef USE_GSTREAMER_1_DOT_0_API
-        gst_buffer_unmap (buf, &map);
-#endif
         return success;
 }
 
+static gboolean zipdec_stream_digest_buffer(void *w, GstBuffer* buf) {
+        GST_TRACE("Processing one buffer for inflation: %" GST_PTR_FORMAT, buf);
+
+        return buffer_foreach_chunk(buf, zipdec_stream_digest, w);
+}
+
@@ -0,0 +1,336 @@
+/*
+ * GStreamer
+ * Copyright (C) 2005 Thomas Vander Stichele <thomas@apestaart.org>
+ * Copyright (C) 2005 Ronald S. Bultje <rbultje@ronald.bitfreak.net>
+ * Copyright (C) 2017 Stephan Hesse <<disparat@gmail.com>>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * SECTION:tracer-gzdec-latency
+ *
+ * Measures where the time goes for each buffer leaving a gzdec:
+ *
+ * input-wait: from the chain function until the decoder takes the input buffer off the input queue
+ * decode: from there until the decompressed chunk is appended to the output queue
+ * output-wait: from there until the source pad task pushes it
+ * push: inside gst_pad_push, i.e. downstream processing or blocking
+ *
+ * Each stage is kept as a histogram with power of two buckets in microseconds,
+ * logged per element at EOS and when the tracer goes away.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * GST_TRACERS=gzdec-latency GST_DEBUG=gzdec-latency:4 gst-launch-1.0 filesrc location=test/test.tiff.gz ! gzdec ! fakesink
+ * ]|
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+
+#include "gstgzdeclatency.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_gz_dec_latency_debug);
+#define GST_CAT_DEFAULT gst_gz_dec_latency_debug
+
+// number of gzdec-latency tracers alive
+static gint active_tracers = 0;
+
+gboolean
+gst_gz_dec_latency_tracing (void)
+{
+        return g_atomic_int_get (&active_tracers) > 0;
+}
+
+GType
+gst_gz_dec_latency_meta_api_get_type (void)
+{
+        static gsize meta_api_type = 0;
+        static const gchar *tags[] = { NULL };
+
+        if (g_once_init_enter (&meta_api_type)) {
+                GType type = gst_meta_api_type_register ("GstGzDecLatencyMetaAPI", tags);
+                g_once_init_leave (&meta_api_type, type);
+        }
+        return meta_api_type;
+}
+
+static gboolean
+gst_gz_dec_latency_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+        GstGzDecLatencyMeta *latency = (GstGzDecLatencyMeta *) meta;
+
+        latency->queued = latency->decode_start = latency->decoded = GST_CLOCK_TIME_NONE;
+        latency->element = NULL;
+        return TRUE;
+}
+
+static gboolean
+gst_gz_dec_latency_meta_transform (GstBuffer * dest, GstMeta * meta,
+                                   GstBuffer * buffer, GQuark type, gpointer data)
+{
+        GstGzDecLatencyMeta *src = (GstGzDecLatencyMeta *) meta;
+        GstGzDecLatencyMeta *copy;
+
+        if (!GST_META_TRANSFORM_IS_COPY (type)) {
+                return FALSE;
+        }
+
+        copy = gst_buffer_add_gz_dec_latency_meta (dest);
+        copy->queued = src->queued;
+        copy->decode_start = src->decode_start;
+        copy->decoded = src->decoded;
+        copy->element = src->element;
+        return TRUE;
+}
+
+const GstMetaInfo *
+gst_gz_dec_latency_meta_get_info (void)
+{
+        static const GstMetaInfo *meta_info = NULL;
+
+        if (g_once_init_enter (&meta_info)) {
+                const GstMetaInfo *info = gst_meta_register (GST_GZDEC_LATENCY_META_API_TYPE,
+                                                             "GstGzDecLatencyMeta",
+                                                             sizeof (GstGzDecLatencyMeta),
+                                                             gst_gz_dec_latency_meta_init,
+                                                             NULL,
+                                                             gst_gz_dec_latency_meta_transform);
+                g_once_init_leave (&meta_info, info);
+        }
+        return meta_info;
+}
+
+GstGzDecLatencyMeta *
+gst_buffer_add_gz_dec_latency_meta (GstBuffer * buffer)
+{
+        return (GstGzDecLatencyMeta *) gst_buffer_add_meta (buffer, GST_GZDEC_LATENCY_META_INFO, NULL);
+}
+
+#ifdef GZDEC_HAVE_LATENCY_TRACER
+
+typedef enum {
+        STAGE_INPUT_WAIT,
+        STAGE_DECODE,
+        STAGE_OUTPUT_WAIT,
+        STAGE_PUSH,
+        N_STAGES
+} LatencyStage;
+
+static const gchar* stage_names[N_STAGES] = { "input-wait", "decode", "output-wait", "push" };
+
+// bucket n counts durations below 2^n microseconds (and from 2^(n-1) on), the last one everything longer
+#define N_BUCKETS 24
+
+typedef struct {
+        gchar* name;
+        guint64 histogram[N_STAGES][N_BUCKETS];
+        guint64 count;
+        // start of the push in progress
+        GstClockTime push_start;
+} LatencyStats;
+
+static void latency_stats_free (LatencyStats* stats) {
+        g_free (stats->name);
+        g_free (stats);
+}
+
+static void latency_stats_add (LatencyStats* stats, LatencyStage stage, GstClockTime from, GstClockTime to) {
+        guint64 us;
+        guint bucket = 0;
+
+        if (!GST_CLOCK_TIME_IS_VALID (from) || !GST_CLOCK_TIME_IS_VALID (to) || to < from) {
+                return;
+        }
+
+        us = (to - from) / GST_USECOND;
+        while (us && bucket < N_BUCKETS - 1) {
+                us >>= 1;
+                bucket++;
+        }
+        stats->histogram[stage][bucket]++;
+}
+
+static void latency_stats_log (LatencyStats* stats) {
+        GString* line;
+        guint stage, bucket;
+
+        for (stage = 0; stage < N_STAGES; stage++) {
+                line = g_string_new (NULL);
+                for (bucket = 0; bucket < N_BUCKETS; bucket++) {
+                        if (stats->histogram[stage][bucket]) {
+                                g_string_append_printf (line, " <%" G_GUINT64_FORMAT "us:%" G_GUINT64_FORMAT,
+                                                        G_GUINT64_CONSTANT(1) << bucket, stats->histogram[stage][bucket]);
+                        }
+                }
+                GST_INFO ("%s %s (%" G_GUINT64_FORMAT " buffers):%s",
+                          stats->name, stage_names[stage], stats->count, line->str);
+                g_string_free (line, TRUE);
+        }
+}
+
+// Called with the tracer lock held
+static LatencyStats* latency_stats_get (GstGzDecLatencyTracer* self, GstPad* pad, gboolean create) {
+        LatencyStats* stats = g_hash_table_lookup (self->stats, pad);
+        GstObject* parent;
+
+        if (!stats && create) {
+                stats = g_new0 (LatencyStats, 1);
+                stats->push_start = GST_CLOCK_TIME_NONE;
+                parent = gst_object_get_parent (GST_OBJECT (pad));
+                stats->name = parent ? gst_object_get_name (parent) : g_strdup ("gzdec");
+                if (parent) {
+                        gst_object_unref (parent);
+                }
+                g_hash_table_insert (self->stats, gst_object_ref (pad), stats);
+        }
+        return stats;
+}
+
+static void
+do_push_buffer_pre (GstGzDecLatencyTracer * self, GstClockTime ts, GstPad * pad, GstBuffer * buffer)
+{
+        GstGzDecLatencyMeta* meta = gst_buffer_get_gz_dec_latency_meta (buffer);
+        LatencyStats* stats;
+        GstClockTime now;
+
+        // buffers keep the meta downstream, through other elements and other gzdecs in
+        // passthrough, only the source pad of the gzdec that decoded them accounts them
+        if (!meta || !GST_PAD_IS_SRC (pad) || meta->element != (gpointer) GST_OBJECT_PARENT (pad)) {
+                return;
+        }
+        // the hook timestamp is relative to gst_init, the meta has absolute ones
+        now = gst_util_get_timestamp ();
+
+        g_mutex_lock (&self->lock);
+        stats = latency_stats_get (self, pad, TRUE);
+        latency_stats_add (stats, STAGE_INPUT_WAIT, meta->queued, meta->decode_start);
+        latency_stats_add (stats, STAGE_DECODE, meta->decode_start, meta->decoded);
+        latency_stats_add (stats, STAGE_OUTPUT_WAIT, meta->decoded, now);
+        stats->count++;
+        stats->push_start = now;
+        g_mutex_unlock (&self->lock);
+}
+
+static void
+do_push_buffer_post (GstGzDecLatencyTracer * self, GstClockTime ts, GstPad * pad, GstFlowReturn res)
+{
+        LatencyStats* stats;
+
+        g_mutex_lock (&self->lock);
+        stats = latency_stats_get (self, pad, FALSE);
+        if (stats && GST_CLOCK_TIME_IS_VALID (stats->push_start)) {
+                latency_stats_add (stats, STAGE_PUSH, stats->push_start, gst_util_get_timestamp ());
+                stats->push_start = GST_CLOCK_TIME_NONE;
+        }
+        g_mutex_unlock (&self->lock);
+}
+
+static void
+do_push_event_pre (GstGzDecLatencyTracer * self, GstClockTime ts, GstPad * pad, GstEvent * event)
+{
+        LatencyStats* stats;
+
+        if (GST_EVENT_TYPE (event) != GST_EVENT_EOS) {
+                return;
+        }
+
+        g_mutex_lock (&self->lock);
+        stats = latency_stats_get (self, pad, FALSE);
+        if (stats) {
+                latency_stats_log (stats);
+        }
+        g_mutex_unlock (&self->lock);
+}
+
+G_DEFINE_TYPE (GstGzDecLatencyTracer, gst_gz_dec_latency_tracer, GST_TYPE_TRACER);
+
+static void
+gst_gz_dec_latency_tracer_finalize (GObject * object)
+{
+        GstGzDecLatencyTracer *self = GST_GZDEC_LATENCY_TRACER (object);
+        GHashTableIter iter;
+        gpointer stats;
+
+        g_hash_table_iter_init (&iter, self->stats);
+        while (g_hash_table_iter_next (&iter, NULL, &stats)) {
+                latency_stats_log ((LatencyStats*) stats);
+        }
+        g_hash_table_unref (self->stats);
+        g_mutex_clear (&self->lock);
+
+        g_atomic_int_add (&active_tracers, -1);
+
+        G_OBJECT_CLASS (gst_gz_dec_latency_tracer_parent_class)->finalize (object);
+}
+
+static void
+gst_gz_dec_latency_tracer_class_init (GstGzDecLatencyTracerClass * klass)
+{
+        GObjectClass *gobject_class = (GObjectClass *) klass;
+
+        gobject_class->finalize = gst_gz_dec_latency_tracer_finalize;
+
+        GST_DEBUG_CATEGORY_INIT (gst_gz_dec_latency_debug, "gzdec-latency",
+                                 0, "gzdec per-stage latency tracer");
+}
+
+static void
+gst_gz_dec_latency_tracer_init (GstGzDecLatencyTracer * self)
+{
+        GstTracer *tracer = GST_TRACER (self);
+
+        g_mutex_init (&self->lock);
+        self->stats = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                             gst_object_unref, (GDestroyNotify) latency_stats_free);
+
+        gst_tracing_register_hook (tracer, "pad-push-pre", G_CALLBACK (do_push_buffer_pre));
+        gst_tracing_register_hook (tracer, "pad-push-post", G_CALLBACK (do_push_buffer_post));
+        gst_tracing_register_hook (tracer, "pad-push-event-pre", G_CALLBACK (do_push_event_pre));
+
+        g_atomic_int_inc (&active_tracers);
+}
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * GStreamer
+ * Copyright (C) 2005 Thomas Vander Stichele <thomas@apestaart.org>
+ * Copyright (C) 2005 Ronald S. Bultje <rbultje@ronald.bitfreak.net>
+ * Copyright (C) 2017 Stephan Hesse <<disparat@gmail.com>>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_GZDEC_LATENCY_H__
+#define __GST_GZDEC_LATENCY_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstGzDecLatencyMeta GstGzDecLatencyMeta;
+
+/* Stage timestamps (gst_util_get_timestamp) of a buffer going through gzdec,
+   added only while a gzdec-latency tracer is active */
+struct _GstGzDecLatencyMeta
+{
+        GstMeta meta;
+
+        // input buffer appended to the input queue
+        GstClockTime queued;
+        // input buffer taken off the input queue by the decoder
+        GstClockTime decode_start;
+        // decompressed chunk appended to the output queue
+        GstClockTime decoded;
+        // the gzdec that queued the chunk, only its source pad accounts it
+        gpointer element;
+};
+
+GType gst_gz_dec_latency_meta_api_get_type (void);
+const GstMetaInfo* gst_gz_dec_latency_meta_get_info (void);
+#define GST_GZDEC_LATENCY_META_API_TYPE (gst_gz_dec_latency_meta_api_get_type())
+#define GST_GZDEC_LATENCY_META_INFO (gst_gz_dec_latency_meta_get_info())
+
+#define gst_buffer_get_gz_dec_latency_meta(b) \
+        ((GstGzDecLatencyMeta*)gst_buffer_get_meta((b), GST_GZDEC_LATENCY_META_API_TYPE))
+GstGzDecLatencyMeta* gst_buffer_add_gz_dec_latency_meta (GstBuffer* buffer);
+
+gboolean gst_gz_dec_latency_tracing (void);
+
+/* The tracer needs the tracing hooks, public since 1.8 */
+#if GST_CHECK_VERSION(1, 8, 0) && !defined(GST_DISABLE_GST_TRACER_HOOKS)
+#define GZDEC_HAVE_LATENCY_TRACER 1
+
+#define GST_TYPE_GZDEC_LATENCY_TRACER \
+        (gst_gz_dec_latency_tracer_get_type())
+#define GST_GZDEC_LATENCY_TRACER(obj) \
+        (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_GZDEC_LATENCY_TRACER,GstGzDecLatencyTracer))
+
+typedef struct _GstGzDecLatencyTracer GstGzDecLatencyTracer;
+typedef struct _GstGzDecLatencyTracerClass GstGzDecLatencyTracerClass;
+
+struct _GstGzDecLatencyTracer
+{
+        GstTracer parent;
+
+        GMutex lock;
+        // source pad -> LatencyStats
+        GHashTable* stats;
+};
+
+struct _GstGzDecLatencyTracerClass
+{
+        GstTracerClass parent_class;
+};
+
+GType gst_gz_dec_latency_tracer_get_type (void);
+#endif
+
+G_END_DECLS
+
+#endif /* __GST_GZDEC_LATENCY_H__ */
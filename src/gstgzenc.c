@@ -0,0 +1,463 @@
+/*
+ * GStreamer
+ * Copyright (C) 2005 Thomas Vander Stichele <thomas@apestaart.org>
+ * Copyright (C) 2005 Ronald S. Bultje <rbultje@ronald.bitfreak.net>
+ * Copyright (C) 2017 Stephan Hesse <<disparat@gmail.com>>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * SECTION:element-gzenc
+ *
+ * Compresses to gzip or bzip2, splitting the input into blocks which are compressed
+ * in parallel on a pool of threads (like pigz and pbzip2 do). The output decompresses
+ * with any gzip or bzip2 decoder.
+ *
+ * bzenc is the same element with bzip2 as default format.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * gst-launch-1.0 filesrc location=test/test.tiff ! gzenc threads=4 ! filesink location=test/test.tiff.gz
+ * gst-launch-1.0 filesrc location=test/test.tiff ! bzenc ! filesink location=test/test.tiff.bz2
+ * ]|
+ * </refsect2>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <zlib.h>
+#include <bzlib.h>
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+
+#include "gstgzenc.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_gz_enc_debug);
+#define GST_CAT_DEFAULT gst_gz_enc_debug
+
+#include "gstgz_queue.h"
+#include "gstgzenc_deflatestream.h"
+#include "gstgzenc_bzipstream.h"
+#include "gstgzenc_priv.h"
+
+enum
+{
+        PROP_0,
+        PROP_FORMAT,
+        PROP_LEVEL,
+        PROP_BLOCK_SIZE,
+        PROP_THREADS
+};
+
+#define DEFAULT_FORMAT GST_GZENC_FORMAT_GZIP
+#define DEFAULT_LEVEL 6
+#define DEFAULT_BLOCK_SIZE 128*1024
+#define DEFAULT_THREADS 0
+
+static GstStaticPadTemplate sink_factory = GST_STATIC_PAD_TEMPLATE ("sink",
+                                                                    GST_PAD_SINK,
+                                                                    GST_PAD_ALWAYS,
+                                                                    GST_STATIC_CAPS ("ANY")
+                                                                    );
+
+static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
+                                                                   GST_PAD_SRC,
+                                                                   GST_PAD_ALWAYS,
+                                                                   GST_STATIC_CAPS ("application/x-gzip; "
+                                                                                    "application/x-bzip")
+                                                                   );
+
+GType
+gst_gz_enc_format_get_type (void)
+{
+        static gsize format_type = 0;
+        static const GEnumValue formats[] = {
+                {GST_GZENC_FORMAT_GZIP, "Gzip", "gzip"},
+                {GST_GZENC_FORMAT_BZIP2, "Bzip2", "bzip2"},
+                {0, NULL, NULL}
+        };
+
+        if (g_once_init_enter (&format_type)) {
+                GType tmp = g_enum_register_static ("GstGzEncFormat", formats);
+                g_once_init_leave (&format_type, tmp);
+        }
+        return (GType) format_type;
+}
+
+#define gst_gz_enc_parent_class parent_class
+G_DEFINE_TYPE (GstGzEnc, gst_gz_enc, GST_TYPE_ELEMENT);
+
+// bzenc: gzenc defaulting to bzip2
+typedef GstGzEnc GstBzEnc;
+typedef GstGzEncClass GstBzEncClass;
+G_DEFINE_TYPE (GstBzEnc, gst_bz_enc, GST_TYPE_GZENC);
+
+static void gst_gz_enc_set_property (GObject * object, guint prop_id,
+                                     const GValue * value, GParamSpec * pspec);
+static void gst_gz_enc_get_property (GObject * object, guint prop_id,
+                                     GValue * value, GParamSpec * pspec);
+static void gst_gz_enc_finalize (GObject * object);
+
+static gboolean gst_gz_enc_sink_event (GstPad * pad, GstObject * parent, GstEvent * event);
+static GstFlowReturn gst_gz_enc_chain (GstPad * pad, GstObject * parent, GstBuffer * buf);
+
+static GstStateChangeReturn
+gst_gz_enc_change_state (GstElement *element, GstStateChange transition);
+
+/* GObject vmethod implementations */
+
+static void
+gst_gz_enc_class_init (GstGzEncClass * klass)
+{
+        GObjectClass *gobject_class = (GObjectClass *) klass;
+        GstElementClass *gstelement_class = (GstElementClass *) klass;
+
+        GST_DEBUG_CATEGORY_INIT (gst_gz_enc_debug, "gzenc", 0, "Parallel gzip/bzip2 encoder");
+
+        gobject_class->set_property = gst_gz_enc_set_property;
+        gobject_class->get_property = gst_gz_enc_get_property;
+        gobject_class->finalize = gst_gz_enc_finalize;
+
+        g_object_class_install_property (gobject_class, PROP_FORMAT,
+                                         g_param_spec_enum ("format", "Format",
+                                                            "Compression format of the output stream",
+                                                            GST_TYPE_GZENC_FORMAT, DEFAULT_FORMAT,
+                                                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_LEVEL,
+                                         g_param_spec_int ("level", "Level",
+                                                           "Compression level, 0 stores gzip blocks uncompressed (for bzip2 the block size in 100k units, at least 1)",
+                                                           0, 9, DEFAULT_LEVEL,
+                                                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_BLOCK_SIZE,
+                                         g_param_spec_uint ("block-size", "Block size",
+                                                            "Size of the input blocks compressed in parallel",
+                                                            DEFLATE_ENC_DICTIONARY_SIZE, G_MAXINT, DEFAULT_BLOCK_SIZE,
+                                                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+        g_object_class_install_property (gobject_class, PROP_THREADS,
+                                         g_param_spec_uint ("threads", "Threads",
+                                                            "Number of compression threads (0 = number of processors)",
+                                                            0, 1024, DEFAULT_THREADS,
+                                                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+        gst_element_class_set_details_simple(gstelement_class,
+                                             "Gzip encoder",
+                                             "Codec/Encoder",
+                                             "Compress data to gzip or bzip2 on several threads",
+                                             "Stephan Hesse <disparat@gmail.com>");
+
+        gst_element_class_add_pad_template (gstelement_class,
+                                            gst_static_pad_template_get (&src_factory));
+        gst_element_class_add_pad_template (gstelement_class,
+                                            gst_static_pad_template_get (&sink_factory));
+
+        gstelement_class->change_state = gst_gz_enc_change_state;
+}
+
+static void
+gst_gz_enc_init (GstGzEnc * filter)
+{
+        filter->sinkpad = gst_pad_new_from_static_template (&sink_factory, "sink");
+        gst_pad_set_event_function (filter->sinkpad,
+                                    GST_DEBUG_FUNCPTR(gst_gz_enc_sink_event));
+        gst_pad_set_chain_function (filter->sinkpad,
+                                    GST_DEBUG_FUNCPTR(gst_gz_enc_chain));
+        gst_element_add_pad (GST_ELEMENT (filter), filter->sinkpad);
+
+        filter->srcpad = gst_pad_new_from_static_template (&src_factory, "src");
+        gst_element_add_pad (GST_ELEMENT (filter), filter->srcpad);
+
+        // EOS event store
+        filter->pending_eos = NULL;
+        // queueing state flags
+        filter->input_task_resume = FALSE;
+        filter->srcpad_task_resume = FALSE;
+        // Queues
+        filter->input_queue = g_queue_new();
+        filter->output_queue = g_queue_new();
+        filter->jobs = g_queue_new();
+        // Init locks
+        g_mutex_init(&filter->input_queue_mutex);
+        g_mutex_init(&filter->output_queue_mutex);
+        g_mutex_init(&filter->jobs_mutex);
+        REC_MUTEX_INIT(&filter->input_task_mutex);
+        // queueing conds
+        g_cond_init(&filter->input_queue_run_cond);
+        g_cond_init(&filter->output_queue_run_cond);
+        g_cond_init(&filter->jobs_cond);
+        // Properties
+        filter->format = DEFAULT_FORMAT;
+        filter->level = DEFAULT_LEVEL;
+        filter->block_size = DEFAULT_BLOCK_SIZE;
+        filter->threads = DEFAULT_THREADS;
+        // Compression state
+        filter->pool = NULL;
+        filter->max_jobs = 0;
+        filter->stream_started = FALSE;
+        filter->block = g_byte_array_new();
+        filter->dictionary = NULL;
+        filter->header_written = FALSE;
+        filter->failed = FALSE;
+        filter->crc = crc32(0L, Z_NULL, 0);
+        filter->total_in = 0;
+
+        GST_INFO_OBJECT(filter, "Done initializing element");
+}
+
+static void
+gst_gz_enc_finalize (GObject * object)
+{
+        GstGzEnc *filter = GST_GZENC (object);
+
+        g_queue_free_full(filter->input_queue, (GDestroyNotify) gst_mini_object_unref);
+        g_queue_free_full(filter->output_queue, (GDestroyNotify) gst_mini_object_unref);
+        g_queue_free_full(filter->jobs, (GDestroyNotify) encoder_job_free);
+        g_mutex_clear(&filter->input_queue_mutex);
+        g_mutex_clear(&filter->output_queue_mutex);
+        g_mutex_clear(&filter->jobs_mutex);
+        g_cond_clear(&filter->input_queue_run_cond);
+        g_cond_clear(&filter->output_queue_run_cond);
+        g_cond_clear(&filter->jobs_cond);
+
+        g_byte_array_unref(filter->block);
+        if (filter->dictionary) {
+                g_bytes_unref(filter->dictionary);
+        }
+
+        G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_gz_enc_set_property (GObject * object, guint prop_id,
+                         const GValue * value, GParamSpec * pspec)
+{
+        GstGzEnc *filter = GST_GZENC (object);
+
+        GST_OBJECT_LOCK(filter);
+        switch (prop_id) {
+        case PROP_FORMAT:
+                filter->format = g_value_get_enum(value);
+                break;
+        case PROP_LEVEL:
+                filter->level = g_value_get_int(value);
+                break;
+        case PROP_BLOCK_SIZE:
+                filter->block_size = g_value_get_uint(value);
+                break;
+        case PROP_THREADS:
+                filter->threads = g_value_get_uint(value);
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+                break;
+        }
+        GST_OBJECT_UNLOCK(filter);
+}
+
+static void
+gst_gz_enc_get_property (GObject * object, guint prop_id,
+                         GValue * value, GParamSpec * pspec)
+{
+        GstGzEnc *filter = GST_GZENC (object);
+
+        GST_OBJECT_LOCK(filter);
+        switch (prop_id) {
+        case PROP_FORMAT:
+                g_value_set_enum(value, filter->format);
+                break;
+        case PROP_LEVEL:
+                g_value_set_int(value, filter->level);
+                break;
+        case PROP_BLOCK_SIZE:
+                g_value_set_uint(value, filter->block_size);
+                break;
+        case PROP_THREADS:
+                g_value_set_uint(value, filter->threads);
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+                break;
+        }
+        GST_OBJECT_UNLOCK(filter);
+}
+
+static GstStateChangeReturn
+gst_gz_enc_change_state (GstElement *element, GstStateChange transition)
+{
+        GstGzEnc *filter = GST_GZENC (element);
+        guint threads;
+
+        switch(transition) {
+        case GST_STATE_CHANGE_NULL_TO_READY:
+                GST_OBJECT_LOCK(filter);
+                filter->eos = FALSE;
+                threads = filter->threads ? filter->threads : g_get_num_processors();
+                filter->input_task = CREATE_TASK(input_task_func, filter);
+                filter->srcpad_task = CREATE_TASK(srcpad_task_func, filter);
+                GST_OBJECT_UNLOCK(filter);
+                GST_INFO_OBJECT(filter, "Compressing on %d threads", (int) threads);
+                filter->max_jobs = 2 * threads;
+                filter->pool = g_thread_pool_new(encoder_job_func, filter, threads, FALSE, NULL);
+                gst_task_set_lock(filter->input_task, &filter->input_task_mutex);
+                gst_task_set_lock(filter->srcpad_task, GST_PAD_GET_STREAM_LOCK(filter->srcpad));
+                gst_task_pause(filter->input_task);
+                break;
+        case GST_STATE_CHANGE_READY_TO_PAUSED:
+                INPUT_TASK_START(filter);
+                SRCPAD_TASK_START(filter);
+                break;
+        case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+                SRCPAD_TASK_START(filter);
+                break;
+        case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+                SRCPAD_TASK_PAUSE(filter);
+                break;
+        case GST_STATE_CHANGE_PAUSED_TO_READY:
+                SRCPAD_TASK_PAUSE(filter);
+                INPUT_TASK_PAUSE(filter);
+                break;
+        case GST_STATE_CHANGE_READY_TO_NULL:
+                SRCPAD_TASK_JOIN(filter);
+                INPUT_TASK_JOIN(filter);
+                // waits for running jobs, queued ones are dropped
+                if (filter->pool) {
+                        g_thread_pool_free(filter->pool, TRUE, TRUE);
+                        filter->pool = NULL;
+                }
+                reset_stream(filter);
+                if (filter->input_task) {
+                        g_object_unref(filter->input_task);
+                        filter->input_task = NULL;
+                }
+                if (filter->srcpad_task) {
+                        g_object_unref(filter->srcpad_task);
+                        filter->srcpad_task = NULL;
+                }
+                break;
+        default:
+                break;
+        }
+
+        return GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+}
+
+/* GstElement vmethod implementations */
+
+static gboolean
+gst_gz_enc_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+        GstGzEnc *filter = GST_GZENC (parent);
+        GstGzEncFormat format;
+        GstCaps *caps;
+        gboolean ret;
+
+        GST_LOG_OBJECT (filter, "Received %s event: %" GST_PTR_FORMAT,
+                        GST_EVENT_TYPE_NAME (event), event);
+
+        switch (GST_EVENT_TYPE (event)) {
+        case GST_EVENT_STREAM_START:
+                filter->eos = FALSE;
+                ret = gst_pad_event_default (pad, parent, event);
+                break;
+        case GST_EVENT_EOS:
+                GST_OBJECT_LOCK(filter);
+                filter->pending_eos = event;
+                GST_OBJECT_UNLOCK(filter);
+                INPUT_QUEUE_RESUME(filter);
+                ret = TRUE;
+                break;
+        case GST_EVENT_CAPS:
+                // whatever comes in, compressed data goes out
+                gst_event_unref (event);
+                GST_OBJECT_LOCK(filter);
+                format = filter->format;
+                GST_OBJECT_UNLOCK(filter);
+                caps = gst_caps_new_empty_simple (format == GST_GZENC_FORMAT_BZIP2 ?
+                                                  "application/x-bzip" : "application/x-gzip");
+                ret = gst_pad_set_caps (filter->srcpad, caps);
+                gst_caps_unref (caps);
+                break;
+        default:
+                ret = gst_pad_event_default (pad, parent, event);
+                break;
+        }
+        return ret;
+}
+
+static GstFlowReturn
+gst_gz_enc_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+{
+        GstGzEnc *filter = GST_GZENC (parent);
+
+        if (stream_failed(filter)) {
+                gst_buffer_unref(buf);
+                return GST_FLOW_ERROR;
+        }
+
+        GST_TRACE_OBJECT(filter, "Appending input buffer of %d bytes", (int) BUFFER_SIZE(buf));
+        input_queue_append_buffer(filter, buf);
+
+        return GST_FLOW_OK;
+}
+
+static void
+gst_bz_enc_class_init (GstBzEncClass * klass)
+{
+        GstElementClass *gstelement_class = (GstElementClass *) klass;
+
+        gst_element_class_set_details_simple(gstelement_class,
+                                             "Bzip2 encoder",
+                                             "Codec/Encoder",
+                                             "Compress data to bzip2 on several threads",
+                                             "Stephan Hesse <disparat@gmail.com>");
+}
+
+static void
+gst_bz_enc_init (GstBzEnc * filter)
+{
+        filter->format = GST_GZENC_FORMAT_BZIP2;
+        filter->level = 9;
+        filter->block_size = 900*1000;
+}
@@ -0,0 +1,164 @@
+/*
+ * GStreamer
+ * Copyright (C) 2005 Thomas Vander Stichele <thomas@apestaart.org>
+ * Copyright (C) 2005 Ronald S. Bultje <rbultje@ronald.bitfreak.net>
+ * Copyright (C) 2017 Stephan Hesse <<disparat@gmail.com>>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_GZENC_H__
+#define __GST_GZENC_H__
+
+#include <gst/gst.h>
+
+#include <gstgzdec_compat.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_GZENC \
+        (gst_gz_enc_get_type())
+#define GST_GZENC(obj) \
+        (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_GZENC,GstGzEnc))
+#define GST_GZENC_CLASS(klass) \
+        (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_GZENC,GstGzEncClass))
+#define GST_IS_GZENC(obj) \
+        (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_GZENC))
+#define GST_IS_GZENC_CLASS(klass) \
+        (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_GZENC))
+
+#define GST_TYPE_BZENC \
+        (gst_bz_enc_get_type())
+
+#define GST_TYPE_GZENC_FORMAT (gst_gz_enc_format_get_type())
+
+typedef struct _GstGzEnc GstGzEnc;
+typedef struct _GstGzEncClass GstGzEncClass;
+typedef struct _EncoderJob EncoderJob;
+
+typedef void (*GstGzEncFunc)(EncoderJob* job);
+
+typedef enum {
+        GST_GZENC_FORMAT_GZIP,
+        GST_GZENC_FORMAT_BZIP2
+} GstGzEncFormat;
+
+/* One block of input, compressed independently on a worker thread */
+struct _EncoderJob
+{
+        GBytes* input;
+        // last 32K of the previous block, primes deflate (pigz-style)
+        GBytes* dictionary;
+        gint level;
+        GstGzEncFunc encode_func;
+
+        // results
+        GBytes* output;
+        guint32 crc;
+        gboolean done;
+        // the codec failed, there is no output
+        gboolean failed;
+};
+
+struct _GstGzEnc
+{
+        GstElement element;
+
+        GstPad *sinkpad, *srcpad;
+
+        GQueue *input_queue;
+        GQueue *output_queue;
+
+        GstTask *input_task;
+        MUTEX input_task_mutex;
+        // runs under the srcpad stream lock like a pad task, see the decoder
+        GstTask *srcpad_task;
+
+        GCond output_queue_run_cond;
+        GCond input_queue_run_cond;
+
+        GMutex input_queue_mutex;
+        GMutex output_queue_mutex;
+
+        GstEvent* pending_eos;
+
+        gboolean eos;
+        gboolean srcpad_task_resume;
+        gboolean input_task_resume;
+
+        // properties
+        GstGzEncFormat format;
+        gint level;
+        guint block_size;
+        guint threads;
+
+        // block compression state
+        GThreadPool* pool;
+        // at most this many blocks in flight, the input task waits beyond
+        guint max_jobs;
+        // the properties for the stream being compressed, taken at its start
+        gboolean stream_started;
+        GstGzEncFormat stream_format;
+        gint stream_level;
+        guint stream_block_size;
+        GByteArray* block;
+        GBytes* dictionary;
+        // jobs in submission order, output is flushed in that order
+        GQueue* jobs;
+        GMutex jobs_mutex;
+        GCond jobs_cond;
+        // a block failed to compress, the stream is broken from there on (jobs lock)
+        gboolean failed;
+        gboolean header_written;
+        guint32 crc;
+        guint64 total_in;
+};
+
+struct _GstGzEncClass
+{
+        GstElementClass parent_class;
+};
+
+GType gst_gz_enc_get_type (void);
+GType gst_bz_enc_get_type (void);
+GType gst_gz_enc_format_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GST_GZENC_H__ */
@@ -0,0 +1,26 @@
+#pragma once
+
+/* This is a block-wise bzip2 writer.
+
+   Every block becomes a complete bzip2 stream of its own (as pbzip2 does),
+   concatenated bzip2 streams decompress to the concatenated data. */
+
+static void bzip_block_encode(EncoderJob* job) {
+        gsize size;
+        const guchar* data = g_bytes_get_data(job->input, &size);
+        // documented worst case: 1% larger plus 600 bytes
+        unsigned int out_size = size + size / 100 + 600;
+        gchar* out = g_malloc(out_size);
+        int ret;
+
+        // there is no level 0 in bzip2, it is the smallest block size
+        ret = BZ2_bzBuffToBuffCompress(out, &out_size, (char*) data, size,
+                                       CLAMP(job->level, 1, 9), 0, 0);
+        if (ret != BZ_OK) {
+                GST_ERROR("Got code %d when calling BZ2_bzBuffToBuffCompress", ret);
+                job->failed = TRUE;
+                out_size = 0;
+        }
+
+        job->output = g_bytes_new_take(out, out_size);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+/* This is a block-wise gzip writer on top of Zlib deflate.
+
+   Like pigz does, each block is raw deflate primed with the last 32K of the previous block
+   and ended with a sync flush (no final bit), so blocks can be compressed concurrently and simply
+   be concatenated. The stream is closed with an empty final block and the gzip trailer, where
+   the CRC-32 of all blocks is combined in order. */
+
+#define DEFLATE_ENC_DICTIONARY_SIZE 32*1024
+#define DEFLATE_ENC_MEM_LEVEL 8
+
+static const guchar deflate_enc_gzip_header[] = {
+        0x1f, 0x8b, // magic
+        0x08, // deflate
+        0x00, // flags
+        0x00, 0x00, 0x00, 0x00, // mtime
+        0x00, // extra flags
+        0x03 // OS: unix
+};
+
+// an empty static block with the final bit set
+static const guchar deflate_enc_last_block[] = { 0x03, 0x00 };
+
+static void deflate_block_encode(EncoderJob* job) {
+        z_stream strm;
+        gsize size;
+        const guchar* data = g_bytes_get_data(job->input, &size);
+        GByteArray* out;
+        gsize have = 0;
+        int ret;
+
+        memset(&strm, 0, sizeof(strm));
+        ret = deflateInit2(&strm, job->level, Z_DEFLATED, -MAX_WBITS,
+                           DEFLATE_ENC_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+        if (ret != Z_OK) {
+                GST_ERROR("Got code %d when calling Zlib deflateInit2", ret);
+                job->failed = TRUE;
+                job->output = g_bytes_new(NULL, 0);
+                return;
+        }
+
+        if (job->dictionary) {
+                gsize dict_size;
+                gconstpointer dict = g_bytes_get_data(job->dictionary, &dict_size);
+                ret = deflateSetDictionary(&strm, dict, (uInt) dict_size);
+                if (ret != Z_OK) {
+                        GST_ERROR("Got code %d when calling Zlib deflateSetDictionary", ret);
+                        job->failed = TRUE;
+                        job->output = g_bytes_new(NULL, 0);
+                        deflateEnd(&strm);
+                        return;
+                }
+        }
+
+        // sync flush adds a few bytes on top of the bound
+        out = g_byte_array_new();
+        g_byte_array_set_size(out, deflateBound(&strm, size) + 16);
+
+        strm.next_in = (Bytef*) data;
+        strm.avail_in = size;
+
+        for (;;) {
+                strm.next_out = out->data + have;
+                strm.avail_out = out->len - have;
+                ret = deflate(&strm, Z_SYNC_FLUSH);
+                have = out->len - strm.avail_out;
+                if (ret != Z_OK || strm.avail_out != 0) {
+                        break;
+                }
+                // only if the bound was wrong
+                g_byte_array_set_size(out, out->len * 2);
+        }
+
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                GST_ERROR("Zlib deflate returned %d", ret);
+                job->failed = TRUE;
+        }
+
+        g_byte_array_set_size(out, have);
+        deflateEnd(&strm);
+
+        job->crc = crc32(crc32(0L, Z_NULL, 0), data, (uInt) size);
+        job->output = g_byte_array_free_to_bytes(out);
+}
+
+static GBytes* deflate_stream_header(void) {
+        return g_bytes_new_static(deflate_enc_gzip_header, sizeof(deflate_enc_gzip_header));
+}
+
+static GBytes* deflate_stream_trailer(guint32 crc, guint64 total_in) {
+        guchar* trailer = g_malloc(sizeof(deflate_enc_last_block) + 8);
+        memcpy(trailer, deflate_enc_last_block, sizeof(deflate_enc_last_block));
+        GST_WRITE_UINT32_LE(trailer + 2, crc);
+        GST_WRITE_UINT32_LE(trailer + 6, (guint32) total_in);
+        return g_bytes_new_take(trailer, sizeof(deflate_enc_last_block) + 8);
+}
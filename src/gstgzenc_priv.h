@@ -0,0 +1,359 @@
+#pragma once
+
+// Mutex convenience macros, the queue and task ones are in gstgz_queue.h
+
+#define JOBS_LOCK(element) g_mutex_lock(&element->jobs_mutex)
+#define JOBS_UNLOCK(element) g_mutex_unlock(&element->jobs_mutex)
+#define JOBS_WAIT(element) g_cond_wait(&element->jobs_cond, &element->jobs_mutex)
+#define JOBS_SIGNAL(element) g_cond_broadcast(&element->jobs_cond)
+
+// Encoder implementation adapters, same as on the decoder side.
+
+// Gzip
+#define DEFLATE_ENCODER_ENCODE deflate_block_encode
+#define DEFLATE_ENCODER_HEADER deflate_stream_header
+#define DEFLATE_ENCODER_TRAILER deflate_stream_trailer
+// Bzip
+#define BZIP_ENCODER_ENCODE bzip_block_encode
+
+static void srcpad_task_func(gpointer user_data);
+static void output_queue_append_bytes (GstGzEnc *filter, GBytes* bytes);
+
+static void encoder_job_free (EncoderJob* job) {
+        g_bytes_unref(job->input);
+        if (job->dictionary) {
+                g_bytes_unref(job->dictionary);
+        }
+        if (job->output) {
+                g_bytes_unref(job->output);
+        }
+        g_free(job);
+}
+
+// Call with the jobs lock held. Hands the output of all finished jobs
+// at the head of the queue to the output queue, so blocks keep their order.
+static void jobs_flush_done (GstGzEnc* filter) {
+        EncoderJob* job;
+
+        while ((job = g_queue_peek_head(filter->jobs)) && job->done) {
+                g_queue_pop_head(filter->jobs);
+                // nothing after a failed block would decompress
+                filter->failed |= job->failed;
+                if (filter->failed) {
+                        encoder_job_free(job);
+                        continue;
+                }
+                if (filter->stream_format == GST_GZENC_FORMAT_GZIP) {
+                        filter->crc = crc32_combine(filter->crc, job->crc,
+                                                    (z_off_t) g_bytes_get_size(job->input));
+                }
+                output_queue_append_bytes(filter, job->output);
+                encoder_job_free(job);
+        }
+}
+
+// Runs on the worker threads of the pool
+static void encoder_job_func (gpointer data, gpointer user_data) {
+        EncoderJob* job = data;
+        GstGzEnc* filter = GST_GZENC(user_data);
+        gboolean failed;
+
+        GST_TRACE_OBJECT(filter, "Encoding block of %d bytes", (int) g_bytes_get_size(job->input));
+
+        job->encode_func(job);
+
+        JOBS_LOCK(filter);
+        job->done = TRUE;
+        // the job might be freed by the flush
+        failed = job->failed;
+        jobs_flush_done(filter);
+        JOBS_SIGNAL(filter);
+        JOBS_UNLOCK(filter);
+
+        if (failed) {
+                GST_ELEMENT_ERROR (filter, STREAM, ENCODE, ("Failed to compress a block"), (NULL));
+        }
+}
+
+// The chain returns an error once a block failed, rather than going on with a corrupt stream
+static gboolean stream_failed (GstGzEnc* filter) {
+        gboolean failed;
+
+        JOBS_LOCK(filter);
+        failed = filter->failed;
+        JOBS_UNLOCK(filter);
+        return failed;
+}
+
+// Takes the properties for the whole stream, changes apply from the next one on
+static void stream_setup (GstGzEnc* filter) {
+        GST_OBJECT_LOCK(filter);
+        filter->stream_format = filter->format;
+        filter->stream_level = filter->level;
+        filter->stream_block_size = filter->block_size;
+        GST_OBJECT_UNLOCK(filter);
+        filter->stream_started = TRUE;
+}
+
+// Hands the current block over to the pool as a job
+static void submit_block (GstGzEnc* filter) {
+        EncoderJob* job = g_new0(EncoderJob, 1);
+        gsize size = filter->block->len;
+        gsize tail;
+
+        job->input = g_byte_array_free_to_bytes(filter->block);
+        filter->block = g_byte_array_sized_new(filter->stream_block_size);
+
+        job->level = filter->stream_level;
+        filter->total_in += size;
+
+        if (filter->stream_format == GST_GZENC_FORMAT_GZIP) {
+                job->encode_func = DEFLATE_ENCODER_ENCODE;
+                job->dictionary = filter->dictionary;
+                tail = MIN(size, DEFLATE_ENC_DICTIONARY_SIZE);
+                filter->dictionary = g_bytes_new_from_bytes(job->input, size - tail, tail);
+        } else {
+                job->encode_func = BZIP_ENCODER_ENCODE;
+        }
+
+        // the header must go out before any block can be flushed
+        if (!filter->header_written) {
+                filter->header_written = TRUE;
+                if (filter->stream_format == GST_GZENC_FORMAT_GZIP) {
+                        GBytes* header = DEFLATE_ENCODER_HEADER();
+                        output_queue_append_bytes(filter, header);
+                        g_bytes_unref(header);
+                }
+        }
+
+        // finished blocks wait for the ones before them, this bounds how many are held
+        JOBS_LOCK(filter);
+        while (g_queue_get_length(filter->jobs) >= filter->max_jobs) {
+                JOBS_WAIT(filter);
+        }
+        g_queue_push_tail(filter->jobs, job);
+        JOBS_UNLOCK(filter);
+
+        GST_TRACE_OBJECT(filter, "Submitting block of %d bytes", (int) size);
+
+        g_thread_pool_push(filter->pool, job, NULL);
+}
+
+// Drops any pending data and jobs, call when no worker is running anymore
+static void reset_stream (GstGzEnc* filter) {
+        EncoderJob* job;
+
+        JOBS_LOCK(filter);
+        while ((job = g_queue_pop_head(filter->jobs))) {
+                encoder_job_free(job);
+        }
+        filter->failed = FALSE;
+        JOBS_UNLOCK(filter);
+
+        g_byte_array_set_size(filter->block, 0);
+        filter->stream_started = FALSE;
+        filter->header_written = FALSE;
+        filter->total_in = 0;
+        filter->crc = crc32(0L, Z_NULL, 0);
+        if (filter->dictionary) {
+                g_bytes_unref(filter->dictionary);
+                filter->dictionary = NULL;
+        }
+}
+
+// Submits the last partial block, waits for all jobs and closes the stream
+static void finish_stream (GstGzEnc* filter) {
+        GBytes* trailer;
+
+        // an empty stream still gets a header and trailer
+        if (!filter->stream_started) {
+                stream_setup(filter);
+        }
+
+        if (filter->block->len > 0 || !filter->header_written) {
+                submit_block(filter);
+        }
+
+        JOBS_LOCK(filter);
+        while (!g_queue_is_empty(filter->jobs)) {
+                JOBS_WAIT(filter);
+        }
+        JOBS_UNLOCK(filter);
+
+        // the error is posted already, a trailer would only make the stream look complete
+        if (filter->stream_format == GST_GZENC_FORMAT_GZIP && !stream_failed(filter)) {
+                trailer = DEFLATE_ENCODER_TRAILER(filter->crc, filter->total_in);
+                output_queue_append_bytes(filter, trailer);
+                g_bytes_unref(trailer);
+        }
+
+        // ready for a next stream
+        reset_stream(filter);
+}
+
+static void push_one_output_buffer (GstGzEnc* filter, GstBuffer* buf) {
+        GstCaps* caps;
+        GstFlowReturn ret;
+
+        GST_TRACE_OBJECT (filter, "Pushing one buffer");
+
+        // upstream might not have sent any caps, the stream has started by now
+        if (G_UNLIKELY(!gst_pad_has_current_caps (filter->srcpad))) {
+                caps = gst_caps_new_empty_simple (filter->stream_format == GST_GZENC_FORMAT_BZIP2 ?
+                                                  "application/x-bzip" : "application/x-gzip");
+                gst_pad_set_caps (filter->srcpad, caps);
+                gst_caps_unref (caps);
+        }
+
+        ret = gst_pad_push (filter->srcpad, buf);
+
+        if (ret != GST_FLOW_OK) {
+                GST_ERROR_OBJECT (filter, "Flow returned: %s", gst_flow_get_name (ret));
+        }
+}
+
+static void srcpad_check_pending_eos (GstGzEnc* filter) {
+        GstEvent *event = NULL;
+
+        GST_OBJECT_LOCK(filter);
+        if (filter->eos && filter->pending_eos) {
+                GST_INFO_OBJECT (filter, "Dispatching pending EOS!");
+                event = filter->pending_eos;
+                // make sure we don't dispatch it twice
+                filter->pending_eos = NULL;
+        }
+        GST_OBJECT_UNLOCK(filter);
+
+        if (event) {
+                if (!gst_pad_event_default (filter->sinkpad, GST_OBJECT(filter), event)) {
+                        GST_WARNING_OBJECT(filter, "Failed to propagate pending EOS event: %" GST_PTR_FORMAT, event);
+                }
+        }
+}
+
+static void srcpad_task_func(gpointer user_data) {
+        GstGzEnc* filter = GST_GZENC(user_data);
+        gpointer data;
+
+        OUTPUT_QUEUE_LOCK(filter);
+        data = g_queue_pop_head (filter->output_queue);
+        OUTPUT_QUEUE_UNLOCK(filter);
+
+        if (data) {
+                push_one_output_buffer (filter, GST_BUFFER(data));
+        }
+
+        // output queue is currently empty, check if we should send EOS
+        OUTPUT_QUEUE_LOCK(filter);
+        while (g_queue_get_length (filter->output_queue) == 0 && !filter->srcpad_task_resume) {
+                srcpad_check_pending_eos(filter);
+                OUTPUT_QUEUE_WAIT(filter);
+        }
+        filter->srcpad_task_resume = FALSE;
+        OUTPUT_QUEUE_UNLOCK(filter);
+}
+
+static void process_one_input_buffer (GstGzEnc* filter, GstBuffer* buf) {
+        GstMapInfo map;
+        const guint8* data;
+        gsize left, n;
+
+        GST_TRACE_OBJECT (filter, "Processing one input buffer: %" GST_PTR_FORMAT, buf);
+
+        if (!filter->stream_started) {
+                stream_setup(filter);
+        }
+
+        if (!gst_buffer_map(buf, &map, GST_MAP_READ)) {
+                GST_ERROR_OBJECT (filter, "Error mapping buffer for read access: %" GST_PTR_FORMAT, buf);
+                return;
+        }
+
+        // the buffer is cut into blocks as it is copied in, so every byte is copied once
+        data = map.data;
+        left = map.size;
+        while (left > 0) {
+                n = MIN(left, filter->stream_block_size - filter->block->len);
+                g_byte_array_append(filter->block, data, (guint) n);
+                data += n;
+                left -= n;
+                if (filter->block->len == filter->stream_block_size) {
+                        submit_block(filter);
+                }
+        }
+
+        gst_buffer_unmap(buf, &map);
+}
+
+static GstBuffer* input_queue_pop_buffer (GstGzEnc *filter) {
+        gpointer data;
+
+        INPUT_QUEUE_LOCK(filter);
+        data = g_queue_pop_head (filter->input_queue);
+        INPUT_QUEUE_UNLOCK(filter);
+
+        return GST_BUFFER(data);
+}
+
+static void input_task_func (gpointer data) {
+
+        GstGzEnc *filter = GST_GZENC (data);
+        GstBuffer* buf;
+        gboolean eos = FALSE;
+
+        buf = input_queue_pop_buffer (filter);
+        if (buf != NULL) {
+                process_one_input_buffer(filter, buf);
+                gst_buffer_unref(buf);
+        } else {
+                GST_OBJECT_LOCK(filter);
+                // There is an EOS event pending and the input queue is fully processed
+                eos = filter->pending_eos && !filter->eos;
+                GST_OBJECT_UNLOCK(filter);
+
+                if (eos) {
+                        // this blocks until all blocks are compressed
+                        finish_stream(filter);
+                        GST_OBJECT_LOCK(filter);
+                        GST_DEBUG_OBJECT(filter, "Setting EOS flag");
+                        filter->eos = TRUE;
+                        GST_OBJECT_UNLOCK(filter);
+                        OUTPUT_QUEUE_RESUME(filter);
+                }
+
+                // Wait around empty queue condition
+                INPUT_QUEUE_LOCK(filter);
+                while(g_queue_get_length(filter->input_queue) == 0
+                      && !filter->input_task_resume) {
+                        INPUT_QUEUE_WAIT(filter);
+                }
+                // reset resume flag in case it was set before signal
+                filter->input_task_resume = FALSE;
+                INPUT_QUEUE_UNLOCK(filter);
+        }
+}
+
+static void input_queue_append_buffer (GstGzEnc *filter, GstBuffer* buf) {
+        INPUT_QUEUE_LOCK(filter);
+        g_queue_push_tail (filter->input_queue, buf);
+        INPUT_QUEUE_SIGNAL(filter);
+        INPUT_QUEUE_UNLOCK(filter);
+}
+
+static void output_queue_append_bytes (GstGzEnc *filter, GBytes* bytes) {
+
+        GstBuffer* buf;
+
+        if (g_bytes_get_size(bytes) == 0) {
+                return;
+        }
+
+        buf = BUFFER_NEW_WRAPPED_BYTES(bytes);
+
+        GST_TRACE_OBJECT (filter, "Queueing new output buffer: %" GST_PTR_FORMAT, buf);
+
+        OUTPUT_QUEUE_LOCK(filter);
+        g_queue_push_tail (filter->output_queue, buf);
+        OUTPUT_QUEUE_SIGNAL(filter);
+        OUTPUT_QUEUE_UNLOCK(filter);
+}
@@ -13,18 +13,116 @@ export GST_DEBUG="*:2,gzdec:6"
 
 gst-inspect-1.0 | grep gzdec
 
+# compares an output with what it should be, the suite goes on either way
+check () {
+        cmp "$1" "$2" && echo "OK: $2" || echo "FAILED: $2 differs from $1"
+}
+
 echo "\nProducing test data":
 
 cat test/test.tiff | zlib-flate -compress > test/test.tiff.zip
 cat test/test.tiff | bzip2 -zc > test/test.tiff.bzip
+cat test/test.tiff | gzip -c > test/test.tiff.gz
 
 echo "\nLaunching zlib pipeline:\n"
 
 gst-launch-1.0 filesrc location=test/test.tiff.zip ! gzdec ! filesink location=test/test.out.zip.tiff
+check test/test.tiff test/test.out.zip.tiff
 
 echo "\nLaunching bzip pipeline:\n"
 
 gst-launch-1.0 filesrc location=test/test.tiff.bzip ! gzdec ! filesink location=test/test.out.bzip.tiff
+check test/test.tiff test/test.out.bzip.tiff
+
+echo "\nLaunching gzip pipeline:\n"
+
+gst-launch-1.0 filesrc location=test/test.tiff.gz ! gzdec ! filesink location=test/test.out.gz.tiff
+check test/test.tiff test/test.out.gz.tiff
+
+echo "\nLaunching tar.gz pipeline:\n"
+
+tar -czf test/test.tiff.tar.gz -C test test.tiff
+gst-launch-1.0 filesrc location=test/test.tiff.tar.gz ! gzdec tar=true entry-filter="*.tiff" ! filesink location=test/test.out.tar.tiff
+check test/test.tiff test/test.out.tar.tiff
+
+echo "\nLaunching PKZIP archive pipeline:\n"
+
+(cd test && zip -q -j test.tiff.pkzip.zip test.tiff)
+gst-launch-1.0 filesrc location=test/test.tiff.pkzip.zip ! gzdec format=zip entry-filter="*.tiff" ! filesink location=test/test.out.pkzip.tiff
+check test/test.tiff test/test.out.pkzip.tiff
+
+echo "\nLaunching mixed gzip + bzip pipeline:\n"
+
+cat test/test.tiff.gz test/test.tiff.bzip > test/test.tiff.mixed
+cat test/test.tiff test/test.tiff > test/test.tiff.twice
+gst-launch-1.0 filesrc location=test/test.tiff.mixed ! gzdec ! filesink location=test/test.out.mixed
+check test/test.tiff.twice test/test.out.mixed
+
+echo "\nLaunching concatenated streams split at the buffer boundary:\n"
+
+# the first buffer ends right at the end of the first stream, decoding restarts on the second buffer
+cat test/test.tiff.gz test/test.tiff.gz > test/test.tiff.gz.twice
+gst-launch-1.0 filesrc location=test/test.tiff.gz.twice blocksize="$(wc -c < test/test.tiff.gz)" ! gzdec ! filesink location=test/test.out.gz.twice
+check test/test.tiff.twice test/test.out.gz.twice
+cat test/test.tiff.bzip test/test.tiff.bzip > test/test.tiff.bzip.twice
+gst-launch-1.0 filesrc location=test/test.tiff.bzip.twice blocksize="$(wc -c < test/test.tiff.bzip)" ! gzdec ! filesink location=test/test.out.bzip.twice
+check test/test.tiff.twice test/test.out.bzip.twice
+
+echo "\nLaunching bzip pipeline twice through the cache (miss, then hit):\n"
+
+rm -rf test/cache
+gst-launch-1.0 filesrc location=test/test.tiff.bzip ! gzdec cache-dir=test/cache ! filesink location=test/test.out.cache-miss.tiff
+check test/test.tiff test/test.out.cache-miss.tiff
+gst-launch-1.0 filesrc location=test/test.tiff.bzip ! gzdec cache-dir=test/cache ! filesink location=test/test.out.cache-hit.tiff
+check test/test.tiff test/test.out.cache-hit.tiff
+
+echo "\nLaunching sparse pipeline on a mostly empty image:\n"
+
+(head -c 1048576 /dev/zero; cat test/test.tiff; head -c 1048576 /dev/zero) > test/test.sparse.img
+gzip -c test/test.sparse.img > test/test.sparse.img.gz
+gst-launch-1.0 filesrc location=test/test.sparse.img.gz ! gzdec sparse=true ! filesink location=test/test.out.sparse.img
+check test/test.sparse.img test/test.out.sparse.img
+
+echo "\nLaunching record split pipeline:\n"
+
+gst-launch-1.0 filesrc location=test/test.tiff.gz ! gzdec split=record record-size=4096 ! filesink location=test/test.out.split.tiff
+check test/test.tiff test/test.out.split.tiff
+
+echo "\nLaunching delimiter split pipeline with a record size cap:\n"
+
+# the delimiter never shows up, the partial record is pushed every 64 KiB
+gst-launch-1.0 filesrc location=test/test.tiff.gz ! gzdec split=delimiter delimiter="@@gzdec@@" max-record-size=65536 ! filesink location=test/test.out.split.capped.tiff
+check test/test.tiff test/test.out.split.capped.tiff
+
+echo "\nLaunching recover pipeline on a corrupt first gzip member:\n"
+
+# the second member has to come out whole after the damage in the first one
+cat test/test.tiff.gz test/test.tiff.gz > test/test.corrupt.gz
+printf 'corrupt corrupt corrupt corrupt ' | dd of=test/test.corrupt.gz bs=1 seek=10000 conv=notrunc 2>/dev/null
+gst-launch-1.0 filesrc location=test/test.corrupt.gz ! gzdec recover=true ! filesink location=test/test.out.recover.tiff
+tail -c "$(wc -c < test/test.tiff)" test/test.out.recover.tiff > test/test.out.recover.tail.tiff
+check test/test.tiff test/test.out.recover.tail.tiff
+
+echo "\nLaunching max-output-bytes pipeline, which has to fail:\n"
+
+if gst-launch-1.0 filesrc location=test/test.tiff.gz ! gzdec max-output-bytes=65536 ! fakesink; then
+        echo "FAILED: max-output-bytes did not stop the stream"
+else
+        echo "OK: max-output-bytes stopped the stream"
+fi
+
+echo "\nLaunching validate-only pipeline:\n"
+
+gst-launch-1.0 -m filesrc location=test/test.tiff.gz ! gzdec validate-only=true checksums=crc32 ! fakesink | grep gzdec-validate
+
+echo "\nLaunching gzenc/gzdec round trip:\n"
+
+gst-launch-1.0 filesrc location=test/test.tiff ! gzenc ! gzdec ! filesink location=test/test.out.gzenc.tiff
+check test/test.tiff test/test.out.gzenc.tiff
+
+gst-launch-1.0 filesrc location=test/test.tiff ! gzenc level=0 ! filesink location=test/test.out.stored.gz
+gunzip -c test/test.out.stored.gz > test/test.out.stored.tiff
+check test/test.tiff test/test.out.stored.tiff
 
 echo "\n"
 